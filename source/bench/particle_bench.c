@@ -0,0 +1,412 @@
+// Copyright [2025] [Nicholas Walton]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Particle update microbenchmark. Times ParticlesUpdate on a full default pool against the original version, which shifted every later particle down for each one removed, and checks that both leave exactly the same particles in the same order.
+// Usage: particle_bench [-f frames] [-n particles] [-t threads]
+// Also times CreateParticlesFromSprite against the original, which tested every pixel and called cos and sin for each particle.
+// steady keeps the system full of particles with random lifetimes, burst fills it with particles which all expire on the same frame, like a big explosion, and boundary has particles which never expire flying off the edges. -n sizes the default pool through ParticlesConfigure, PARTICLES_DEFAULT_CAPACITY by default. -t splits the update between threads with ParticlesSetThreads, and saved is the time ParticlesUpdateStats says they took off it. Then the steady scene runs on a pool of only a few chunks with more threads than chunks, and with fewer threads than were started. Last, overflow adds past the capacity of a replace_oldest and a drop_new emitter, and checks the order of what's left and the replaced and dropped counts, on one thread and on four.
+
+#include "framework.c"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+update_data_t update_data = {};
+render_data_t render_data = {};
+bool quit = false;
+
+typedef struct {
+	vec2i32split_t *position;
+	u8 *pixel;
+	v2i32 *velocity;
+	int count;
+	bool *gravity;
+	int *time;
+} particles_t;
+
+// An emitter's pool, in the framework's particle storage
+static particles_t EmitterPool (particle_emitter_t emitter) {
+	const auto pool = &particles.pools[emitter.index];
+	return (particles_t){
+		.position = &particles.position[pool->first],
+		.pixel = &particles.pixel[pool->first],
+		.velocity = &particles.velocity[pool->first],
+		.count = pool->count,
+		.gravity = &particles.gravity[pool->first],
+		.time = &particles.time[pool->first],
+	};
+}
+#define DefaultPool() EmitterPool (PARTICLE_EMITTER_DEFAULT)
+
+static void ParticlesCopy (particles_t *to, const particles_t *from) {
+	const int n = to->count = from->count;
+	memcpy (to->position, from->position, n * sizeof (to->position[0]));
+	memcpy (to->velocity, from->velocity, n * sizeof (to->velocity[0]));
+	memcpy (to->pixel, from->pixel, n * sizeof (to->pixel[0]));
+	memcpy (to->gravity, from->gravity, n * sizeof (to->gravity[0]));
+	memcpy (to->time, from->time, n * sizeof (to->time[0]));
+}
+
+// ParticlesUpdate and ParticleDelete as they were, for comparison
+static void ReferenceDelete (particles_t *particles, int index) {
+	if (particles->count == 0) return;
+	--particles->count;
+	for (int i = index; i < particles->count; ++i) {
+		particles->position[i] = particles->position[i+1];
+		particles->velocity[i] = particles->velocity[i+1];
+		particles->pixel[i] = particles->pixel[i+1];
+		particles->gravity[i] = particles->gravity[i+1];
+		particles->time[i] = particles->time[i+1];
+	}
+}
+
+static void ReferenceUpdate (particles_t *particles, int left, int right, int bottom, int top) {
+	for (int i = 0; i < particles->count; ++i) {
+		if (particles->gravity[i])
+			particles->velocity[i].y += PARTICLE_GRAVITY;
+		if (particles->time[i]) {
+			if (--particles->time[i] == 0) {
+				ReferenceDelete (particles, i--);
+				continue;
+			}
+		}
+		particles->position[i].x.i32 += particles->velocity[i].x;
+		particles->position[i].y.i32 += particles->velocity[i].y;
+		int x = particles->position[i].x.high;
+		int y = particles->position[i].y.high;
+		if (x < left || x > right || y < bottom || y > top) {
+			ReferenceDelete (particles, i--);
+		}
+	}
+}
+
+// A full pool as a queue: replace_oldest takes the first particle off the front to make room, which keeps the rest in age order. Counts what the policy lost.
+static void ReferenceAdd (particles_t *particles, int capacity, particles_overflow_e overflow, u32 *lost, u8 pixel, int x, int y, i32 vx, i32 vy, int time) {
+	if (particles->count == capacity) {
+		++*lost;
+		if (overflow == particles_overflow_drop_new) return;
+		ReferenceDelete (particles, 0);
+	}
+	const int i = particles->count++;
+	particles->pixel[i] = pixel;
+	particles->position[i] = (vec2i32split_t){.x.high = x, .y.high = y};
+	particles->velocity[i] = (v2i32){vx, vy};
+	particles->gravity[i] = true;
+	particles->time[i] = time;
+}
+
+// CreateParticlesFromSprite as it was, for comparison
+static void ReferenceCreateParticlesFromSprite (const sprite_t *sprite, int x, int y, f32 direction, i32 velocity, CreateParticlesFromSprite_arguments arguments) {
+	enum {CPFSFLIP_NONE, CPFSFLIP_Y, CPFSFLIP_X, CPFSFLIP_BOTH} flip = (arguments.flipx ? 2 : 0) | (arguments.flipy ? 1 : 0);
+    auto w = sprite->w;
+    auto h = sprite->h;
+	f32 c = cos_turns (arguments.rotation);
+	f32 s = sin_turns (arguments.rotation);
+	switch (flip) {
+		case CPFSFLIP_NONE: {
+			for (int sy = 0; sy < h; ++sy) {
+				for (int sx = 0; sx < w; ++sx) {
+					u8 p = sprite->p[sx + sy * w];
+					int tx = sx - arguments.originx;
+					int ty = sy - arguments.originy;
+					int rx = c*tx - s*ty;
+					int ry = s*tx + c*ty;
+					if (p != 0)
+						ParticleAddAngleVelocity (arguments.color ? arguments.color : p, x + rx, y + ry, direction + DiscreteRandom_Rangef (&random_state, -0.01, 0.01), velocity + DiscreteRandom_Range (&random_state, -16384, 16384));
+				}
+			}
+		} break;
+		case CPFSFLIP_X: {
+			// x += w-1;
+			for (int sy = 0; sy < h; ++sy) {
+				for (int sx = 0; sx < w; ++sx) {
+					u8 p = sprite->p[sx + sy * w];
+					int tx = sx - arguments.originx;
+					int ty = sy - arguments.originy;
+					int rx = c*tx - s*ty;
+					int ry = s*tx + c*ty;
+					if (p != 0)
+						ParticleAddAngleVelocity (arguments.color ? arguments.color : p, x - rx, y + ry, direction + DiscreteRandom_Rangef (&random_state, -0.01, 0.01), velocity + DiscreteRandom_Range (&random_state, -16384, 16384));
+				}
+			}
+		} break;
+		case CPFSFLIP_Y: {
+			// y += h-1;
+			for (int sy = 0; sy < h; ++sy) {
+				for (int sx = 0; sx < w; ++sx) {
+					u8 p = sprite->p[sx + sy * w];
+					int tx = sx - arguments.originx;
+					int ty = sy - arguments.originy;
+					int rx = c*tx - s*ty;
+					int ry = s*tx + c*ty;
+					if (p != 0)
+						ParticleAddAngleVelocity (arguments.color ? arguments.color : p, x + rx, y - ry, direction + DiscreteRandom_Rangef (&random_state, -0.01, 0.01), velocity + DiscreteRandom_Range (&random_state, -16384, 16384));
+				}
+			}
+		} break;
+		case CPFSFLIP_BOTH: {
+			// x += w-1;
+			// y += h-1;
+			for (int sy = 0; sy < h; ++sy) {
+				for (int sx = 0; sx < w; ++sx) {
+					u8 p = sprite->p[sx + sy * w];
+					int tx = sx - arguments.originx;
+					int ty = sy - arguments.originy;
+					int rx = c*tx - s*ty;
+					int ry = s*tx + c*ty;
+					if (p != 0)
+						ParticleAddAngleVelocity (arguments.color ? arguments.color : p, x - rx, y - ry, direction + DiscreteRandom_Rangef (&random_state, -0.01, 0.01), velocity + DiscreteRandom_Range (&random_state, -16384, 16384));
+				}
+			}
+		} break;
+	}
+}
+
+static bool ParticlesMatch (const particles_t *a, const particles_t *b) {
+	if (a->count != b->count) return false;
+	const int n = a->count;
+	return memcmp (a->position, b->position, n * sizeof (a->position[0])) == 0
+		&& memcmp (a->velocity, b->velocity, n * sizeof (a->velocity[0])) == 0
+		&& memcmp (a->pixel, b->pixel, n * sizeof (a->pixel[0])) == 0
+		&& memcmp (a->gravity, b->gravity, n * sizeof (a->gravity[0])) == 0
+		&& memcmp (a->time, b->time, n * sizeof (a->time[0])) == 0;
+}
+
+typedef enum {scene_steady, scene_burst, scene_boundary, scene_count} scene_e;
+static const char *const scene_names[scene_count] = {"steady", "burst", "boundary"};
+
+// Tops the default pool back up to capacity for the scene
+static void Fill (scene_e scene, u64 *random_state, int frame) {
+	#define R(__min__, __max__) DiscreteRandom_Range (random_state, __min__, __max__)
+	while (particles.pools[0].count < particles.pools[0].capacity) {
+		const int x = R (0, RESOLUTION_WIDTH - 1), y = R (0, RESOLUTION_HEIGHT - 1);
+		const i32 vx = R (-(2 << 16), 2 << 16), vy = R (-(1 << 16), 3 << 16);
+		switch (scene) {
+			case scene_steady: ParticleAdd (R (1, 255), x, y, vx, vy, .time = R (30, 300)); break;
+			case scene_burst: ParticleAdd (R (1, 255), x, y, vx / 4, vy / 4, .gravity = false, .time = 60 - frame % 60); break;
+			case scene_boundary: ParticleAdd (R (1, 255), x, y, vx, vy); break;
+			case scene_count: break;
+		}
+	}
+	#undef R
+}
+
+typedef struct {
+	i64 total, worst, saved, reference_total, reference_worst;
+} scene_times_t;
+
+// Updates the default pool frames times against the original, returning how many frames didn't match
+static int SceneRun (scene_e scene, int frames, particles_t *reference, scene_times_t *times) {
+	u64 random_state = 12345;
+	ParticlesClear ();
+	*times = (scene_times_t){};
+	int mismatches = 0;
+	for (int frame = 0; frame < frames; ++frame) {
+		// The boundary scene only fills once, and lets them fly off
+		if (scene != scene_boundary || frame == 0) Fill (scene, &random_state, frame);
+		const auto pool = DefaultPool ();
+		ParticlesCopy (reference, &pool);
+
+		i64 start = zen_nTime ();
+		ParticlesUpdate (PARTICLES_BOUNDARY_LEFT, PARTICLES_BOUNDARY_RIGHT, PARTICLES_BOUNDARY_BOTTOM, PARTICLES_BOUNDARY_TOP);
+		const i64 ns = zen_nTime () - start;
+		start = zen_nTime ();
+		ReferenceUpdate (reference, PARTICLES_BOUNDARY_LEFT, PARTICLES_BOUNDARY_RIGHT, PARTICLES_BOUNDARY_BOTTOM, PARTICLES_BOUNDARY_TOP);
+		const i64 reference_ns = zen_nTime () - start;
+
+		times->total += ns;
+		times->saved += ParticlesUpdateStats ().saved_us;
+		times->reference_total += reference_ns;
+		times->worst = MAX (times->worst, ns);
+		times->reference_worst = MAX (times->reference_worst, reference_ns);
+		const auto updated = DefaultPool ();
+		if (!ParticlesMatch (&updated, reference)) ++mismatches;
+	}
+	return mismatches;
+}
+
+// Chunks in the default pool for the thread count checks
+#define PARTICLES_FEW_CHUNKS 3
+// Capacity of each emitter in the overflow check, and particles added to each per frame
+#define OVERFLOW_CAPACITY 3000
+#define OVERFLOW_ADDS 1000
+
+// Adds past capacity to a replace_oldest and a drop_new emitter every frame, and checks their particles and counts after each update against ReferenceAdd. Returns how many frames didn't match.
+static int OverflowRun (int frames, particles_t references[2]) {
+	static const particles_overflow_e overflows[2] = {particles_overflow_replace_oldest, particles_overflow_drop_new};
+	const size_t size = 2 * OVERFLOW_CAPACITY * PARTICLE_STORAGE_BYTES;
+	static void *storage;
+	if (!storage) storage = aligned_alloc (8, (size + 7) & ~7);
+	if (!ParticlesConfigure (storage, size, 0, particles_overflow_replace_oldest)) return frames;
+	particle_emitter_t emitters[2];
+	u32 lost[2] = {};
+	for (int e = 0; e < 2; ++e) {
+		emitters[e] = ParticleEmitterCreate (OVERFLOW_CAPACITY, overflows[e]);
+		if (emitters[e].index < 0) return frames;
+		references[e].count = 0;
+	}
+
+	u64 random_state = 12345;
+	int mismatches = 0;
+	for (int frame = 0; frame < frames; ++frame) {
+		for (int i = 0; i < OVERFLOW_ADDS; ++i) {
+			#define R(__min__, __max__) DiscreteRandom_Range (&random_state, __min__, __max__)
+			const u8 pixel = R (1, 255);
+			const int x = R (0, RESOLUTION_WIDTH - 1), y = R (0, RESOLUTION_HEIGHT - 1), time = R (30, 300);
+			const i32 vx = R (-(2 << 16), 2 << 16), vy = R (-(1 << 16), 3 << 16);
+			#undef R
+			for (int e = 0; e < 2; ++e) {
+				ParticleAdd (pixel, x, y, vx, vy, .time = time, .emitter = emitters[e]);
+				ReferenceAdd (&references[e], OVERFLOW_CAPACITY, overflows[e], &lost[e], pixel, x, y, vx, vy, time);
+			}
+		}
+		ParticlesUpdate (PARTICLES_BOUNDARY_LEFT, PARTICLES_BOUNDARY_RIGHT, PARTICLES_BOUNDARY_BOTTOM, PARTICLES_BOUNDARY_TOP);
+		bool match = true;
+		for (int e = 0; e < 2; ++e) {
+			ReferenceUpdate (&references[e], PARTICLES_BOUNDARY_LEFT, PARTICLES_BOUNDARY_RIGHT, PARTICLES_BOUNDARY_BOTTOM, PARTICLES_BOUNDARY_TOP);
+			const auto pool = EmitterPool (emitters[e]);
+			const auto stats = ParticleEmitterStats (emitters[e]);
+			match &= ParticlesMatch (&pool, &references[e]) && (overflows[e] == particles_overflow_replace_oldest ? stats.replaced : stats.dropped) == lost[e];
+		}
+		mismatches += !match;
+	}
+	return mismatches;
+}
+
+int main (int argc, char **argv) {
+	int frames = 600, count = PARTICLES_DEFAULT_CAPACITY, threads = 1;
+	bool usage = false;
+	for (int i = 1; i < argc; i += 2) {
+		if (i+1 < argc && strcmp (argv[i], "-f") == 0) frames = atoi (argv[i+1]);
+		else if (i+1 < argc && strcmp (argv[i], "-n") == 0) count = atoi (argv[i+1]);
+		else if (i+1 < argc && strcmp (argv[i], "-t") == 0) threads = atoi (argv[i+1]);
+		else usage = true;
+	}
+	if (usage || frames < 1 || count < 1 || threads < 1) {
+		printf ("Usage: particle_bench [-f frames] [-n particles] [-t threads]\n");
+		return 1;
+	}
+	zen_Init ();
+	ParticlesSetThreads (threads);
+
+	if (count != PARTICLES_DEFAULT_CAPACITY) {
+		const size_t size = count * PARTICLE_STORAGE_BYTES;
+		if (!ParticlesConfigure (aligned_alloc (8, (size + 7) & ~7), size, count, particles_overflow_replace_oldest)) return 1;
+	}
+	const int reference_capacity = MAX (count, PARTICLES_FEW_CHUNKS * PARTICLE_CHUNK_SIZE);
+	particles_t reference = {
+		.position = malloc (reference_capacity * sizeof (*reference.position)),
+		.pixel = malloc (reference_capacity * sizeof (*reference.pixel)),
+		.velocity = malloc (reference_capacity * sizeof (*reference.velocity)),
+		.gravity = malloc (reference_capacity * sizeof (*reference.gravity)),
+		.time = malloc (reference_capacity * sizeof (*reference.time)),
+	};
+
+	int result = 0;
+	printf ("%d particles, %d frames, %d threads\n", count, frames, threads);
+	printf ("  %-10s %12s %12s %12s %12s %12s %8s\n", "", "update", "worst", "saved", "original", "worst", "speedup");
+	for (scene_e scene = 0; scene < scene_count; ++scene) {
+		scene_times_t times;
+		const int mismatches = SceneRun (scene, frames, &reference, &times);
+		printf ("  %-10s %10.1fus %10.1fus %10.1fus %10.1fus %10.1fus %7.2fx", scene_names[scene], times.total / 1000.0 / frames, times.worst / 1000.0, (f64)times.saved / frames, times.reference_total / 1000.0 / frames, times.reference_worst / 1000.0, (f64)times.reference_total / times.total);
+		if (mismatches) {
+			printf (" MISMATCH on %d frames", mismatches);
+			result = 1;
+		}
+		printf ("\n");
+	}
+
+	// Sprite explosions: a disc of random colors in a 64x64 sprite, at every flip and a slight rotation, into an empty pool each frame. The velocities have random jitter drawn differently from the original, so only the positions and colors are compared.
+	static u8 disc_pixels[64*64];
+	u64 random_state = 12345;
+	for (int y = 0; y < 64; ++y) for (int x = 0; x < 64; ++x)
+		disc_pixels[x + y*64] = (x-32)*(x-32) + (y-32)*(y-32) < 32*32 ? DiscreteRandom_Range (&random_state, 1, 255) : 0;
+	const sprite_t disc = {.w = 64, .h = 64, .p = disc_pixels};
+	sprite_t disc_spans = disc;
+	disc_spans.spans = sprite_BuildSpans (&disc, malloc (sprite_SpansSize (&disc)), sprite_SpansSize (&disc));
+	printf ("\n  %-10s %12s %12s %12s %12s %8s\n", "", "create", "worst", "original", "worst", "speedup");
+	const struct {const char *name; const sprite_t *sprite;} sprites[] = {{"sprite", &disc}, {"spans", &disc_spans}};
+	for (int s = 0; s < _Countof (sprites); ++s) {
+		i64 total = 0, worst = 0, reference_total = 0, reference_worst = 0;
+		int mismatches = 0;
+		for (int frame = 0; frame < frames; ++frame) {
+			const CreateParticlesFromSprite_arguments arguments = {.rotation = .1f, .flipx = frame & 1, .flipy = frame & 2, .originx = 32, .originy = 32};
+			ParticlesClear ();
+			i64 start = zen_nTime ();
+			CreateParticlesFromSprite_ (sprites[s].sprite, 160, 100, .25f, 2 << 16, arguments);
+			const i64 ns = zen_nTime () - start;
+			const auto created = DefaultPool ();
+			ParticlesCopy (&reference, &created);
+
+			ParticlesClear ();
+			start = zen_nTime ();
+			ReferenceCreateParticlesFromSprite (sprites[s].sprite, 160, 100, .25f, 2 << 16, arguments);
+			const i64 reference_ns = zen_nTime () - start;
+
+			total += ns;
+			reference_total += reference_ns;
+			worst = MAX (worst, ns);
+			reference_worst = MAX (reference_worst, reference_ns);
+			const auto original = DefaultPool ();
+			if (original.count != reference.count || memcmp (original.position, reference.position, reference.count * sizeof (*reference.position)) || memcmp (original.pixel, reference.pixel, reference.count)) ++mismatches;
+		}
+		printf ("  %-10s %10.1fus %10.1fus %10.1fus %10.1fus %7.2fx", sprites[s].name, total / 1000.0 / frames, worst / 1000.0, reference_total / 1000.0 / frames, reference_worst / 1000.0, (f64)reference_total / total);
+		if (mismatches) {
+			printf (" MISMATCH on %d frames", mismatches);
+			result = 1;
+		}
+		printf ("\n");
+	}
+
+	// More threads than chunks, so most of them wake with nothing to do, and then fewer threads than have been started. Both have to leave the particles alone while the update thread moves them.
+	const size_t few_chunks_size = PARTICLES_FEW_CHUNKS * PARTICLE_CHUNK_SIZE * PARTICLE_STORAGE_BYTES;
+	if (!ParticlesConfigure (aligned_alloc (8, (few_chunks_size + 7) & ~7), few_chunks_size, PARTICLES_FEW_CHUNKS * PARTICLE_CHUNK_SIZE, particles_overflow_replace_oldest)) return 1;
+	printf ("\n  %-10s %12s %12s\n", "", "update", "worst");
+	for (int t = PARTICLE_THREADS_MAX; t >= 2; t /= 2) {
+		ParticlesSetThreads (t);
+		char label[16];
+		snprintf (label, sizeof (label), "%dt/%dc", t, PARTICLES_FEW_CHUNKS);
+		scene_times_t times;
+		const int mismatches = SceneRun (scene_steady, frames, &reference, &times);
+		printf ("  %-10s %10.1fus %10.1fus", label, times.total / 1000.0 / frames, times.worst / 1000.0);
+		if (mismatches) {
+			printf (" MISMATCH on %d frames", mismatches);
+			result = 1;
+		}
+		printf ("\n");
+	}
+
+	particles_t overflow_references[2];
+	for (int e = 0; e < 2; ++e) {
+		overflow_references[e] = (particles_t){
+			.position = malloc (OVERFLOW_CAPACITY * sizeof (*reference.position)),
+			.pixel = malloc (OVERFLOW_CAPACITY * sizeof (*reference.pixel)),
+			.velocity = malloc (OVERFLOW_CAPACITY * sizeof (*reference.velocity)),
+			.gravity = malloc (OVERFLOW_CAPACITY * sizeof (*reference.gravity)),
+			.time = malloc (OVERFLOW_CAPACITY * sizeof (*reference.time)),
+		};
+	}
+	for (int t = 1; t <= 4; t *= 4) {
+		ParticlesSetThreads (t);
+		const int mismatches = OverflowRun (frames, overflow_references);
+		printf ("  overflow %dt", t);
+		if (mismatches) {
+			printf (" MISMATCH on %d frames", mismatches);
+			result = 1;
+		}
+		printf ("\n");
+	}
+	return result;
+}
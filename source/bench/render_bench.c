@@ -0,0 +1,275 @@
+// Copyright [2025] [Nicholas Walton]
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Headless render benchmark. Draws render state captures (saved from a debug build of the game with the O key) or a built-in scene through Render_DrawState - no window, no OpenGL, no frame pacing - and prints the time spent on each element type and the frames per second.
+// Usage: render_bench [-f frames] [-t threads] [-r 0|1] [-d 0|1] [-s seconds] [capture.krsc ... | handoff]
+// -r 1 turns on the rotated sprite cache (render_rotation_cache).
+// -d 1 turns on dirty rectangles (render_dirty_rects). The state is the same every frame, so after the first this times finding nothing to redraw.
+// handoff instead stress tests the render state triple buffer between the update and render threads, for 5 seconds unless -s is given.
+
+#define RENDER_DRAW_TIMING
+#include "framework.c"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+update_data_t update_data = {};
+render_data_t render_data = {};
+bool quit = false;
+
+static u8 bench_frame_pixels[RESOLUTION_WIDTH*RESOLUTION_HEIGHT];
+static sprite_t bench_frame = {.w = RESOLUTION_WIDTH, .h = RESOLUTION_HEIGHT, .p = bench_frame_pixels};
+
+static const char *const element_names[render_element_type_count] = {
+	[render_element_sprite] = "sprite",
+	[render_element_shape] = "shape",
+	[render_element_text] = "text",
+	[render_element_sprite_silhouette] = "silhouette",
+	[render_element_darkness_rectangle] = "darkness",
+	[render_element_textured_poly] = "textured poly",
+};
+
+// Something like a busy gameplay frame, using every element type. Seeded so every run draws the same thing.
+static render_state_t *BuildScene () {
+	u64 random_state = 12345;
+	static u8 color_swap[256];
+	for (int i = 0; i < 256; ++i) color_swap[i] = 255 - i;
+	color_swap[0] = 0;
+
+	Render_SelectStateToEdit ();
+	Render_Background (.type = background_type_stripes, .stripes = {.color = 193, .width = 8, .angle = 0.1f});
+	Render_Camera (4, -3);
+
+	// Random values are pulled into locals first, since the order initializers are evaluated in is unspecified
+	#define R(__min__, __max__) DiscreteRandom_Range (&random_state, __min__, __max__)
+	repeat (200) {
+		const sprite_t *sprite = R (0, 1) ? &resources_gameplay_heli : &resources_gameplay_coin;
+		const int x = R (-20, RESOLUTION_WIDTH+20), y = R (-20, RESOLUTION_HEIGHT+20), depth = R (-8, 8);
+		const bool flip = R (0, 1);
+		Render_Sprite (.sprite = sprite, .x = x, .y = y, .depth = depth, .sprite_flags = {.flip_horizontally = flip, .center_horizontally = true, .center_vertically = true});
+	}
+	repeat (60) {
+		const int x = R (0, RESOLUTION_WIDTH), y = R (0, RESOLUTION_HEIGHT), depth = R (-8, 8);
+		const f32 rotation = R (0, 255) / 256.f;
+		const bool flip = R (0, 1);
+		Render_Sprite (.sprite = &resources_gameplay_heli, .x = x, .y = y, .depth = depth, .rotation = rotation, .sprite_flags = {.flip_vertically = flip, .center_horizontally = true, .center_vertically = true});
+	}
+	repeat (40) {
+		const int x = R (0, RESOLUTION_WIDTH), y = R (0, RESOLUTION_HEIGHT), quarters = R (0, 3);
+		Render_Sprite (.sprite = &resources_gameplay_pipe_top, .x = x, .y = y, .depth = -1, .sprite_flags = {.rotation_by_quarters = quarters}, .color_swap_palette = &color_swap);
+	}
+	repeat (40) {
+		const int x = R (0, RESOLUTION_WIDTH), y = R (0, RESOLUTION_HEIGHT), color = R (1, 255);
+		Render_SpriteSilhouette (color, .sprite = &resources_gameplay_coin, .x = x, .y = y, .depth = 2);
+	}
+	repeat (30) {
+		const i16 x = R (0, RESOLUTION_WIDTH), y = R (0, RESOLUTION_HEIGHT);
+		const u8 color = R (1, 255);
+		Render_Shape (.shape = {.type = render_shape_rectangle, .rectangle = {.x = x, .y = y, .w = 30, .h = 20, .color_edge = color, .color_fill = color/2}});
+		Render_Shape (.shape = {.type = render_shape_circle, .circle = {.x = y, .y = x % RESOLUTION_HEIGHT, .r = 12, .color_edge = color, .color_fill = color/2}});
+		Render_Shape (.shape = {.type = render_shape_ellipse, .ellipse = {.x = x, .y = y, .rx = 20, .ry = 9, .color_edge = color, .color_fill = 0}});
+		Render_Shape (.shape = {.type = render_shape_line, .line = {.x0 = x, .y0 = y, .x1 = x + 40, .y1 = y - 25, .color = color}});
+		Render_Shape (.shape = {.type = render_shape_triangle, .triangle = {.x0 = x, .y0 = y, .x1 = x + 30, .y1 = y + 5, .x2 = x + 10, .y2 = y + 25, .color_edge = color, .color_fill = color/2}});
+	}
+	repeat (20) {
+		const i16 x = R (0, RESOLUTION_WIDTH), y = R (0, RESOLUTION_HEIGHT);
+		Render_TexturedPoly (.texture = &resources_gameplay_coin, .x = x, .y = y, .depth = 1, .vertex_count = 4, .vertices = (textured_poly_vertex_t[]){{0, 0, 0, 0}, {24, 4, 1, 0}, {20, 28, 1, 1}, {-2, 22, 0, 1}});
+	}
+	repeat (10) {
+		const int x = R (0, RESOLUTION_WIDTH-60), y = R (20, RESOLUTION_HEIGHT);
+		Render_Text (.string = "Score 1234\nThe \\c20\\quick\\c0\\ brown \\w224\\frog\\w0\\", .x = x, .y = y, .depth = 10);
+	}
+	Render_Text (.string = "Press [SPACE] to play again", .depth = 10, .center_horizontally_on_screen = true, .translucent_background_darkness = 2);
+	Render_DarkenRectangle (.t = 30, .depth = 5);
+	repeat (RENDER_PARTICLES_DEFAULT/2) {
+		const int x = R (0, RESOLUTION_WIDTH-1), y = R (0, RESOLUTION_HEIGHT-1), pixel = R (1, 255);
+		Render_Particle (x, y, pixel, true);
+	}
+	#undef R
+
+	auto state = Render_GetCurrentEditableState ();
+	Render_FinishEditingState ();
+	return state;
+}
+
+static u8 *LoadFile (const char *filename, size_t *size) {
+	FILE *file = fopen (filename, "rb");
+	if (!file) { LOG ("Failed to read file [%s]", filename); return NULL; }
+	defer { fclose (file); }
+	fseek (file, 0, SEEK_END);
+	const long length = ftell (file);
+	fseek (file, 0, SEEK_SET);
+	if (length <= 0) return NULL;
+	u8 *buf = malloc (length);
+	if (!buf) return NULL;
+	if (fread (buf, length, 1, file) != 1) {
+		free (buf);
+		return NULL;
+	}
+	*size = length;
+	return buf;
+}
+
+// Handoff stress test: a thread fills and publishes states as the update thread does, stamping each with its number, while this one takes the newest as the render thread does. Each reads and writes its state slowly, with uneven pauses, and which of them is faster swaps every second. Every state taken must be whole and newer than the last one, and a state kept must not change while it's held.
+static atomic_bool handoff_test_stop;
+static const size_t handoff_stamps[] = {0, RENDER_STATE_MEM_AMOUNT / 2, RENDER_STATE_MEM_AMOUNT - sizeof (u64)};
+
+static int HandoffTestPause (u64 *random_state, bool fast) {
+	return DiscreteRandom_Range (random_state, 0, fast ? 500 : 4000);
+}
+
+static void *HandoffTestSend (void *sent_void) {
+	u64 *sent = sent_void;
+	u64 random_state = 54321;
+	const i64 start = zen_nTime ();
+	while (!atomic_load_explicit (&handoff_test_stop, memory_order_relaxed)) {
+		const bool fast = (zen_nTime () - start) / 1000000000 % 2;
+		Render_SelectStateToEdit ();
+		const auto state = Render_GetCurrentEditableState ();
+		for (int i = 0; i < _Countof (handoff_stamps); ++i) {
+			memcpy (&state->mem.bytes[handoff_stamps[i]], &state->state_count, sizeof (u64));
+			repeat (HandoffTestPause (&random_state, fast)) atomic_signal_fence (memory_order_seq_cst);
+		}
+		*sent = state->state_count;
+		Render_FinishEditingState ();
+	}
+	return NULL;
+}
+
+static bool HandoffTest (f32 seconds) {
+	u64 random_state = 12345;
+	u64 sent = 0;
+	pthread_t sender;
+	if (pthread_create (&sender, NULL, HandoffTestSend, &sent)) { LOG ("Failed to create thread"); return false; }
+	const i64 start = zen_nTime ();
+	u32 taken = 0, kept = 0, torn = 0, stale = 0, changed = 0;
+	u64 last = 0;
+	for (bool stopped = false;;) {
+		if (!stopped && zen_nTime () - start > seconds * 1e9) {
+			atomic_store (&handoff_test_stop, true);
+			pthread_join (sender, NULL);
+			stopped = true;
+		}
+		const bool fast = (zen_nTime () - start) / 1000000000 % 2 == 0;
+		const u8 front = render_state_front;
+		const auto state = Render_AcquireNewestState ();
+		const bool new = render_state_front != front;
+		const u64 number = state->state_count;
+		bool whole = true;
+		for (int i = 0; i < _Countof (handoff_stamps); ++i) {
+			u64 stamp;
+			memcpy (&stamp, &state->mem.bytes[handoff_stamps[i]], sizeof (u64));
+			whole &= stamp == number;
+			repeat (HandoffTestPause (&random_state, fast)) atomic_signal_fence (memory_order_seq_cst);
+		}
+		whole &= state->state_count == number;
+		if (new) {
+			++taken;
+			torn += !whole;
+			// Never one already drawn, or older than it
+			stale += number <= last;
+		}
+		else if (last) {
+			++kept;
+			changed += !whole || number != last;
+		}
+		last = number;
+		if (stopped && !new) break;
+	}
+	const bool pass = torn == 0 && stale == 0 && changed == 0 && last == sent;
+	printf ("handoff: %"PRIu64" states in %.1f seconds, %u taken, %"PRIu64" skipped, %u redrawn\n", sent, seconds, taken, sent - taken, kept);
+	printf ("  %u torn, %u stale, %u changed while held, last taken %"PRIu64" (expected %"PRIu64"): %s\n", torn, stale, changed, last, sent, pass ? "pass" : "FAIL");
+	return pass;
+}
+
+static void PrintEntry (const char *label, render_draw_timing_entry_t entry, int frames) {
+	if (entry.count == 0) return;
+	printf ("  %-14s %12.2f %10"PRId64" %10.1f\n", label, entry.nanoseconds / 1000.0 / frames, entry.count / frames, (f64)entry.nanoseconds / entry.count);
+}
+
+static void Bench (const char *name, render_state_t *state, int frames) {
+	// Warm up caches before timing
+	Render_DrawState (state, &bench_frame);
+	render_draw_timing = (render_draw_timing_t){};
+	const auto rotation_cache_start = render_rotation_cache;
+	const auto dirty_rects_start = render_dirty_rects;
+
+	const i64 start = zen_nTime ();
+	repeat (frames) Render_DrawState (state, &bench_frame);
+	const i64 total = zen_nTime () - start;
+
+	// FNV-1a of the final frame, so changes to drawing output show up between runs
+	u32 hash = 2166136261u;
+	for (int i = 0; i < bench_frame.w * bench_frame.h; ++i) hash = (hash ^ bench_frame.p[i]) * 16777619u;
+
+	printf ("%s: %d elements, %d particles, %d frames\n", name, state->element_count, state->particles.count, frames);
+	printf ("  %-14s %12s %10s %10s\n", "", "us/frame", "per frame", "ns each");
+	PrintEntry ("background", render_draw_timing.background, frames);
+	PrintEntry ("sort", render_draw_timing.sort, frames);
+	for (int i = 0; i < render_element_type_count; ++i) PrintEntry (element_names[i], render_draw_timing.elements[i], frames);
+	PrintEntry ("particles", render_draw_timing.particles, frames);
+	PrintEntry ("all elements", render_draw_timing.bands, frames);
+	printf ("  %-14s %12.2f\n", "total", total / 1000.0 / frames);
+	if (render_rotation_cache.enabled) printf ("  rotation cache: %"PRIu64" hits, %"PRIu64" misses, %"PRIu64" skipped\n", render_rotation_cache.hits - rotation_cache_start.hits, render_rotation_cache.misses - rotation_cache_start.misses, render_rotation_cache.skipped - rotation_cache_start.skipped);
+	if (render_dirty_rects.enabled) printf ("  dirty rectangles: %"PRIu64" of %"PRIu64" frames redrawn completely, %.1f rows per frame\n", render_dirty_rects.full_frames - dirty_rects_start.full_frames, render_dirty_rects.frames - dirty_rects_start.frames, (f64)(render_dirty_rects.rows - dirty_rects_start.rows) / frames);
+	printf ("  %.1f frames/sec, frame hash %08x\n\n", frames * 1e9 / total, hash);
+}
+
+int main (int argc, char **argv) {
+	int frames = 1000, threads = 1;
+	f32 seconds = 5;
+	--argc;
+	++argv;
+	while (argc >= 2 && (*argv)[0] == '-') {
+		if (strcmp (*argv, "-f") == 0) frames = atoi (argv[1]);
+		else if (strcmp (*argv, "-t") == 0) threads = atoi (argv[1]);
+		else if (strcmp (*argv, "-r") == 0) render_rotation_cache.enabled = atoi (argv[1]);
+		else if (strcmp (*argv, "-d") == 0) render_dirty_rects.enabled = atoi (argv[1]);
+		else if (strcmp (*argv, "-s") == 0) seconds = atof (argv[1]);
+		else break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (frames < 1 || threads < 1 || seconds <= 0) {
+		printf ("Usage: render_bench [-f frames] [-t threads] [-r 0|1] [-d 0|1] [-s seconds] [capture.krsc ... | handoff]\n");
+		return 1;
+	}
+	if (argc == 1 && strcmp (*argv, "handoff") == 0) {
+		zen_Init ();
+		return HandoffTest (seconds) ? 0 : 1;
+	}
+	Render_SetThreads (threads);
+	printf ("Drawing with %d thread%s\n\n", threads, threads == 1 ? "" : "s");
+
+	zen_Init ();
+
+	if (argc == 0) {
+		Bench ("built-in scene", BuildScene (), frames);
+		return 0;
+	}
+
+	int failed = 0;
+	for (int i = 0; i < argc; ++i) {
+		size_t size;
+		u8 *capture = LoadFile (argv[i], &size);
+		if (!capture || !Render_CaptureRead (&render_data.render_states[0], capture, size)) {
+			printf ("%s: not a usable render state capture\n\n", argv[i]);
+			++failed;
+		}
+		else Bench (argv[i], &render_data.render_states[0], frames);
+		free (capture);
+	}
+	return failed ? 1 : 0;
+}
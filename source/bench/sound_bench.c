@@ -0,0 +1,357 @@
+// Copyright [2025] [Nicholas Walton]
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Offline synth benchmark. Runs RefillSampleBuffer the way the sound thread does, but without an audio device, and prints how many samples per second the synth makes. The output can be saved and compared against a previous run's, to check that changes to the synth sound the same.
+// Usage: sound_bench [-s seconds] [-b buffer_samples] [-v oldest|quietest|none] [-k] [-w workers] [-o output.wav|.raw] [-c golden.wav|.raw] [-e tolerance] [music|fx|mixed|queue|steal]
+// music plays the game's song, fx a seeded stream of sound effects using every waveform, and mixed (the default) both at once.
+// queue instead stress tests the command queue between the update and sound threads, for 5 seconds unless -s is given.
+// steal checks which sound effects are cut off when every FX channel is busy, under each steal policy.
+// -v sets which sound effect is cut off when a new one starts and every FX channel is busy (SoundFXSetStealPolicy).
+// -w renders music channels on this many worker threads as well as the sound thread (SoundMusicSetWorkers). The output should be the same either way.
+// -k puts the fixed sound effect chain in the sound cache (SoundFXCache) before starting. The output should be the same either way.
+// -o saves the output as 32 bit float mono at SAMPLING_RATE: a WAV file if the name ends in .wav, otherwise raw samples.
+// -c compares the output against a file saved with -o and fails if any sample differs by more than the tolerance (default 0, meaning bit for bit).
+// golden/ holds 1 second renders of each scene, which ctest compares against (see CMakeLists.txt for regenerating them).
+
+#include "framework.c"
+#include "sound_common.c" // Rather than linking the sound object, so the queue test can get at the command queue
+
+#include <stdlib.h>
+#include <pthread.h>
+
+update_data_t update_data = {};
+render_data_t render_data = {};
+bool quit = false;
+
+typedef enum {scene_music = 1, scene_fx = 2, scene_mixed = scene_music | scene_fx, scene_queue = 4, scene_steal = 8} scene_e;
+
+static const sound_t fx_chain[] = {
+	{.waveform = sound_waveform_sine, .duration = 48000 * .1, .next = &fx_chain[1], .frequency = 1600, .ADSR = {.peak = .5, .sustain = .4, .attack = 480, .decay = 240, .release = 480}, .priority = 1, .max_instances = 2},
+	{.waveform = sound_waveform_sine, .duration = 48000 * .1, .frequency = 2000, .ADSR = {.peak = .5, .sustain = .4, .attack = 480, .decay = 240, .release = 480}},
+};
+
+// Plays one of a few sound effects chosen by random_state, covering every waveform along with sweeps, vibrato and duty cycle sweeps
+static void PlayRandomFX (u64 *random_state) {
+	#define R(__min__, __max__) DiscreteRandom_Range (random_state, __min__, __max__)
+	const int kind = R (0, 5);
+	const u16 frequency = R (100, 2000);
+	const i16 sweep = R (-500, 500);
+	const f32 duration = R (2, 40) / 100.f;
+	switch (kind) {
+		case 0: SoundFXPlayDirect (fx_chain[0]); break;
+		case 1: SoundFXPlay (.waveform = sound_waveform_sine, .frequency = frequency, .duration_seconds = duration, .sweep = sweep, .vibrato = {.frequency_range = 30, .vibrations_per_hundred_seconds = 1500}); break;
+		case 2: SoundFXPlay (.waveform = sound_waveform_triangle, .frequency = frequency, .duration_seconds = duration, .sweep = sweep); break;
+		case 3: SoundFXPlay (.waveform = sound_waveform_saw, .frequency = frequency, .duration_seconds = duration, .sweep = sweep, .volume = .5f); break;
+		case 4: {
+			const i8 duty_cycle = R (-128, 127), duty_cycle_sweep = R (-100, 100);
+			SoundFXPlay (.waveform = sound_waveform_pulse, .frequency = frequency, .duration_seconds = duration, .sweep = sweep, .square_duty_cycle = duty_cycle, .square_duty_cycle_sweep = duty_cycle_sweep, .volume = .5f);
+		} break;
+		case 5: SoundFXPlay (.waveform = sound_waveform_noise, .frequency = frequency * 4, .duration_seconds = duration, .volume = .4f); break;
+	}
+	#undef R
+}
+
+// Queue stress test: a thread sends numbered commands while this one takes them off the queue in uneven bursts, checking that each one arrives whole and in order, and that every command sent is either received or counted as dropped.
+static sound_t QueueTestSound (u32 i) {
+	return (sound_t){.duration = i, .frequency = (i * 2654435761u) >> 16, .sweep = ~i, .ADSR = {.attack = i, .release = ~i, .peak = i}, .square_duty_cycle = i >> 8, .waveform = i % 8};
+}
+static bool QueueTestSoundMatches (const sound_t *sound) {
+	const auto expected = QueueTestSound (sound->duration);
+	return sound->frequency == expected.frequency && sound->sweep == expected.sweep && sound->ADSR.attack == expected.ADSR.attack && sound->ADSR.release == expected.ADSR.release && sound->ADSR.peak == expected.ADSR.peak && sound->square_duty_cycle == expected.square_duty_cycle && sound->waveform == expected.waveform;
+}
+
+static atomic_bool queue_test_stop;
+static void *QueueTestSend (void *count_void) {
+	u32 *count = count_void;
+	u64 random_state = 54321;
+	for (u32 i = 0; !atomic_load_explicit (&queue_test_stop, memory_order_relaxed); ++i) {
+		SoundAddCommand (.type = sound_command_fx_play, .data.fx_play.sound = QueueTestSound (i));
+		if (i % 1000 == 0) SoundFXSetVolume ((i / 1000 % 11) / 10.f);
+		*count = i + 1;
+		repeat (DiscreteRandom_Range (&random_state, 0, 50)) atomic_signal_fence (memory_order_seq_cst);
+	}
+	return NULL;
+}
+
+static bool QueueTest (f32 seconds) {
+	u64 random_state = 12345;
+	u32 count = 0;
+	pthread_t sender;
+	if (pthread_create (&sender, NULL, QueueTestSend, &count)) { LOG ("Failed to create thread"); return false; }
+	const i64 start = zen_nTime ();
+	u32 received = 0, out_of_order = 0, torn = 0;
+	i64 last = -1;
+	for (bool stopped = false;;) {
+		if (!stopped && zen_nTime () - start > seconds * 1e9) {
+			atomic_store (&queue_test_stop, true);
+			pthread_join (sender, NULL);
+			stopped = true;
+		}
+		sound_command_t command;
+		bool empty = false;
+		// Once the sender has stopped, take everything that's left
+		for (int burst = stopped ? INT32_MAX : DiscreteRandom_Range (&random_state, 0, SOUND_COMMAND_QUEUE_SIZE * 2); burst > 0; --burst) {
+			if (!SoundTakeCommand (&command)) { empty = true; break; }
+			++received;
+			if (command.type != sound_command_fx_play || !QueueTestSoundMatches (&command.data.fx_play.sound)) ++torn;
+			else if ((i64)command.data.fx_play.sound.duration <= last) ++out_of_order;
+			else last = command.data.fx_play.sound.duration;
+		}
+		if (stopped && empty) break;
+		// Uneven pauses so the queue is sometimes empty and sometimes full
+		repeat (DiscreteRandom_Range (&random_state, 0, 4000)) atomic_signal_fence (memory_order_seq_cst);
+	}
+	const auto stats = SoundCommandStats ();
+	const f32 volume = SoundFXGetVolume (), expected_volume = ((count - 1) / 1000 % 11) / 10.f;
+	const bool pass = torn == 0 && out_of_order == 0 && received == stats.sent && stats.sent + stats.dropped == count && volume == expected_volume;
+	printf ("queue: %u commands in %.1f seconds, %u received, %u dropped, at most %u waiting\n", count, seconds, received, stats.dropped, stats.most_pending);
+	printf ("  %u torn, %u out of order, %u unaccounted for, final volume %g (expected %g): %s\n", torn, out_of_order, count - received - stats.dropped, volume, expected_volume, pass ? "pass" : "FAIL");
+	return pass;
+}
+
+// Voice stealing test: under each steal policy, fills all FX_CHANNELS with long sounds, then starts more than fit, and checks the SoundVoiceStats counts and which sounds are still playing. Two copies of a sound with max_instances 2 start first, then fillers each quieter than the last.
+#define STEAL_TEST_COPY_FREQUENCY 300
+#define STEAL_TEST_FILLERS (FX_CHANNELS - 2)
+static u16 StealTestFillerFrequency (int i) { return 400 + i * 50; }
+
+static int StealTestPlaying (u16 frequency) {
+	int playing = 0;
+	for (int i = FX_CHANNELS_FIRST; i <= FX_CHANNELS_LAST; ++i)
+		playing += sound.channels[i].sound.waveform != sound_waveform_none && sound.channels[i].sound.frequency == frequency;
+	return playing;
+}
+
+// Refills enough buffers for every sound started so far to be past its attack and decay
+static void StealTestSettle () {
+	repeat (10) RefillSampleBuffer ();
+}
+
+static bool StealTest (sound_steal_policy_e policy) {
+	SoundFXStop ();
+	SoundFXSetStealPolicy (policy);
+	StealTestSettle ();
+	atomic_store (&voice_stats.most_voices, 0);
+	atomic_store (&voice_stats.steals, 0);
+	atomic_store (&voice_stats.replaced, 0);
+	atomic_store (&voice_stats.dropped, 0);
+
+	// The third copy replaces the first
+	repeat (3) {
+		SoundFXPlay (.waveform = sound_waveform_sine, .frequency = STEAL_TEST_COPY_FREQUENCY, .duration_seconds = 10, .priority = 1, .max_instances = 2);
+		StealTestSettle ();
+	}
+	for (int i = 0; i < STEAL_TEST_FILLERS; ++i) {
+		SoundFXPlay (.waveform = sound_waveform_sine, .frequency = StealTestFillerFrequency (i), .duration_seconds = 10, .priority = 1, .volume = (STEAL_TEST_FILLERS - i) / 10.f);
+		StealTestSettle ();
+	}
+	// Lower priority than everything playing, so it's dropped under every policy
+	SoundFXPlay (.waveform = sound_waveform_sine, .frequency = 1000, .duration_seconds = 10, .priority = 0);
+	StealTestSettle ();
+	for (int i = 0; i < 3; ++i) {
+		SoundFXPlay (.waveform = sound_waveform_sine, .frequency = 1100 + i * 50, .duration_seconds = 10, .priority = 1);
+		StealTestSettle ();
+	}
+	SoundFXPlay (.waveform = sound_waveform_sine, .frequency = 1300, .duration_seconds = 10, .priority = 2);
+	StealTestSettle ();
+
+	const auto stats = SoundVoiceStats ();
+	bool pass = stats.most_voices == FX_CHANNELS && stats.replaced == 1;
+	const auto F = StealTestFillerFrequency;
+	switch (policy) {
+		case sound_steal_oldest: {
+			// Both copies and the two oldest fillers
+			pass = pass && stats.steals == 4 && stats.dropped == 1 && StealTestPlaying (STEAL_TEST_COPY_FREQUENCY) == 0 && !StealTestPlaying (F (0)) && !StealTestPlaying (F (1)) && StealTestPlaying (F (2)) && StealTestPlaying (1300);
+		} break;
+		case sound_steal_quietest: {
+			// The four quietest fillers
+			pass = pass && stats.steals == 4 && stats.dropped == 1 && StealTestPlaying (STEAL_TEST_COPY_FREQUENCY) == 2 && StealTestPlaying (F (3)) && !StealTestPlaying (F (4)) && !StealTestPlaying (F (7)) && StealTestPlaying (1300);
+		} break;
+		case sound_steal_none: {
+			pass = pass && stats.steals == 0 && stats.dropped == 5 && StealTestPlaying (STEAL_TEST_COPY_FREQUENCY) == 2 && StealTestPlaying (F (0)) && StealTestPlaying (F (7)) && !StealTestPlaying (1300);
+		} break;
+	}
+	printf ("steal %s: at most %u voices, %u stolen, %u replaced by copies, %u dropped: %s\n", policy == sound_steal_oldest ? "oldest" : policy == sound_steal_quietest ? "quietest" : "none", stats.most_voices, stats.steals, stats.replaced, stats.dropped, pass ? "pass" : "FAIL");
+	return pass;
+}
+
+static bool WriteOutput (const char *filename, const f32 *samples, size_t count) {
+	FILE *file = fopen (filename, "wb");
+	if (!file) { LOG ("Failed to open file [%s]", filename); return false; }
+	defer { fclose (file); }
+	const size_t length = strlen (filename);
+	if (length >= 4 && strcmp (filename + length - 4, ".wav") == 0) {
+		const u32 data_size = count * sizeof (f32);
+		struct [[gnu::packed]] {
+			char riff[4]; u32 riff_size; char wave[4];
+			char fmt[4]; u32 fmt_size; u16 format, channels; u32 rate, byte_rate; u16 block_align, bits;
+			char data[4]; u32 data_size;
+		} header = {
+			{'R', 'I', 'F', 'F'}, 36 + data_size, {'W', 'A', 'V', 'E'},
+			{'f', 'm', 't', ' '}, 16, 3, 1, SAMPLING_RATE, SAMPLING_RATE * sizeof (f32), sizeof (f32), 32,
+			{'d', 'a', 't', 'a'}, data_size,
+		};
+		if (fwrite (&header, sizeof (header), 1, file) != 1) { LOG ("Failed to write file [%s]", filename); return false; }
+	}
+	if (fwrite (samples, sizeof (f32), count, file) != count) { LOG ("Failed to write file [%s]", filename); return false; }
+	return true;
+}
+
+// Reads samples saved by WriteOutput. Returns NULL on failure, otherwise a malloc'd array of *count samples.
+static f32 *ReadOutput (const char *filename, size_t *count) {
+	FILE *file = fopen (filename, "rb");
+	if (!file) { LOG ("Failed to read file [%s]", filename); return NULL; }
+	defer { fclose (file); }
+	fseek (file, 0, SEEK_END);
+	long length = ftell (file);
+	fseek (file, 0, SEEK_SET);
+	char magic[4] = {};
+	if (length >= 44 && fread (magic, 4, 1, file) == 1 && memcmp (magic, "RIFF", 4) == 0) {
+		fseek (file, 44, SEEK_SET);
+		length -= 44;
+	}
+	else fseek (file, 0, SEEK_SET);
+	*count = length / sizeof (f32);
+	f32 *samples = malloc (MAX (*count, 1) * sizeof (f32));
+	if (!samples) return NULL;
+	if (fread (samples, sizeof (f32), *count, file) != *count) {
+		LOG ("Failed to read file [%s]", filename);
+		free (samples);
+		return NULL;
+	}
+	return samples;
+}
+
+int main (int argc, char **argv) {
+	f32 seconds = 0, tolerance = 0;
+	scene_e scene = scene_mixed;
+	bool usage = false, cache = false;
+	int buffer_samples = SAMPLING_RATE / 200;
+	const char *output_filename = NULL, *golden_filename = NULL;
+	--argc;
+	++argv;
+	while (argc >= 1 && (*argv)[0] == '-') {
+		if (strcmp (*argv, "-k") == 0) {
+			cache = true;
+			--argc;
+			++argv;
+			continue;
+		}
+		if (argc < 2) break;
+		if (strcmp (*argv, "-s") == 0) seconds = atof (argv[1]);
+		else if (strcmp (*argv, "-b") == 0) buffer_samples = atoi (argv[1]);
+		else if (strcmp (*argv, "-o") == 0) output_filename = argv[1];
+		else if (strcmp (*argv, "-c") == 0) golden_filename = argv[1];
+		else if (strcmp (*argv, "-e") == 0) tolerance = atof (argv[1]);
+		else if (strcmp (*argv, "-w") == 0) SoundMusicSetWorkers (atoi (argv[1]));
+		else if (strcmp (*argv, "-v") == 0) {
+			if (strcmp (argv[1], "oldest") == 0) SoundFXSetStealPolicy (sound_steal_oldest);
+			else if (strcmp (argv[1], "quietest") == 0) SoundFXSetStealPolicy (sound_steal_quietest);
+			else if (strcmp (argv[1], "none") == 0) SoundFXSetStealPolicy (sound_steal_none);
+			else usage = true;
+		}
+		else break;
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc == 1 && strcmp (*argv, "music") == 0) scene = scene_music;
+	else if (argc == 1 && strcmp (*argv, "fx") == 0) scene = scene_fx;
+	else if (argc == 1 && strcmp (*argv, "mixed") == 0) scene = scene_mixed;
+	else if (argc == 1 && strcmp (*argv, "queue") == 0) scene = scene_queue;
+	else if (argc == 1 && strcmp (*argv, "steal") == 0) scene = scene_steal;
+	else if (argc != 0) usage = true;
+	if (seconds == 0) seconds = scene == scene_queue ? 5 : 60;
+	if (seconds <= 0 || buffer_samples < 1 || buffer_samples > SAMPLE_BUFFER_SIZE_MAX || tolerance < 0 || usage) {
+		printf ("Usage: sound_bench [-s seconds] [-b buffer_samples] [-v oldest|quietest|none] [-k] [-w workers] [-o output.wav|.raw] [-c golden.wav|.raw] [-e tolerance] [music|fx|mixed|queue|steal]\n");
+		return 1;
+	}
+
+	zen_Init ();
+	if (scene == scene_queue) return QueueTest (seconds) ? 0 : 1;
+	if (scene == scene_steal) {
+		sample_buffer_size = buffer_samples;
+		bool pass = true;
+		for (sound_steal_policy_e policy = sound_steal_oldest; policy <= sound_steal_none; ++policy) pass = StealTest (policy) && pass;
+		return pass ? 0 : 1;
+	}
+	u64 random_state = 12345;
+
+	const int buffers = seconds * SAMPLING_RATE / buffer_samples;
+	const size_t sample_count = (size_t)buffers * buffer_samples;
+	f32 *samples = malloc (sample_count * sizeof (f32));
+	if (!samples) { LOG ("Failed to allocate [%zu] samples", sample_count); return 1; }
+
+	if (scene & scene_music) SoundMusicPlay (&resources_music_choppa);
+	if (cache) SoundFXCache (&fx_chain[0]);
+	sample_buffer_size = buffer_samples;
+	RefillSampleBuffer (); // The sound thread fills one buffer ahead before it starts playing
+
+	i64 total = 0;
+	for (int b = 0; b < buffers; ++b) {
+		// About 8 sound effects a second
+		if ((scene & scene_fx) && DiscreteRandom_Range (&random_state, 0, SAMPLING_RATE / 8 / buffer_samples) == 0) PlayRandomFX (&random_state);
+		const i64 start = zen_nTime ();
+		RefillSampleBuffer ();
+		total += zen_nTime () - start;
+		memcpy (samples + (size_t)b * buffer_samples, sample_buffer[sample_buffer_swap].samples, buffer_samples * sizeof (f32));
+	}
+
+	// FNV-1a of the output, so changes to it show up between runs
+	u32 hash = 2166136261u;
+	for (size_t i = 0; i < sample_count * sizeof (f32); ++i) hash = (hash ^ ((u8 *)samples)[i]) * 16777619u;
+
+	printf ("%s: %.1f seconds of audio in %d buffers of %d samples\n", scene == scene_music ? "music" : scene == scene_fx ? "fx" : "mixed", (f64)sample_count / SAMPLING_RATE, buffers, buffer_samples);
+	printf ("  %.2f us per buffer, %.0f samples/sec, %.0fx real time, output hash %08x\n", total / 1000.0 / buffers, sample_count * 1e9 / total, sample_count * 1e9 / total / SAMPLING_RATE, hash);
+
+	const auto synth_stats = SoundSynthStats ();
+	printf ("  Slowest buffer %u us, %u of %u over their deadline, %u music channels rendered by workers\n", synth_stats.worst_us, synth_stats.deadline_misses, synth_stats.refills, synth_stats.worker_channels);
+
+	if (scene & scene_fx) {
+		const auto voices = SoundVoiceStats ();
+		printf ("  FX voices: at most %u playing, %u stolen, %u replaced by copies, %u dropped\n", voices.most_voices, voices.steals, voices.replaced, voices.dropped);
+		const auto cached = SoundFXCacheStats ();
+		if (cached.sounds) printf ("  FX cache: %u sounds in %u samples, %u plays from the cache\n", cached.sounds, cached.samples, cached.hits);
+	}
+
+	int result = 0;
+	if (output_filename && !WriteOutput (output_filename, samples, sample_count)) result = 1;
+	if (golden_filename) {
+		size_t golden_count;
+		f32 *golden = ReadOutput (golden_filename, &golden_count);
+		if (!golden) result = 1;
+		else {
+			size_t differing = 0, first = 0;
+			f32 largest = 0;
+			for (size_t i = 0; i < MIN (sample_count, golden_count); ++i) {
+				const f32 difference = absf (samples[i] - golden[i]);
+				if (difference > tolerance || (difference != difference)) {
+					if (differing++ == 0) first = i;
+				}
+				if (difference > largest) largest = difference;
+			}
+			if (golden_count != sample_count) {
+				printf ("  %s has %zu samples, expected %zu\n", golden_filename, golden_count, sample_count);
+				result = 1;
+			}
+			if (differing) {
+				printf ("  %zu samples differ from %s by more than %g, first at %zu, largest difference %g\n", differing, golden_filename, tolerance, first, largest);
+				result = 1;
+			}
+			else if (golden_count == sample_count) printf ("  matches %s (largest difference %g)\n", golden_filename, largest);
+			free (golden);
+		}
+	}
+	free (samples);
+	return result;
+}
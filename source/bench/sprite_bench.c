@@ -0,0 +1,173 @@
+// Copyright [2025] [Nicholas Walton]
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Sprite blit microbenchmark. Times sprite_Blit, the flipped, silhouette, color swap and rotated blits on an 8x8, the game's 31x19 heli and a 320x180 sprite with every row kernel the CPU supports, and with an opaque span table, and checks that each one draws exactly what the scalar blit does.
+// Usage: sprite_bench [-f iterations]
+
+#include "framework.c"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+update_data_t update_data = {};
+render_data_t render_data = {};
+bool quit = false;
+
+static const char *const kernel_names[] = {
+	[sprite_blit_kernel_scalar] = "scalar",
+	[sprite_blit_kernel_sse2] = "sse2",
+	[sprite_blit_kernel_avx2] = "avx2",
+};
+
+typedef enum {blit_plain, blit_flipped_horizontally, blit_flipped_vertically, blit_color, blit_color_flipped_horizontally, blit_color_swap, blit_rotated, blit_rotated_color, blit_count} blit_e;
+static const char *const blit_names[blit_count] = {
+	[blit_plain] = "blit",
+	[blit_flipped_horizontally] = "flip h",
+	[blit_flipped_vertically] = "flip v",
+	[blit_color] = "silhouette",
+	[blit_color_flipped_horizontally] = "silh. flip h",
+	[blit_color_swap] = "color swap",
+	[blit_rotated] = "rotated",
+	[blit_rotated_color] = "rotated silh.",
+};
+
+static u8 color_swap[256];
+static u8 destination_pixels[400*300];
+static sprite_t destination = {.w = 400, .h = 300, .p = destination_pixels};
+
+// Like sprite art: an opaque blob with transparent corners (about a third of the pixels) and a few transparent holes, colors changing every few pixels
+static sprite_t MakeSprite (int w, int h, u64 *random_state) {
+	sprite_t sprite = {.w = w, .h = h, .p = malloc (w*h)};
+	if (sprite.p == NULL) { printf ("Failed to allocate %dx%d sprite\n", w, h); exit (1); }
+	u8 color = 1;
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			const f32 dx = (x + .5f) / w * 2 - 1, dy = (y + .5f) / h * 2 - 1;
+			if (DiscreteRandom_Range (random_state, 0, 3) == 0) color = DiscreteRandom_Range (random_state, 1, 255);
+			const bool hole = DiscreteRandom_Range (random_state, 0, 100) == 0;
+			sprite.p[x + y*w] = dx*dx + dy*dy > .85f || hole ? 0 : color;
+		}
+	}
+	return sprite;
+}
+
+// A copy of sprite carrying an opaque span table
+static sprite_t WithSpans (const sprite_t *sprite) {
+	const size_t size = sprite_SpansSize (sprite);
+	void *storage = malloc (size);
+	if (storage == NULL) { printf ("Failed to allocate %zu bytes of spans\n", size); exit (1); }
+	sprite_t copy = *sprite;
+	copy.spans = sprite_BuildSpans (sprite, storage, size);
+	return copy;
+}
+
+static void Draw (blit_e blit, const sprite_t *sprite, int x, int y) {
+	switch (blit) {
+		case blit_plain: sprite_Blit (sprite, &destination, x, y); break;
+		case blit_flipped_horizontally: sprite_BlitFlippedHorizontally (sprite, &destination, x, y); break;
+		case blit_flipped_vertically: sprite_BlitFlippedVertically (sprite, &destination, x, y); break;
+		case blit_color: sprite_BlitColor (sprite, &destination, x, y, 77); break;
+		case blit_color_flipped_horizontally: sprite_BlitFlippedHorizontallyColor (sprite, &destination, x, y, 77); break;
+		case blit_color_swap: sprite_BlitColorSwap (sprite, &destination, x, y, color_swap); break;
+		case blit_rotated: sprite_SampleRotated (sprite, &destination, x, y, 0.1f, sprite->w/2.f, sprite->h/2.f); break;
+		case blit_rotated_color: sprite_SampleRotatedColor (sprite, &destination, x, y, 0.1f, sprite->w/2.f, sprite->h/2.f, 77); break;
+		default: unreachable ();
+	}
+}
+
+// Positions step across the whole destination, including partly off each edge, so clipped rows get timed and checked too
+static u32 Run (blit_e blit, const sprite_t *sprite, int iterations) {
+	u32 hash = 2166136261u;
+	memset (destination.p, 0, destination.w * destination.h);
+	for (int i = 0; i < iterations; ++i) {
+		const int x = (i * 7) % (destination.w + sprite->w) - sprite->w + 1 - (i & 1);
+		const int y = (i * 5) % (destination.h + sprite->h) - sprite->h + 1;
+		Draw (blit, sprite, x, y);
+	}
+	for (int i = 0; i < destination.w * destination.h; ++i) hash = (hash ^ destination.p[i]) * 16777619u;
+	return hash;
+}
+
+static i64 TimeBlits (blit_e blit, const sprite_t *sprite, int iterations, u32 *hash) {
+	Run (blit, sprite, iterations / 10 + 1); // Warm up
+	const i64 start = zen_nTime ();
+	*hash = Run (blit, sprite, iterations);
+	return zen_nTime () - start;
+}
+
+static bool Bench (const char *name, const sprite_t *sprite, const sprite_t *with_spans, int iterations) {
+	bool identical = true;
+	printf ("%s (%dx%d), %d blits\n", name, sprite->w, sprite->h, iterations);
+	printf ("  %-13s", "");
+	for (sprite_blit_kernel_e kernel = sprite_blit_kernel_scalar; kernel <= sprite_blit_kernel_avx2; ++kernel) printf (" %10s %7s", kernel_names[kernel], "");
+	printf (" %10s\n", "spans");
+	for (blit_e blit = 0; blit < blit_count; ++blit) {
+		printf ("  %-13s", blit_names[blit]);
+		i64 scalar_ns = 0, ns;
+		u32 scalar_hash = 0, hash;
+		for (sprite_blit_kernel_e kernel = sprite_blit_kernel_scalar; kernel <= sprite_blit_kernel_avx2; ++kernel) {
+			if (sprite_SetBlitKernel (kernel) != kernel) { printf (" %10s %7s", "-", ""); continue; }
+			ns = TimeBlits (blit, sprite, iterations, &hash);
+			if (kernel == sprite_blit_kernel_scalar) { scalar_ns = ns; scalar_hash = hash; }
+			printf (" %8.1fns %6.2fx", (f64)ns / iterations, (f64)scalar_ns / ns);
+			if (hash != scalar_hash) {
+				printf (" MISMATCH");
+				identical = false;
+			}
+		}
+		// Color swap blits test the swapped value, so they can't use spans. Rotated ones don't use row kernels or spans; they're here to compare against the others.
+		if (blit < blit_color_swap) {
+			sprite_SetBlitKernel (sprite_blit_kernel_auto);
+			ns = TimeBlits (blit, with_spans, iterations, &hash);
+			printf (" %8.1fns %6.2fx", (f64)ns / iterations, (f64)scalar_ns / ns);
+			if (hash != scalar_hash) {
+				printf (" MISMATCH");
+				identical = false;
+			}
+		}
+		printf ("\n");
+	}
+	printf ("\n");
+	return identical;
+}
+
+int main (int argc, char **argv) {
+	int iterations = 200000;
+	if (argc == 3 && strcmp (argv[1], "-f") == 0) iterations = atoi (argv[2]);
+	if ((argc != 1 && argc != 3) || iterations < 1) {
+		printf ("Usage: sprite_bench [-f iterations]\n");
+		return 1;
+	}
+	zen_Init ();
+	printf ("Best kernel on this CPU: %s\n\n", kernel_names[sprite_SetBlitKernel (sprite_blit_kernel_auto)]);
+
+	for (int i = 0; i < 256; ++i) color_swap[i] = 255 - i;
+	color_swap[0] = 0;
+	color_swap[17] = 0;
+
+	u64 random_state = 12345;
+	const sprite_t small = MakeSprite (8, 8, &random_state);
+	const sprite_t large = MakeSprite (320, 180, &random_state);
+	const sprite_t small_spans = WithSpans (&small), large_spans = WithSpans (&large), heli_spans = WithSpans (&resources_gameplay_heli);
+
+	bool identical = Bench ("small", &small, &small_spans, iterations);
+	identical &= Bench ("heli", &resources_gameplay_heli, &heli_spans, iterations);
+	identical &= Bench ("large", &large, &large_spans, MAX(1, iterations / 500));
+	if (!identical) {
+		printf ("Kernels or spans disagree with the scalar blit\n");
+		return 1;
+	}
+	return 0;
+}
@@ -63,6 +63,7 @@ extern os_private_t os_private;
 #include "sound.h"
 #include "cereal.h"
 #include "update.h"
+#include "particles.h"
 #include "zen_timer.h"
 #include "objects/_.h"
 
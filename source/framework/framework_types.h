@@ -62,9 +62,21 @@ static inline f32 AngleDifference(f32 from, f32 to) {
 	return d;
 }
 
+// One run of opaque (non-zero) pixels on a sprite row: columns start to start+length-1
+typedef struct {
+	u16 start, length;
+} sprite_span_t;
+
+// Opaque runs for every row of a sprite, left to right. Row y's runs are runs[row[y]] to runs[row[y+1]-1]. See sprite_BuildSpans.
+typedef struct {
+	const u32 *row;
+	const sprite_span_t *runs;
+} sprite_spans_t;
+
 typedef struct {
 	u16 w, h;
 	u8 *p;
+	const sprite_spans_t *spans; // Optional. When set, the plain, flipped and silhouette blits copy whole runs instead of testing every pixel. Must be rebuilt if p changes.
 } sprite_t;
 
 #define BITMAP_FONT_FIRST_VISIBLE_CHAR 33
@@ -102,6 +114,9 @@ typedef struct sound_t {
 	i16 sweep; // 0 means frequency stays the same. Otherwise, this is an offset to which frequency will lerp through the duration of the sound
 	i8 square_duty_cycle; // 0 produces a contant signal (no sound). 1 to 127 represent ~1%-50% duty cycle. The top 50% is left out since it's equivalent (usually) to the bottom 50% in reverse. Only has an effect when waveform == sound_waveform_pulse
 	i8 square_duty_cycle_sweep; // Delta from starting duty cycle across full duration of sound
+	u8 priority; // For sound effects. When every FX channel is busy, a new sound takes the channel of one with lower or equal priority (see SoundFXSetStealPolicy), or isn't played if there are none
+	u8 max_instances; // For sound effects. How many copies of this sound can play at once, or 0 for no limit. Playing one more replaces the oldest copy. Copies are sounds with the same waveform, frequency, duration and next
+	bool cache; // For sound effects. The first time it plays, queue the chain for the sound cache, and mix it from there once it's rendered instead of synthesizing it (see SoundFXCache)
     sound_waveform_e waveform;
 } sound_t;
 
@@ -19,24 +19,111 @@
 #include <pulse/simple.h>
 #include <pulse/error.h>
 
-// 5ms period size
-#define PERIOD_SIZE (SAMPLING_RATE/200)
+#ifndef SOUND_OUTPUT_SHRINK_SECONDS
+#define SOUND_OUTPUT_SHRINK_SECONDS 30
+#endif
 
-void *Sound (void *data_void) {
-    sample_buffer_size = PERIOD_SIZE;
-    RefillSampleBuffer ();
+// Buffer sizes in pa_buffer_attr are in bytes
+static pa_simple *OpenStream (u16 period_samples, u8 buffer_periods, u8 prebuffer_periods) {
+    const u32 period_bytes = period_samples * sizeof (f32);
+    int pulse_error;
+    auto simple = pa_simple_new (NULL, GAME_TITLE, PA_STREAM_PLAYBACK, NULL, "playback", &(pa_sample_spec){.format = PA_SAMPLE_FLOAT32LE, .rate = SAMPLING_RATE, .channels = 1}, NULL, &(pa_buffer_attr){.maxlength = period_bytes * buffer_periods * 2, .tlength = period_bytes * buffer_periods, .prebuf = period_bytes * prebuffer_periods, .minreq = -1, .fragsize = -1}, &pulse_error);
+    if (simple == NULL) LOG ("Failed to initialize PulseAudio [%s]", pa_strerror (pulse_error));
+    return simple;
+}
+
+static struct {
+    pa_simple *simple;
+    sound_output_config_t config;
+    pa_usec_t period_us;
+    pa_usec_t full_us; // Most latency measured since the stream filled, which is the sink's own plus a full buffer
+    u32 shrink_after_periods;
+    // Periods written since the stream was opened, and since the last underrun or change in depth
+    u32 written, settled;
+} pulse;
+
+static bool RestartStream () {
+    if (pulse.simple) {
+        pa_simple_drain (pulse.simple, NULL);
+        pa_simple_free (pulse.simple);
+    }
+    pulse.simple = OpenStream (pulse.config.period_samples, pulse.config.buffer_periods, pulse.config.prebuffer_periods);
+    pulse.written = 0;
+    pulse.full_us = 0;
+    return pulse.simple != NULL;
+}
+
+static bool PulseOpen (const char *argument) {
+    pulse.simple = NULL;
+    return true;
+}
+
+static bool PulseConfigure (sound_output_config_t *config) {
+    config->buffer_periods_min = MAX (2, config->buffer_periods_min);
+    config->buffer_periods_max = MAX (config->buffer_periods_min, config->buffer_periods_max);
+    config->buffer_periods = MAX (config->buffer_periods_min, MIN (config->buffer_periods, config->buffer_periods_max));
+    config->prebuffer_periods = MAX (1, MIN (config->prebuffer_periods, config->buffer_periods_min));
+    pulse.config = *config;
+    pulse.period_us = config->period_samples * 1000000ull / SAMPLING_RATE;
+    pulse.shrink_after_periods = SOUND_OUTPUT_SHRINK_SECONDS * SAMPLING_RATE / config->period_samples;
+    pulse.settled = 0;
+    return RestartStream ();
+}
 
-    pa_simple *simple = NULL;
+static bool PulseWrite (const f32 *samples, int count) {
     int pulse_error;
-    { simple = pa_simple_new (NULL, GAME_TITLE, PA_STREAM_PLAYBACK, NULL, "playback", &(pa_sample_spec){.format = PA_SAMPLE_FLOAT32LE, .rate = SAMPLING_RATE, .channels = 1}, NULL, &(pa_buffer_attr){.maxlength = PERIOD_SIZE * 16, .tlength = PERIOD_SIZE * 8, .prebuf = PERIOD_SIZE * 4, .minreq = -1, .fragsize = PERIOD_SIZE * 4}, &pulse_error); if (simple == NULL) { LOG ("Failed to initialize PulseAudio [%s]", pa_strerror (pulse_error)); return NULL; }}
+    // The simple API has no underflow notification, and its latency includes the sink's. Once the stream has filled, the most latency seen less the buffer is the sink's, and the rest of this measurement is what's queued ahead of this write. Under half a period queued means it ran dry since the last write.
+    auto latency = pa_simple_get_latency (pulse.simple, &pulse_error);
+    bool underrun = false;
+    if (latency != (pa_usec_t)-1) {
+        if (pulse.written >= pulse.config.buffer_periods) {
+            pulse.full_us = MAX (pulse.full_us, latency);
+            const pa_usec_t sink_us = pulse.full_us - MIN (pulse.full_us, pulse.period_us * pulse.config.buffer_periods);
+            underrun = latency < sink_us + pulse.period_us / 2;
+        }
+        SoundOutputReport (latency, underrun, pulse.config.period_samples, pulse.config.buffer_periods);
+    }
+
+    if (pulse.config.adaptive) {
+        u8 buffer_periods = pulse.config.buffer_periods;
+        if (underrun) {
+            pulse.settled = 0;
+            if (buffer_periods < pulse.config.buffer_periods_max) ++buffer_periods;
+        }
+        else if (++pulse.settled >= pulse.shrink_after_periods) {
+            pulse.settled = 0;
+            if (buffer_periods > pulse.config.buffer_periods_min) --buffer_periods;
+        }
+        if (buffer_periods != pulse.config.buffer_periods) {
+            LOG ("Changing audio buffer from %d to %d periods", pulse.config.buffer_periods, buffer_periods);
+            pulse.config.buffer_periods = buffer_periods;
+            if (!RestartStream ()) return false;
+        }
+    }
+
+    if (pa_simple_write (pulse.simple, samples, count * sizeof (f32), &pulse_error) != 0) { LOG ("PulseAudio failed to write buffer [%s]", pa_strerror (pulse_error)); return false; }
+    ++pulse.written;
+    return true;
+}
+
+static void PulseClose () {
+    if (pulse.simple) pa_simple_free (pulse.simple);
+    pulse.simple = NULL;
+}
 
-    while (!sound_extern_data.quit) {
-        RefillSampleBuffer ();
-        int buffer_index = 0;
-        { auto result = pa_simple_write (simple, sample_buffer[sample_buffer_swap].samples, PERIOD_SIZE * sizeof (f32), &pulse_error); if (result != 0) { LOG ("PulseAudio failed to write buffer [%s]", pa_strerror (pulse_error)); return NULL; } }
+static const sound_backend_t sound_backend_pulse = {"pulse", PulseOpen, PulseConfigure, PulseWrite, PulseClose};
+
+void *Sound (void *data_void) {
+    const char *argument;
+    const sound_backend_t *backend = SoundBackendRequested (&argument);
+    if (backend == NULL) backend = &sound_backend_pulse;
+    SoundRunBackend (backend, argument);
+    if (!sound_extern_data.quit && backend != &sound_backend_null) {
+        LOG ("Sound output [%s] stopped. Running the null sound output instead", backend->name);
+        SoundRunBackend (&sound_backend_null, NULL);
     }
 
-    LOG ("Render thread exiting normally");
+    LOG ("Sound thread exiting normally");
 
     return NULL;
 }
@@ -709,7 +709,7 @@ void os_DrawScreen () {
 	// glBindTexture (GL_TEXTURE_2D, os_private.gl.texture);
 	if (os_LogGLErrors ()) LOG ("Had GL errors");
 	// BUG: When I ALT+F4, this line sometimes segfaults
-	glTexImage2D (GL_TEXTURE_2D, 0, GL_RED, os_private.frame_buffer.width, os_private.frame_buffer.height, 0, GL_RED, GL_UNSIGNED_BYTE, os_private.frame_buffer.pixels);
+	os_UploadFrameBuffer ();
 	if (os_LogGLErrors ()) LOG ("Had GL errors");
 	glBegin (GL_TRIANGLE_STRIP);
 	glTexCoord2f (0,0); glVertex2f(-1,-1);
@@ -49,6 +49,12 @@ OSStatus deviceChangedCallback(AudioObjectID inObjectID, UInt32 inNumberAddresse
 }
 
 void *Sound (void* args) {
+    const char *argument;
+    const sound_backend_t *backend = SoundBackendRequested (&argument);
+    if (backend) {
+        SoundRunBackend (backend, argument);
+        return NULL;
+    }
     sample_buffer_size = PERIOD_SIZE;
 
     RefillSampleBuffer();
@@ -23,7 +23,6 @@ update_data_t update_data = {};
 render_data_t render_data = {};
 pthread_t thread_render = 0, thread_update = 0, thread_sound = 0;
 bool quit = false;
-pthread_mutex_t update_render_swap_state_mutex = (pthread_mutex_t){};
 
 sprite_t render_data_frame_0 = {.p = (u8[RESOLUTION_WIDTH*RESOLUTION_HEIGHT]){}}, render_data_frame_1 = {.p = (u8[RESOLUTION_WIDTH*RESOLUTION_HEIGHT]){}};
 
@@ -79,6 +78,7 @@ static struct [[gnu::packed]] {
 static_assert (sizeof (bmp_static_data) == 54+256*4);
 
 void OutputScreenshot ();
+void OutputRenderStateCapture ();
 #endif
 
 int main (int argc, char **argv) {
@@ -101,7 +101,6 @@ int main (int argc, char **argv) {
 	zen_Init();
 	folder_SetCurrentFolderAsBaseDirectory ();
 
-	if (pthread_mutex_init (&update_render_swap_state_mutex, NULL) != 0) { LOG ("Failed to initialize update_render_swap_state_mutex"); abort (); }
 	if (pthread_create (&thread_sound, NULL, Sound, NULL)) { LOG ("Failed to create sound thread."); abort (); }
 	if (pthread_create (&thread_update, NULL, Update, NULL)) { LOG ("Failed to create update thread."); abort (); }
 	if (pthread_create (&thread_render, NULL, Render, NULL)) { LOG ("Failed to create render thread."); abort (); }
@@ -150,6 +149,10 @@ int main (int argc, char **argv) {
 					case os_KEY_P: {
 						OutputScreenshot();
 					} break;
+
+					case os_KEY_O: {
+						OutputRenderStateCapture ();
+					} break;
 					#endif
 
 					default: break;
@@ -283,4 +286,18 @@ void OutputScreenshot () {
 	fclose (phil);
 	render_data.resume_thread = true;
 }
-#endif
\ No newline at end of file
+
+// Saves the latest render state for replaying in render_bench
+void OutputRenderStateCapture () {
+	char buf[1024];
+	snprintf (buf, sizeof (buf), "%s/%s/render_states", os_public.directories.config, GAME_FOLDER_CONFIG);
+	folder_CreateDirectoryRecursive (buf);
+	auto t = time(0);
+	auto lt = localtime (&t);
+	for (int i = 0; true; ++i) {
+		snprintf (buf, sizeof(buf), "%s/%s/render_states/%04d-%02d-%02d-%02d-%02d-%02d-%02d.krsc", os_public.directories.config, GAME_FOLDER_CONFIG, lt->tm_year + 1900, lt->tm_mon + 1, lt->tm_mday, lt->tm_hour, lt->tm_min, lt->tm_sec, i);
+		if (!folder_FileExists (buf)) break;
+	}
+	Render_CaptureWrite (buf);
+}
+#endif
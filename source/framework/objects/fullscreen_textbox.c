@@ -25,5 +25,5 @@ bool FullscreenTextBox_Create (const char *const text) {
     const auto len = strlen(text) + 1; // Add one for null terminator
     char a[len];
     memcpy (a, text, len);
-    return Update_ObjectCreate (FullscreenTextBox_Update, 127, true, a);
+    return Update_ObjectCreate (FullscreenTextBox_Update, 127, true, a).generation != 0;
 }
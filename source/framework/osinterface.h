@@ -30,6 +30,11 @@ typedef u8 frame_buffer_pixel_t;
 typedef u32 frame_buffer_pixel_t;
 #endif
 
+// Most row ranges os_SetWindowFrameBufferDirtyRows keeps for one frame
+#ifndef OS_FRAME_BUFFER_DIRTY_ROWS_MAX
+#define OS_FRAME_BUFFER_DIRTY_ROWS_MAX 16
+#endif
+
 typedef enum {
 	os_EVENT_NULL, os_EVENT_INTERNAL, os_EVENT_QUIT, os_EVENT_WINDOW_RESIZE, os_EVENT_KEY_PRESS, os_EVENT_KEY_RELEASE, os_EVENT_MOUSE_BUTTON_PRESS, os_EVENT_MOUSE_BUTTON_RELEASE, os_EVENT_MOUSE_MOVE, os_EVENT_MOUSE_SCROLL,
 } os_event_e;
@@ -170,6 +175,12 @@ typedef struct {
 		int scale;
 		int left, bottom;
 		bool has_been_set;
+		struct {
+			bool partial; // Set by os_SetWindowFrameBufferDirtyRows, cleared by the next upload
+			int count;
+			struct {int bottom, top;} rows[OS_FRAME_BUFFER_DIRTY_ROWS_MAX];
+			unsigned int texture_width, texture_height; // Size of the last whole upload
+		} dirty;
 	} frame_buffer;
 	#ifdef OSINTERFACE_EVENT_AND_RENDER_THREADS_ARE_SEPARATE
 	struct {
@@ -240,6 +251,12 @@ typedef struct {
 		int scale;
 		int left, bottom;
 		bool has_been_set;
+		struct {
+			bool partial; // Set by os_SetWindowFrameBufferDirtyRows, cleared by the next upload
+			int count;
+			struct {int bottom, top;} rows[OS_FRAME_BUFFER_DIRTY_ROWS_MAX];
+			unsigned int texture_width, texture_height; // Size of the last whole upload
+		} dirty;
 	} frame_buffer;
 	struct {
 		volatile bool is_valid;
@@ -285,6 +302,12 @@ typedef struct {
 		int scale;
 		int left, bottom;
 		bool has_been_set;
+		struct {
+			bool partial; // Set by os_SetWindowFrameBufferDirtyRows, cleared by the next upload
+			int count;
+			struct {int bottom, top;} rows[OS_FRAME_BUFFER_DIRTY_ROWS_MAX];
+			unsigned int texture_width, texture_height; // Size of the last whole upload
+		} dirty;
 	} frame_buffer;
 	struct {
 		volatile bool is_valid;
@@ -339,6 +362,14 @@ os_intxy_t os_WindowPositionToScaledFrameBufferPosition (int windowx, int window
 os_intxy_t os_ScaledFrameBufferPositionToWindowPosition (int framex, int framey);
 void os_SetWindowFrameBuffer (frame_buffer_pixel_t *pixels, int width, int height);
 void os_WindowFrameBufferCalculateScale ();
+typedef struct {int bottom, top;} os_row_range_t;
+// Limits the next os_DrawScreen to uploading these rows of the frame buffer, where everything else is unchanged since the last. Rows count from the bottom and both ends are inclusive. Call from the thread which calls os_DrawScreen. Without it, the whole frame buffer is uploaded.
+void os_SetWindowFrameBufferDirtyRows (const os_row_range_t *ranges, int count);
+#endif
+
+#if defined OSINTERFACE_COLOR_INDEX_MODE && !defined OSINTERFACE_NATIVE_GL_RENDERING
+// Used by os_DrawScreen. Uploads the frame buffer to the bound texture, only the dirty rows if there are any.
+void os_UploadFrameBuffer ();
 #endif
 
 // UNTESTED FUNCTION PROBABLY DOESN'T WORK YET
@@ -58,6 +58,19 @@ void os_SetWindowFrameBuffer (frame_buffer_pixel_t *pixels, int width, int heigh
 	os_WindowFrameBufferCalculateScale ();
 }
 
+void os_SetWindowFrameBufferDirtyRows (const os_row_range_t *ranges, int count) {
+	auto dirty = &os_private.frame_buffer.dirty;
+	dirty->partial = true;
+	dirty->count = 0;
+	for (int i = 0; i < count; ++i) {
+		const int bottom = Max (ranges[i].bottom, 0), top = Min (ranges[i].top, (int)os_private.frame_buffer.height-1);
+		if (bottom > top) continue;
+		// Merge anything past the limit into the last range
+		if (dirty->count == OS_FRAME_BUFFER_DIRTY_ROWS_MAX) dirty->rows[dirty->count-1].top = Max (dirty->rows[dirty->count-1].top, top);
+		else dirty->rows[dirty->count++] = (typeof(dirty->rows[0])){bottom, top};
+	}
+}
+
 os_intxy_t os_WindowPositionToScaledFrameBufferPosition (int windowx, int windowy) {
 	return (os_intxy_t){
 		(windowx - os_private.frame_buffer.left) / os_private.frame_buffer.scale,
@@ -99,6 +112,23 @@ void os_ClearScreen () {
 
 #ifdef OSINTERFACE_COLOR_INDEX_MODE
 
+void os_UploadFrameBuffer () {
+	auto fb = &os_private.frame_buffer;
+	// Sub-uploads need the texture to already hold the last frame at this size
+	if (fb->dirty.partial && fb->dirty.texture_width == fb->width && fb->dirty.texture_height == fb->height) {
+		for (int i = 0; i < fb->dirty.count; ++i) {
+			const auto rows = fb->dirty.rows[i];
+			glTexSubImage2D (GL_TEXTURE_2D, 0, 0, rows.bottom, fb->width, rows.top - rows.bottom + 1, GL_RED, GL_UNSIGNED_BYTE, &fb->pixels[rows.bottom * fb->width]);
+		}
+	}
+	else {
+		glTexImage2D (GL_TEXTURE_2D, 0, GL_RED, fb->width, fb->height, 0, GL_RED, GL_UNSIGNED_BYTE, fb->pixels);
+		fb->dirty.texture_width = fb->width;
+		fb->dirty.texture_height = fb->height;
+	}
+	fb->dirty.partial = false;
+}
+
 bool os_CreateGLColorMap () {
 	if (os_LogGLErrors ()) { LOG ("OpenGL error"); return false; }
 	auto vertex = glCreateShader (GL_VERTEX_SHADER);
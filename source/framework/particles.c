@@ -0,0 +1,537 @@
+// Copyright [2025] [Nicholas Walton]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "framework.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define PARTICLE_GRAVITY -2048
+
+typedef struct {
+	int first, capacity, count; // The pool is [first, first+capacity) of the particle arrays
+	// When a full pool replaces its oldest particles, the newest particles wrap around to the front. The pool is in age order starting from oldest until ParticlesUpdate rotates it back to 0.
+	int oldest;
+	particles_overflow_e overflow;
+	u32 dropped, replaced;
+} particle_pool_t;
+
+static vec2i32split_t particles_default_position[PARTICLES_DEFAULT_CAPACITY];
+static v2i32 particles_default_velocity[PARTICLES_DEFAULT_CAPACITY];
+static int particles_default_time[PARTICLES_DEFAULT_CAPACITY];
+static u8 particles_default_pixel[PARTICLES_DEFAULT_CAPACITY];
+static bool particles_default_gravity[PARTICLES_DEFAULT_CAPACITY];
+static bool particles_default_dead[PARTICLES_DEFAULT_CAPACITY];
+
+// Structure of arrays, so the update touches only what it needs and vectorizes
+static struct {
+	vec2i32split_t *position;
+	v2i32 *velocity;
+	int *time;
+	u8 *pixel;
+	bool *gravity;
+	bool *dead; // Particles which have timed out or left the boundary this update
+	int capacity, reserved; // Particles the storage holds, and how many of those are in pools
+	int pool_count;
+	particle_pool_t pools[PARTICLE_EMITTERS_MAX];
+} particles = {
+	.position = particles_default_position,
+	.velocity = particles_default_velocity,
+	.time = particles_default_time,
+	.pixel = particles_default_pixel,
+	.gravity = particles_default_gravity,
+	.dead = particles_default_dead,
+	.capacity = PARTICLES_DEFAULT_CAPACITY,
+	.reserved = PARTICLES_DEFAULT_CAPACITY,
+	.pool_count = 1,
+	.pools[0] = {.capacity = PARTICLES_DEFAULT_CAPACITY, .overflow = particles_overflow_replace_oldest},
+};
+
+static inline particle_pool_t *ParticlePool (particle_emitter_t emitter) {
+	if (emitter.index < 0 || emitter.index >= particles.pool_count) return NULL;
+	return &particles.pools[emitter.index];
+}
+
+bool ParticlesConfigure (void *storage, size_t size, int default_capacity, particles_overflow_e default_overflow) {
+	int capacity = PARTICLES_DEFAULT_CAPACITY;
+	if (storage) {
+		if ((uintptr_t)storage % alignof (vec2i32split_t)) {
+			LOG ("Particle storage isn't aligned");
+			return false;
+		}
+		capacity = MIN (size / PARTICLE_STORAGE_BYTES, INT32_MAX);
+	}
+	if (default_capacity < 0 || default_capacity > capacity) {
+		LOG ("Particle storage holds %d particles, fewer than the default pool's %d", capacity, default_capacity);
+		return false;
+	}
+
+	if (storage) {
+		// Largest alignment first, so every array starts aligned
+		u8 *next = storage;
+		particles.position = (vec2i32split_t *)next; next += capacity * sizeof (vec2i32split_t);
+		particles.velocity = (v2i32 *)next; next += capacity * sizeof (v2i32);
+		particles.time = (int *)next; next += capacity * sizeof (int);
+		particles.pixel = next; next += capacity;
+		particles.gravity = (bool *)next; next += capacity;
+		particles.dead = (bool *)next;
+	}
+	else {
+		particles.position = particles_default_position;
+		particles.velocity = particles_default_velocity;
+		particles.time = particles_default_time;
+		particles.pixel = particles_default_pixel;
+		particles.gravity = particles_default_gravity;
+		particles.dead = particles_default_dead;
+	}
+	particles.capacity = capacity;
+	particles.reserved = default_capacity;
+	particles.pool_count = 1;
+	particles.pools[0] = (particle_pool_t){.capacity = default_capacity, .overflow = default_overflow};
+	return true;
+}
+
+particle_emitter_t ParticleEmitterCreate (int capacity, particles_overflow_e overflow) {
+	if (capacity < 1 || capacity > particles.capacity - particles.reserved || particles.pool_count >= PARTICLE_EMITTERS_MAX) {
+		LOG ("No room for a particle emitter of %d particles (%d free, %d of %d emitters)", capacity, particles.capacity - particles.reserved, particles.pool_count, PARTICLE_EMITTERS_MAX);
+		return (particle_emitter_t){-1};
+	}
+	particles.pools[particles.pool_count] = (particle_pool_t){.first = particles.reserved, .capacity = capacity, .overflow = overflow};
+	particles.reserved += capacity;
+	return (particle_emitter_t){particles.pool_count++};
+}
+
+void ParticleEmitterClear (particle_emitter_t emitter) {
+	auto pool = ParticlePool (emitter);
+	if (pool) pool->count = pool->oldest = 0;
+}
+
+void ParticlesClear () {
+	for (int i = 0; i < particles.pool_count; ++i)
+		particles.pools[i].count = particles.pools[i].oldest = 0;
+}
+
+particle_emitter_stats_t ParticleEmitterStats (particle_emitter_t emitter) {
+	const auto pool = ParticlePool (emitter);
+	if (!pool) return (particle_emitter_stats_t){};
+	return (particle_emitter_stats_t){.count = pool->count, .capacity = pool->capacity, .dropped = pool->dropped, .replaced = pool->replaced};
+}
+
+// Index in the particle arrays for a new particle in pool, going by its overflow policy when it's full, or -1 if the particle is dropped
+static inline int ParticlePoolSlot (particle_pool_t *pool) {
+	if (pool->count < pool->capacity) return pool->first + pool->count++;
+	if (pool->overflow == particles_overflow_replace_oldest && pool->capacity > 0) {
+		const int i = pool->oldest;
+		pool->oldest = (pool->oldest + 1) % pool->capacity;
+		++pool->replaced;
+		return pool->first + i;
+	}
+	++pool->dropped;
+	return -1;
+}
+
+void ParticleAdd_ (u8 pixel, int x, int y, i32 vx, i32 vy, ParticleAdd_arguments arguments) {
+	auto pool = ParticlePool (arguments.emitter);
+	if (!pool) return;
+
+	const int i = ParticlePoolSlot (pool);
+	if (i < 0) return;
+	particles.pixel[i] = pixel;
+	particles.position[i].x.high = x;
+	particles.position[i].y.high = y;
+	particles.position[i].x.low = 0;
+	particles.position[i].y.low = 0;
+	particles.velocity[i].x = vx;
+	particles.velocity[i].y = vy;
+	particles.gravity[i] = arguments.gravity;
+	particles.time[i] = arguments.time;
+}
+
+static void ParticleSwap (int a, int b) {
+	SWAP (particles.position[a], particles.position[b]);
+	SWAP (particles.velocity[a], particles.velocity[b]);
+	SWAP (particles.time[a], particles.time[b]);
+	SWAP (particles.pixel[a], particles.pixel[b]);
+	SWAP (particles.gravity[a], particles.gravity[b]);
+}
+
+static void ParticlesReverse (int first, int end) {
+	for (int a = first, b = end-1; a < b; ++a, --b) ParticleSwap (a, b);
+}
+
+// Moves every particle in [first, end) in one pass with no branches and no dependencies between particles, so it vectorizes, marking the ones to remove
+static void ParticlesIntegrate (int first, int end, int left, int right, int bottom, int top) {
+	// Locals, so the compiler knows the arrays don't overlap
+	vec2i32split_t *restrict position = particles.position;
+	v2i32 *restrict velocity = particles.velocity;
+	int *restrict time = particles.time;
+	const bool *restrict gravity = particles.gravity;
+	bool *restrict dead = particles.dead;
+
+	for (int i = first; i < end; ++i) {
+		// A non-zero time counts down each update and the particle expires when it reaches 0. The default of -1 never gets there.
+		const bool expired = time[i] == 1;
+		time[i] -= time[i] != 0;
+		velocity[i].y += gravity[i] ? PARTICLE_GRAVITY : 0;
+		position[i].x.i32 += velocity[i].x;
+		position[i].y.i32 += velocity[i].y;
+		const int x = position[i].x.high;
+		const int y = position[i].y.high;
+		dead[i] = expired | (x < left) | (x > right) | (y < bottom) | (y > top);
+	}
+}
+
+// Removes the marked particles in [first, end) by moving the survivors down, keeping their order, so it's O(n) however many die at once. Returns how many survived.
+static int ParticlesCompact (int first, int end) {
+	int kept = first;
+	for (int i = first; i < end; ++i) {
+		if (particles.dead[i]) continue;
+		if (kept != i) {
+			particles.position[kept] = particles.position[i];
+			particles.velocity[kept] = particles.velocity[i];
+			particles.pixel[kept] = particles.pixel[i];
+			particles.gravity[kept] = particles.gravity[i];
+			particles.time[kept] = particles.time[i];
+		}
+		++kept;
+	}
+	return kept - first;
+}
+
+// Rotates the oldest survivor to the front, so new particles go on the end in age order again. Call after compacting the pool, with what ParticlePoolOldestSurvivors returned for it.
+static void ParticlePoolFinish (particle_pool_t *pool, int old_oldest_survivors) {
+	const int oldest = pool->first + old_oldest_survivors;
+	const int end = pool->first + pool->count;
+	if (oldest != pool->first && oldest != end) {
+		ParticlesReverse (pool->first, oldest);
+		ParticlesReverse (oldest, end);
+		ParticlesReverse (pool->first, end);
+	}
+	pool->oldest = 0;
+}
+
+// Survivors before the pool's oldest particle, which is where it ends up after compacting
+static int ParticlePoolOldestSurvivors (const particle_pool_t *pool) {
+	int survivors = 0;
+	for (int i = pool->first; i < pool->first + pool->oldest; ++i) survivors += !particles.dead[i];
+	return survivors;
+}
+
+// ************************************
+// Update threads
+// ************************************
+#ifndef PARTICLE_THREADS
+#define PARTICLE_THREADS 1
+#endif
+#ifndef PARTICLE_THREADS_MAX
+#define PARTICLE_THREADS_MAX 16
+#endif
+static_assert (PARTICLE_THREADS >= 1 && PARTICLE_THREADS <= PARTICLE_THREADS_MAX);
+// Particles per chunk of work. Chunks are cut the same way for any number of threads, so the threads only change who does the work.
+#ifndef PARTICLE_CHUNK_SIZE
+#define PARTICLE_CHUNK_SIZE 2048
+#endif
+#ifndef PARTICLE_CHUNKS_MAX
+#define PARTICLE_CHUNKS_MAX 1024
+#endif
+static_assert (PARTICLE_CHUNKS_MAX > PARTICLE_EMITTERS_MAX);
+
+typedef struct {
+	int first, end;
+	int kept; // Survivors, compacted to the start of the chunk
+} particle_chunk_t;
+
+static struct {
+	int count; // Threads updating particles, including the update thread
+	int started; // Worker threads created so far, which is at most PARTICLE_THREADS_MAX-1
+	pthread_t threads[PARTICLE_THREADS_MAX-1];
+	pthread_mutex_t mutex;
+	pthread_cond_t start, done;
+	u64 generation;
+	int workers; // Worker threads taking part in this update. The rest wake and go straight back to waiting.
+	int remaining;
+	int left, right, bottom, top;
+	int chunk_count;
+	_Atomic int next_chunk;
+	_Atomic i64 work_ns; // Time spent in chunks, summed over threads
+	particle_chunk_t chunks[PARTICLE_CHUNKS_MAX];
+	particles_update_stats_t stats;
+} particle_threads = {
+	.count = PARTICLE_THREADS,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.start = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+// Takes chunks until there are none left. Each chunk is marked and compacted on its own, so they can go in any order on any thread.
+static void ParticleChunksRun () {
+	const i64 start = zen_nTime ();
+	int c;
+	while ((c = atomic_fetch_add_explicit (&particle_threads.next_chunk, 1, memory_order_relaxed)) < particle_threads.chunk_count) {
+		auto chunk = &particle_threads.chunks[c];
+		ParticlesIntegrate (chunk->first, chunk->end, particle_threads.left, particle_threads.right, particle_threads.bottom, particle_threads.top);
+		chunk->kept = ParticlesCompact (chunk->first, chunk->end);
+	}
+	atomic_fetch_add_explicit (&particle_threads.work_ns, zen_nTime () - start, memory_order_relaxed);
+}
+
+static void *ParticleThread (void *argument) {
+	const int id = (intptr_t)argument; // 0 for the first worker thread
+	u64 generation = 0;
+	pthread_mutex_lock (&particle_threads.mutex);
+	while (true) {
+		while (particle_threads.generation == generation) pthread_cond_wait (&particle_threads.start, &particle_threads.mutex);
+		generation = particle_threads.generation;
+		// There may be more threads than chunks, or than ParticlesSetThreads now asks for. Only the ones counted in remaining may run, or the update thread could move particles under them.
+		if (id >= particle_threads.workers) continue;
+		pthread_mutex_unlock (&particle_threads.mutex);
+
+		ParticleChunksRun ();
+
+		pthread_mutex_lock (&particle_threads.mutex);
+		if (--particle_threads.remaining == 0) pthread_cond_signal (&particle_threads.done);
+	}
+	return NULL;
+}
+
+void ParticlesSetThreads (int count) {
+	particle_threads.count = MAX (1, MIN (PARTICLE_THREADS_MAX, count));
+}
+
+particles_update_stats_t ParticlesUpdateStats () {
+	return particle_threads.stats;
+}
+
+// Cuts every pool into chunks of at least PARTICLE_CHUNK_SIZE, bigger if there would be more than PARTICLE_CHUNKS_MAX, and runs them across the threads. Then moves each chunk's survivors down to follow the previous chunk's, in order, which leaves exactly what one pass over the pool would.
+static int ParticlesUpdateChunked (int total) {
+	const int chunk_size = MAX (PARTICLE_CHUNK_SIZE, (total + PARTICLE_CHUNKS_MAX - PARTICLE_EMITTERS_MAX - 1) / (PARTICLE_CHUNKS_MAX - PARTICLE_EMITTERS_MAX));
+	int chunk_count = 0;
+	for (int p = 0; p < particles.pool_count; ++p) {
+		const auto pool = &particles.pools[p];
+		for (int first = pool->first; first < pool->first + pool->count; first += chunk_size)
+			particle_threads.chunks[chunk_count++] = (particle_chunk_t){.first = first, .end = MIN (first + chunk_size, pool->first + pool->count)};
+	}
+
+	while (particle_threads.started < particle_threads.count-1) {
+		if (pthread_create (&particle_threads.threads[particle_threads.started], NULL, ParticleThread, (void *)(intptr_t)particle_threads.started)) {
+			LOG ("Failed to create particle thread. Updating with %d threads", particle_threads.started+1);
+			particle_threads.count = particle_threads.started+1;
+			break;
+		}
+		++particle_threads.started;
+	}
+	const int workers = MIN (particle_threads.count, chunk_count) - 1;
+
+	pthread_mutex_lock (&particle_threads.mutex);
+	particle_threads.chunk_count = chunk_count;
+	particle_threads.next_chunk = 0;
+	particle_threads.workers = workers;
+	particle_threads.remaining = workers;
+	if (workers > 0) {
+		++particle_threads.generation;
+		pthread_cond_broadcast (&particle_threads.start);
+	}
+	pthread_mutex_unlock (&particle_threads.mutex);
+
+	ParticleChunksRun ();
+
+	pthread_mutex_lock (&particle_threads.mutex);
+	while (particle_threads.remaining > 0) pthread_cond_wait (&particle_threads.done, &particle_threads.mutex);
+	pthread_mutex_unlock (&particle_threads.mutex);
+
+	int c = 0;
+	for (int p = 0; p < particles.pool_count; ++p) {
+		const auto pool = &particles.pools[p];
+		const int oldest_survivors = pool->oldest ? ParticlePoolOldestSurvivors (pool) : 0;
+		int kept = pool->first;
+		for (; c < chunk_count && particle_threads.chunks[c].first < pool->first + pool->count; ++c) {
+			const auto chunk = &particle_threads.chunks[c];
+			if (kept != chunk->first) {
+				memmove (&particles.position[kept], &particles.position[chunk->first], chunk->kept * sizeof (*particles.position));
+				memmove (&particles.velocity[kept], &particles.velocity[chunk->first], chunk->kept * sizeof (*particles.velocity));
+				memmove (&particles.time[kept], &particles.time[chunk->first], chunk->kept * sizeof (*particles.time));
+				memmove (&particles.pixel[kept], &particles.pixel[chunk->first], chunk->kept * sizeof (*particles.pixel));
+				memmove (&particles.gravity[kept], &particles.gravity[chunk->first], chunk->kept * sizeof (*particles.gravity));
+			}
+			kept += chunk->kept;
+		}
+		pool->count = kept - pool->first;
+		ParticlePoolFinish (pool, oldest_survivors);
+	}
+	return workers + 1;
+}
+
+void ParticlesUpdate (int left, int right, int bottom, int top) {
+	const i64 start = zen_nTime ();
+	int total = 0;
+	for (int p = 0; p < particles.pool_count; ++p) total += particles.pools[p].count;
+
+	int threads = 1;
+	particle_threads.work_ns = 0;
+	if (particle_threads.count > 1 && total > PARTICLE_CHUNK_SIZE) {
+		particle_threads.left = left;
+		particle_threads.right = right;
+		particle_threads.bottom = bottom;
+		particle_threads.top = top;
+		threads = ParticlesUpdateChunked (total);
+	}
+	else {
+		for (int p = 0; p < particles.pool_count; ++p) {
+			auto pool = &particles.pools[p];
+			ParticlesIntegrate (pool->first, pool->first + pool->count, left, right, bottom, top);
+			const int oldest_survivors = pool->oldest ? ParticlePoolOldestSurvivors (pool) : 0;
+			pool->count = ParticlesCompact (pool->first, pool->first + pool->count);
+			ParticlePoolFinish (pool, oldest_survivors);
+		}
+	}
+
+	const i64 ns = zen_nTime () - start;
+	auto stats = &particle_threads.stats;
+	stats->update_us = ns / 1000;
+	// Chunk time on every thread is what one thread would have spent on them, near enough
+	stats->saved_us = MAX (0, particle_threads.work_ns - ns) / 1000;
+	stats->particles = total;
+	stats->threads = threads;
+}
+
+void ParticlesRender () {
+	for (int p = 0; p < particles.pool_count; ++p) {
+		const auto pool = &particles.pools[p];
+		for (int i = pool->first; i < pool->first + pool->count; ++i)
+			Render_Particle (particles.position[i].x.high, particles.position[i].y.high, particles.pixel[i], false);
+	}
+}
+
+void ParticleDelete (particle_emitter_t emitter, int index) {
+	auto pool = ParticlePool (emitter);
+	// Ignore out of bounds rather than letting count go negative or reading past the end
+	if (!pool || index < 0 || index >= pool->count) return;
+	const int last = pool->first + --pool->count;
+	index += pool->first;
+	particles.position[index] = particles.position[last];
+	particles.velocity[index] = particles.velocity[last];
+	particles.pixel[index] = particles.pixel[last];
+	particles.gravity[index] = particles.gravity[last];
+	particles.time[index] = particles.time[last];
+	if (pool->oldest >= pool->count) pool->oldest = 0;
+}
+
+// Opaque pixels gathered, and then turned into particles, this many at a time
+#ifndef PARTICLE_SPRITE_BATCH
+#define PARTICLE_SPRITE_BATCH 256
+#endif
+
+typedef struct {
+	const sprite_t *sprite;
+	particle_pool_t *pool;
+	int x, y, flipx, flipy; // flipx and flipy are -1 or 1
+	i32 velocity;
+	f32 c, s; // Sprite rotation
+	f32 dx, dy; // Unit vector in the launch direction
+	CreateParticlesFromSprite_arguments arguments;
+	int count;
+	i16 sx[PARTICLE_SPRITE_BATCH], sy[PARTICLE_SPRITE_BATCH];
+	u8 pixel[PARTICLE_SPRITE_BATCH];
+} sprite_particles_t;
+
+static void SpriteParticlesFlush (sprite_particles_t *batch) {
+	const int n = batch->count;
+	batch->count = 0;
+
+	// The random stream is sequential, so draw all of it first and keep the maths below free of calls
+	u32 random_angle[PARTICLE_SPRITE_BATCH], random_speed[PARTICLE_SPRITE_BATCH];
+	for (int i = 0; i < n; ++i) {
+		random_angle[i] = DiscreteRandom_Next (&random_state);
+		random_speed[i] = DiscreteRandom_Next (&random_state);
+	}
+
+	i32 px[PARTICLE_SPRITE_BATCH], py[PARTICLE_SPRITE_BATCH], vx[PARTICLE_SPRITE_BATCH], vy[PARTICLE_SPRITE_BATCH];
+	const auto arguments = &batch->arguments;
+	for (int i = 0; i < n; ++i) {
+		const int tx = batch->sx[i] - arguments->originx;
+		const int ty = batch->sy[i] - arguments->originy;
+		const int rx = batch->c*tx - batch->s*ty;
+		const int ry = batch->s*tx + batch->c*ty;
+		px[i] = batch->x + batch->flipx * rx;
+		py[i] = batch->y + batch->flipy * ry;
+		// Up to 0.01 turns either side of the direction. That's small enough that 1 - a²/2 and a - a³/6 are as good as cos and sin, and rotating the direction by them saves calling both per particle.
+		const f32 a = (0.02f * ((f32)random_angle[i] / (f32)DISCRETE_RANDOM_MAX) - 0.01f) * (2 * (f32)M_PI);
+		const f32 ca = 1 - a*a * 0.5f;
+		const f32 sa = a - a*a*a * (1.f / 6);
+		const i32 speed = batch->velocity + (i32)(random_speed[i] % 32769) - 16384;
+		vx[i] = (batch->dx * ca - batch->dy * sa) * speed;
+		vy[i] = (batch->dy * ca + batch->dx * sa) * speed;
+	}
+
+	// Straight onto the end of the pool while there's room, then one at a time by its overflow policy
+	auto pool = batch->pool;
+	const int room = MIN (n, pool->capacity - pool->count);
+	const int end = pool->first + pool->count;
+	pool->count += room;
+	for (int i = 0; i < n; ++i) {
+		const int slot = i < room ? end + i : ParticlePoolSlot (pool);
+		if (slot < 0) continue;
+		particles.pixel[slot] = arguments->color ? arguments->color : batch->pixel[i];
+		particles.position[slot].x = (int32split_t){.high = px[i]};
+		particles.position[slot].y = (int32split_t){.high = py[i]};
+		particles.velocity[slot] = (v2i32){vx[i], vy[i]};
+		particles.gravity[slot] = true;
+		particles.time[slot] = -1;
+	}
+}
+
+static inline void SpriteParticlesPush (sprite_particles_t *batch, int sx, int sy, u8 pixel) {
+	batch->sx[batch->count] = sx;
+	batch->sy[batch->count] = sy;
+	batch->pixel[batch->count] = pixel;
+	if (++batch->count == PARTICLE_SPRITE_BATCH) SpriteParticlesFlush (batch);
+}
+
+// Gathers the opaque pixels, from the sprite's span table when it has one, and makes particles from them in batches. Flipping is a sign on the rotated offset, so there's one path for every flip.
+void CreateParticlesFromSprite_ (const sprite_t *sprite, int x, int y, f32 direction, i32 velocity, CreateParticlesFromSprite_arguments arguments) {
+	auto pool = ParticlePool (arguments.emitter);
+	if (!pool) return;
+	sprite_particles_t batch = {
+		.sprite = sprite,
+		.pool = pool,
+		.x = x,
+		.y = y,
+		.flipx = arguments.flipx ? -1 : 1,
+		.flipy = arguments.flipy ? -1 : 1,
+		.velocity = velocity,
+		.c = cos_turns (arguments.rotation),
+		.s = sin_turns (arguments.rotation),
+		.dx = cos_turns (direction),
+		.dy = sin_turns (direction),
+		.arguments = arguments,
+	};
+
+	const int w = sprite->w;
+	const auto spans = FindSpans (sprite);
+	for (int sy = 0; sy < sprite->h; ++sy) {
+		const u8 *row = &sprite->p[sy * w];
+		if (spans) {
+			for (u32 r = spans->row[sy]; r < spans->row[sy+1]; ++r) {
+				const auto run = spans->runs[r];
+				for (int sx = run.start; sx < run.start + run.length; ++sx)
+					SpriteParticlesPush (&batch, sx, sy, row[sx]);
+			}
+		}
+		else {
+			for (int sx = 0; sx < w; ++sx)
+				if (row[sx]) SpriteParticlesPush (&batch, sx, sy, row[sx]);
+		}
+	}
+	if (batch.count) SpriteParticlesFlush (&batch);
+}
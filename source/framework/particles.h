@@ -0,0 +1,87 @@
+// Copyright [2025] [Nicholas Walton]
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "framework.h"
+
+// Pixel particles, owned by the update thread. Each emitter has its own pool with an overflow policy for when it's full; emitter 0 is the default pool.
+
+// Particles in the storage used until ParticlesConfigure is given some, all of them in the default pool
+#ifndef PARTICLES_DEFAULT_CAPACITY
+#define PARTICLES_DEFAULT_CAPACITY 4096
+#endif
+#ifndef PARTICLE_EMITTERS_MAX
+#define PARTICLE_EMITTERS_MAX 32
+#endif
+
+// Storage bytes per particle, for sizing ParticlesConfigure's storage
+#define PARTICLE_STORAGE_BYTES (sizeof (vec2i32split_t) + sizeof (v2i32) + sizeof (int) + sizeof (u8) + 2 * sizeof (bool))
+
+typedef enum {
+	particles_overflow_replace_oldest, // New particles take the places of the oldest ones in the pool. The default pool's policy until ParticlesConfigure says otherwise.
+	particles_overflow_drop_new, // New particles aren't added
+} particles_overflow_e;
+
+typedef struct {
+	i16 index; // Negative if ParticleEmitterCreate failed
+} particle_emitter_t;
+#define PARTICLE_EMITTER_DEFAULT ((particle_emitter_t){0})
+
+// Removes every particle and emitter and lays the pools out in storage, which must be aligned for an i32 and stay valid until the next call. NULL goes back to the built in storage. The default pool gets default_capacity particles and the rest is left for ParticleEmitterCreate. Call from the update thread. Returns false and changes nothing if storage can't hold default_capacity particles.
+bool ParticlesConfigure (void *storage, size_t size, int default_capacity, particles_overflow_e default_overflow);
+// Reserves capacity particles of the storage ParticlesConfigure didn't give the default pool. Emitters last until the next ParticlesConfigure. Returns an emitter with a negative index if there isn't room or PARTICLE_EMITTERS_MAX already exist.
+particle_emitter_t ParticleEmitterCreate (int capacity, particles_overflow_e overflow);
+void ParticleEmitterClear (particle_emitter_t emitter);
+// Removes every particle from every pool, keeping the emitters
+void ParticlesClear ();
+
+typedef struct {
+	int count, capacity;
+	u32 dropped; // New particles not added because the pool was full
+	u32 replaced; // Particles cut short by newer ones because the pool was full
+} particle_emitter_stats_t;
+particle_emitter_stats_t ParticleEmitterStats (particle_emitter_t emitter);
+
+typedef struct {
+	bool gravity;
+	int time;
+	particle_emitter_t emitter;
+} ParticleAdd_arguments;
+#define ParticleAdd(pixel, x, y, vx, vy, ...) ParticleAdd_ (pixel, x, y, vx, vy, (ParticleAdd_arguments){.gravity = true, .time = -1, __VA_ARGS__})
+void ParticleAdd_ (u8 pixel, int x, int y, i32 vx, i32 vy, ParticleAdd_arguments arguments);
+#define ParticleAddAngleVelocity(pixel, x, y, angle, velocity, ...) ParticleAdd (pixel, x, y, cos_turns (angle) * velocity, sin_turns (angle) * velocity, __VA_ARGS__)
+void ParticlesUpdate (int left, int right, int bottom, int top);
+// Number of threads ParticlesUpdate splits the particles between, in chunks of PARTICLE_CHUNK_SIZE (default PARTICLE_THREADS, which defaults to 1). The update thread takes chunks too, and the result is identical for any count. Call from the update thread.
+void ParticlesSetThreads (int count);
+// The last ParticlesUpdate, for the update thread
+typedef struct {
+	u32 update_us;
+	u32 saved_us; // Time the worker threads took off the update, measured as the chunk time on every thread minus update_us
+	int particles, threads;
+} particles_update_stats_t;
+particles_update_stats_t ParticlesUpdateStats ();
+// Adds every particle to the render state being edited
+void ParticlesRender ();
+// Replaces the particle with the last one in its pool, so it doesn't keep the order of the rest
+void ParticleDelete (particle_emitter_t emitter, int index);
+typedef struct {
+	f32 rotation;
+	bool flipx, flipy;
+	int originx, originy;
+	u8 color;
+	particle_emitter_t emitter;
+} CreateParticlesFromSprite_arguments;
+#define CreateParticlesFromSprite(sprite, x, y, direction, velocity, ...) CreateParticlesFromSprite_ (sprite, x, y, direction, velocity, (CreateParticlesFromSprite_arguments){__VA_ARGS__})
+void CreateParticlesFromSprite_ (const sprite_t *sprite, int x, int y, f32 direction, i32 velocity, CreateParticlesFromSprite_arguments arguments);
@@ -19,12 +19,12 @@
 #include "sprite.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
 
 render_state_t *render_state_being_edited = NULL;
-extern pthread_mutex_t update_render_swap_state_mutex;
 extern render_data_t render_data;
 extern bool quit;
-typeof(render_data.render_states[0].camera) camera;
+thread_local typeof(render_data.render_states[0].camera) camera;
 
 void Render_Cursor (const cursor_t *cursor, int x, int y) {
 	render_state_being_edited->cursor = (typeof (render_state_being_edited->cursor)) {
@@ -50,15 +50,43 @@ void Render_ScreenShake (int x, int y) {
 	if (y) render_state_being_edited->camera.y += DiscreteRandom_Range(&random_state, -y, y);
 }
 
+// Appends an element whose payload is the next free entry of pool. Returns that entry's index, or -1 if there's no room for either.
+#define Render_AddElement(__pool__, __type__, __depth__, __ignore_camera__) Render_AddElement_ (&render_state_being_edited->__pool__.count, _Countof (render_state_being_edited->__pool__.array), __type__, __depth__, __ignore_camera__)
+static int Render_AddElement_ (u16 *pool_count, int pool_max, u8 type, i8 depth, bool ignore_camera) {
+	if (render_state_being_edited->element_count >= RENDER_MAX_ELEMENTS || *pool_count >= pool_max) return -1;
+	const u16 index = (*pool_count)++;
+	render_state_being_edited->elements[render_state_being_edited->element_count++] = (render_state_element_t){
+		.type = type,
+		.ignore_camera = ignore_camera,
+		.depth = depth,
+		.index = index,
+	};
+	return index;
+}
+
 void Render_Sprite_ (Render_Sprite_arguments arguments) {
 	if (arguments.sprite == NULL) return;
-	if (render_state_being_edited->element_count >= RENDER_MAX_ELEMENTS) return;
-	const auto count = render_state_being_edited->element_count++;
+	const int index = Render_AddElement (sprites, render_element_sprite, arguments.depth, arguments.ignore_camera);
+	if (index < 0) return;
+	arguments.rotation -= (int)arguments.rotation;
+	render_state_being_edited->sprites.array[index] = (render_state_sprite_t){
+		.position = {.x = arguments.x, .y = arguments.y},
+		.flags = arguments.sprite_flags,
+		.sprite = arguments.sprite,
+		.rotation = arguments.rotation,
+		.originx = arguments.sprite_flags.center_horizontally ? arguments.sprite->w/2 : (arguments.sprite_flags.flip_horizontally ? arguments.sprite->w-1 - arguments.originx : arguments.originx),
+		.originy = arguments.sprite_flags.center_vertically ? arguments.sprite->h/2 : (arguments.sprite_flags.flip_vertically ? arguments.sprite->h-1 - arguments.originy : arguments.originy),
+		.color_swap_palette = arguments.color_swap_palette,
+	};
+}
+
+void Render_SpriteSilhouette_ (u8 color, Render_Sprite_arguments arguments) {
+	if (arguments.sprite == NULL) return;
+	const int index = Render_AddElement (sprite_silhouettes, render_element_sprite_silhouette, arguments.depth, arguments.ignore_camera);
+	if (index < 0) return;
 	arguments.rotation -= (int)arguments.rotation;
-	render_state_being_edited->elements[count] = (typeof((render_state_t){}.elements[0])){
-		.type = render_element_sprite,
-		.depth = arguments.depth,
-		.ignore_camera = arguments.ignore_camera,
+	render_state_being_edited->sprite_silhouettes.array[index] = (render_state_sprite_silhouette_t){
+		.color = color,
 		.sprite = {
 			.position = {.x = arguments.x, .y = arguments.y},
 			.flags = arguments.sprite_flags,
@@ -66,37 +94,13 @@ void Render_Sprite_ (Render_Sprite_arguments arguments) {
 			.rotation = arguments.rotation,
 			.originx = arguments.sprite_flags.center_horizontally ? arguments.sprite->w/2 : (arguments.sprite_flags.flip_horizontally ? arguments.sprite->w-1 - arguments.originx : arguments.originx),
 			.originy = arguments.sprite_flags.center_vertically ? arguments.sprite->h/2 : (arguments.sprite_flags.flip_vertically ? arguments.sprite->h-1 - arguments.originy : arguments.originy),
-			.color_swap_palette = arguments.color_swap_palette,
-		}
-	};
-}
-
-void Render_SpriteSilhouette_ (u8 color, Render_Sprite_arguments arguments) {
-	if (arguments.sprite == NULL) return;
-	if (render_state_being_edited->element_count >= RENDER_MAX_ELEMENTS) return;
-	const auto count = render_state_being_edited->element_count++;
-	arguments.rotation -= (int)arguments.rotation;
-	render_state_being_edited->elements[count] = (typeof((render_state_t){}.elements[0])){
-		.type = render_element_sprite_silhouette,
-		.depth = arguments.depth,
-		.ignore_camera = arguments.ignore_camera,
-		.sprite_silhouette = {
-			.color = color,
-			.sprite = {
-				.position = {.x = arguments.x, .y = arguments.y},
-				.flags = arguments.sprite_flags,
-				.sprite = arguments.sprite,
-				.rotation = arguments.rotation,
-				.originx = arguments.sprite_flags.center_horizontally ? arguments.sprite->w/2 : (arguments.sprite_flags.flip_horizontally ? arguments.sprite->w-1 - arguments.originx : arguments.originx),
-				.originy = arguments.sprite_flags.center_vertically ? arguments.sprite->h/2 : (arguments.sprite_flags.flip_vertically ? arguments.sprite->h-1 - arguments.originy : arguments.originy),
-			}
 		}
 	};
 }
 
 void Render_Shape_ (Render_Shape_arguments arguments) {
-	if (render_state_being_edited->element_count >= RENDER_MAX_ELEMENTS) return;
-	const auto count = render_state_being_edited->element_count++;
+	const int index = Render_AddElement (shapes, render_element_shape, arguments.depth, arguments.ignore_camera);
+	if (index < 0) return;
 	if (arguments.shape.type == render_shape_ellipse && arguments.shape.ellipse.rx == arguments.shape.ellipse.ry) {
 		const render_shape_t circ = {
 			.type = render_shape_circle,
@@ -110,12 +114,7 @@ void Render_Shape_ (Render_Shape_arguments arguments) {
 		};
 		arguments.shape = circ;
 	}
-	render_state_being_edited->elements[count] = (typeof((render_state_t){}.elements[0])){
-		.type = render_element_shape,
-		.depth = arguments.depth,
-		.ignore_camera = arguments.ignore_camera,
-		.shape = arguments.shape
-	};
+	render_state_being_edited->shapes.array[index] = arguments.shape;
 }
 
 static u16 Render_AllocInState (u16 bytes) {
@@ -127,7 +126,7 @@ static u16 Render_AllocInState (u16 bytes) {
 }
 
 void Render_Text_ (Render_Text_arguments arguments) {
-	if (render_state_being_edited->element_count >= RENDER_MAX_ELEMENTS) return;
+	if (render_state_being_edited->element_count >= RENDER_MAX_ELEMENTS || render_state_being_edited->texts.count >= RENDER_MAX_TEXTS) return;
 	if (arguments.string == NULL) return;
 	if (arguments.length == 0) arguments.length = strlen (arguments.string);
 	if (arguments.length == 0) return; // Empty string
@@ -148,24 +147,17 @@ void Render_Text_ (Render_Text_arguments arguments) {
 		arguments.ignore_camera = true;
 	}
 
-	if (render_state_being_edited->element_count >= RENDER_MAX_ELEMENTS) return;
-
 	size_t alloc_payload = arguments.payload.count * sizeof(*arguments.payload._);
 	size_t alloc_size = arguments.length + alloc_payload;
 	auto mem = Render_AllocInState(alloc_size);
 	if (mem == RENDER_STATE_MEM_AMOUNT) // Out of memory, cannot render this string
 	return;
 	
-	const auto count = render_state_being_edited->element_count++;
+	const int index = Render_AddElement (texts, render_element_text, arguments.depth, arguments.ignore_camera); // Room was checked above
 
 	auto str = &render_state_being_edited->mem.bytes[mem+alloc_payload];
 
-	render_state_being_edited->elements[count] = (typeof((render_state_t){}.elements[0])){
-		.type = render_element_text,
-		.depth = arguments.depth,
-		.ignore_camera = arguments.ignore_camera,
-		.text = {.x = arguments.x, .y = arguments.y, .length = arguments.length, .string = str},
-	};
+	render_state_being_edited->texts.array[index] = (render_state_text_t){.x = arguments.x, .y = arguments.y, .length = arguments.length, .string = str};
 	strcpy (str, arguments.string); // Already checked length above
 	str[arguments.length-1] = 0;
 	for (int i = 0; i < arguments.payload.count; ++i) {
@@ -186,8 +178,30 @@ void Render_Background_ (Render_Background_arguments background) {
 	render_state_being_edited->background = background;
 }
 
+static render_state_particle_t render_particles_default[3][RENDER_PARTICLES_DEFAULT];
+static struct {
+	render_state_particle_t *storage;
+	i32 per_state;
+} render_particles = {render_particles_default[0], RENDER_PARTICLES_DEFAULT};
+
+bool Render_SetParticleStorage (void *storage, size_t size) {
+	if (storage == NULL) {
+		render_particles.storage = render_particles_default[0];
+		render_particles.per_state = RENDER_PARTICLES_DEFAULT;
+		return true;
+	}
+	const size_t per_state = size / RENDER_PARTICLES_STORAGE_BYTES (1);
+	if (per_state < 1 || per_state > INT32_MAX) {
+		LOG ("Render particle storage of %zu bytes is out of range", size);
+		return false;
+	}
+	render_particles.storage = storage;
+	render_particles.per_state = per_state;
+	return true;
+}
+
 void Render_Particle (int x, int y, u8 pixel, bool ignore_camera) {
-	if (render_state_being_edited->particles.count >= PARTICLES_MAX) return;
+	if (render_state_being_edited->particles.count >= render_state_being_edited->particles.capacity) return;
 	if (!ignore_camera) {
 		x -= render_state_being_edited->camera.x;
 		y -= render_state_being_edited->camera.y;
@@ -201,26 +215,22 @@ void Render_Particle (int x, int y, u8 pixel, bool ignore_camera) {
 
 void Render_DarkenRectangle_ (Render_DarkenRectangle_arguments_t args) {
 	if (args.r < args.l || args.t < args.b || args.l > RESOLUTION_WIDTH-1 || args.b > RESOLUTION_HEIGHT-1 || args.r < 0 || args.t < 0 || args.levels == 0) return;
-	if (render_state_being_edited->element_count >= RENDER_MAX_ELEMENTS) return;
-	const auto count = render_state_being_edited->element_count++;
+	const int index = Render_AddElement (darkness_rectangles, render_element_darkness_rectangle, args.depth, false);
+	if (index < 0) return;
 
 	if (args.levels > 7) args.levels = 7;
 
-	render_state_being_edited->elements[count] = (typeof((render_state_t){}.elements[0])){
-		.type = render_element_darkness_rectangle,
-		.depth = args.depth,
-		.darkness_rectangle = {
-			.l = args.l,
-			.b = args.b,
-			.r = args.r,
-			.t = args.t,
-			.levels = args.levels
-		},
+	render_state_being_edited->darkness_rectangles.array[index] = (render_state_darkness_rectangle_t){
+		.l = args.l,
+		.b = args.b,
+		.r = args.r,
+		.t = args.t,
+		.levels = args.levels
 	};
 }
 
 void Render_TexturedPoly_ (Render_TexturedPoly_arguments_t args) {
-	if (render_state_being_edited->element_count >= RENDER_MAX_ELEMENTS) return;
+	if (render_state_being_edited->element_count >= RENDER_MAX_ELEMENTS || render_state_being_edited->textured_polys.count >= RENDER_MAX_TEXTURED_POLYS) return;
 	if (args.vertex_count < 3) return;
 	if (args.vertices == NULL) return;
 	
@@ -228,19 +238,15 @@ void Render_TexturedPoly_ (Render_TexturedPoly_arguments_t args) {
 	if (mem == RENDER_STATE_MEM_AMOUNT) // Out of memory, cannot render this poly
 	return;
 	
-	const auto count = render_state_being_edited->element_count++;
-	const auto verts = (typeof(render_state_being_edited->elements[0].textured_poly.vertices))&render_state_being_edited->mem.bytes[mem];
-
-	render_state_being_edited->elements[count] = (typeof(*render_state_being_edited->elements)) {
-		.type = render_element_textured_poly,
-		.textured_poly = {
-			.x = args.x,
-			.y = args.y,
-			.texture = args.texture,
-			.vertex_count = args.vertex_count,
-			.vertices = verts,
-		},
-		.depth = args.depth,
+	const int index = Render_AddElement (textured_polys, render_element_textured_poly, args.depth, false); // Room was checked above
+	const auto verts = (textured_poly_vertex_t *)&render_state_being_edited->mem.bytes[mem];
+
+	render_state_being_edited->textured_polys.array[index] = (render_state_textured_poly_t){
+		.x = args.x,
+		.y = args.y,
+		.texture = args.texture,
+		.vertex_count = args.vertex_count,
+		.vertices = verts,
 	};
 
 	memcpy (verts, args.vertices, args.vertex_count * sizeof (*args.vertices));
@@ -250,41 +256,53 @@ render_state_t *Render_GetCurrentEditableState () {
 	return render_state_being_edited;
 }
 
+// render_data.render_states is a triple buffer. The update thread owns the state it's filling (back) and the render thread owns the one it's drawing (front). The third waits in the middle. Publishing a finished state swaps it into the middle and takes whatever was there. The render thread swaps its front for the middle only when the middle holds something it hasn't seen, marked by RENDER_STATE_FRESH. Each is a single atomic exchange, so neither thread ever waits for the other, and a state is never written while it's being drawn.
+#define RENDER_STATE_FRESH 4
+static _Atomic u8 render_state_middle = 1;
+static u8 render_state_back = 0, render_state_front = 2;
+
 void Render_SelectStateToEdit () {
-	// Select oldest non-busy render state to replace
 	static u64 state_count = 0;
-	int found = -1;
-	u64 lowest_state_count = -1;
-
-	pthread_mutex_lock (&update_render_swap_state_mutex);
-	for(int i = 0; i < 3; ++i) {
-		if(!render_data.render_states[i].busy && render_data.render_states[i].state_count <= lowest_state_count) {
-			found = i;
-			lowest_state_count = render_data.render_states[i].state_count;
-		}
-	}
-	assert (found != -1);
-	render_state_being_edited = &render_data.render_states[found];
-	render_state_being_edited->busy = true;
-
-	pthread_mutex_unlock (&update_render_swap_state_mutex);
-
-	*render_state_being_edited = (typeof(*render_state_being_edited)){
-		.state_count = ++state_count,
-		.busy = true,
-	};
+	render_state_being_edited = &render_data.render_states[render_state_back];
+	// Only reset the counts and the small settings: nothing past a count is ever read, so there's no need to clear the whole state each frame
+	auto state = render_state_being_edited;
+	state->state_count = ++state_count;
+	state->element_count = 0;
+	state->sprites.count = state->sprite_silhouettes.count = state->shapes.count = state->texts.count = state->darkness_rectangles.count = state->textured_polys.count = 0;
+	state->mem.position = 0;
+	state->particles.count = 0;
+	state->particles.capacity = render_particles.per_state;
+	state->particles.array = &render_particles.storage[render_state_back * render_particles.per_state];
+	state->camera = (typeof(state->camera)){};
+	state->background = (typeof(state->background)){};
+	state->cursor = (typeof(state->cursor)){};
+	state->debug = (typeof(state->debug)){};
 }
 
 void Render_FinishEditingState () {
-	render_state_being_edited->busy = false;
+	// Release so the render thread sees the whole state once it takes it. Acquire so the render thread is done drawing whichever state comes back.
+	render_state_back = atomic_exchange_explicit (&render_state_middle, render_state_back | RENDER_STATE_FRESH, memory_order_acq_rel) & 3;
 	render_state_being_edited = NULL;
 }
 
+// Render thread only. Takes the newest finished state if there is one, otherwise returns the one drawn last time.
+static render_state_t *Render_AcquireNewestState () {
+	if (atomic_load_explicit (&render_state_middle, memory_order_relaxed) & RENDER_STATE_FRESH)
+		render_state_front = atomic_exchange_explicit (&render_state_middle, render_state_front, memory_order_acq_rel) & 3;
+	return &render_data.render_states[render_state_front];
+}
+
 void Render_ShowRenderTime (bool show) { render_state_being_edited->debug.show_rendertime = show; }
 void Render_ShowFPS (bool show) { render_state_being_edited->debug.show_framerate = show; }
 
-static sprite_t *frame;
+static thread_local sprite_t *frame;
 static bool frame_select = 0;
+static sprite_t *frame_presented = NULL; // The last frame passed to os_DrawScreen
+// When a frame is split into bands drawn by several threads, frame is a view of rows [band.y, band.y + frame->h) of a frame_h tall frame, and everything is drawn band.y rows lower
+static thread_local struct {
+	int y, frame_h;
+	bool split;
+} band;
 
 static inline void DrawBackground (render_state_t *render_state) {
 	switch (render_state->background.type) {
@@ -423,102 +441,225 @@ static inline void DrawBackground (render_state_t *render_state) {
 	}
 }
 
-static inline void DrawSprite (render_state_element_t element) {
-	auto s = element.sprite;
-	if (!element.ignore_camera) {
-		s.position.x -= camera.x;
-		s.position.y -= camera.y;
+// ************************************
+// Rotated sprite cache
+// ************************************
+
+// Set associative: a key hashes to one set of RENDER_ROTATION_CACHE_WAYS slots, and the least recently used slot in the set is replaced. Slots are a fixed RENDER_ROTATION_CACHE_SLOT_SIZE pixels; rotated sprites which don't fit are always sampled directly.
+#ifndef RENDER_ROTATION_CACHE_SETS
+#define RENDER_ROTATION_CACHE_SETS 32
+#endif
+#ifndef RENDER_ROTATION_CACHE_WAYS
+#define RENDER_ROTATION_CACHE_WAYS 4
+#endif
+#ifndef RENDER_ROTATION_CACHE_SLOT_SIZE
+#define RENDER_ROTATION_CACHE_SLOT_SIZE (64*64)
+#endif
+#ifndef RENDER_ROTATION_CACHE_ANGLES
+#define RENDER_ROTATION_CACHE_ANGLES 256
+#endif
+
+render_rotation_cache_t render_rotation_cache = {};
+
+typedef struct {
+	const sprite_t *sprite;
+	const u8 (*color_swap_palette)[256];
+	f32 originx, originy;
+	u16 angle; // In 1/RENDER_ROTATION_CACHE_ANGLES turns
+	bool flipx, flipy;
+} rotation_cache_key_t;
+
+typedef struct {
+	rotation_cache_key_t key;
+	sprite_t raster;
+	int x, y; // Where the sprite's position falls in raster
+	u64 last_used; // Frame number. 0 means empty.
+} rotation_cache_entry_t;
+
+static struct {
+	u64 frame;
+	rotation_cache_entry_t entries[RENDER_ROTATION_CACHE_SETS][RENDER_ROTATION_CACHE_WAYS];
+	u8 pixels[RENDER_ROTATION_CACHE_SETS][RENDER_ROTATION_CACHE_WAYS][RENDER_ROTATION_CACHE_SLOT_SIZE];
+} rotation_cache;
+
+// Cached raster for each element index this frame, or NULL to sample directly. Filled on the calling thread by Render_DrawState before any band is drawn; entries used this frame are never replaced, so bands only read them.
+static const rotation_cache_entry_t *render_rotated[RENDER_MAX_ELEMENTS];
+
+static const rotation_cache_entry_t *RotationCacheGet (const render_state_sprite_t *s) {
+	const int angles = RENDER_ROTATION_CACHE_ANGLES;
+	// Zeroed first so the padding hashes and compares the same every time
+	rotation_cache_key_t key;
+	memset (&key, 0, sizeof (key));
+	key.sprite = s->sprite;
+	key.color_swap_palette = s->color_swap_palette;
+	key.originx = s->originx;
+	key.originy = s->originy;
+	key.angle = ((int)lroundf (s->rotation * angles) % angles + angles) % angles;
+	key.flipx = s->flags.flip_horizontally;
+	key.flipy = s->flags.flip_vertically;
+	u64 hash = 14695981039346656037ull;
+	for (size_t i = 0; i < sizeof (key); ++i) hash = (hash ^ ((const u8 *)&key)[i]) * 1099511628211ull;
+	auto set = rotation_cache.entries[hash % RENDER_ROTATION_CACHE_SETS];
+
+	rotation_cache_entry_t *replace = NULL;
+	for (int i = 0; i < RENDER_ROTATION_CACHE_WAYS; ++i) {
+		auto entry = &set[i];
+		if (entry->last_used && memcmp (&entry->key, &key, sizeof (key)) == 0) {
+			entry->last_used = rotation_cache.frame;
+			++render_rotation_cache.hits;
+			return entry;
+		}
+		if (entry->last_used != rotation_cache.frame && (replace == NULL || entry->last_used < replace->last_used)) replace = entry;
+	}
+
+	// Bounding box of the rotated sprite around its position, as sprite_SampleRotated works it out, plus a pixel either side
+	const f32 angle = (f32)key.angle / angles;
+	const f32 sin_angle = sin_turns (angle), cos_angle = cos_turns (angle);
+	const f32 l = -key.originx, r = key.sprite->w - key.originx, b = -key.originy, t = key.sprite->h - key.originy;
+	const f32 xs[] = {l*cos_angle - b*sin_angle, l*cos_angle - t*sin_angle, r*cos_angle - b*sin_angle, r*cos_angle - t*sin_angle};
+	const f32 ys[] = {l*sin_angle + b*cos_angle, l*sin_angle + t*cos_angle, r*sin_angle + b*cos_angle, r*sin_angle + t*cos_angle};
+	const int left = (int)floorf (MIN (MIN (xs[0], xs[1]), MIN (xs[2], xs[3]))) - 1, right = (int)floorf (MAX (MAX (xs[0], xs[1]), MAX (xs[2], xs[3]))) + 2;
+	const int bottom = (int)floorf (MIN (MIN (ys[0], ys[1]), MIN (ys[2], ys[3]))) - 1, top = (int)floorf (MAX (MAX (ys[0], ys[1]), MAX (ys[2], ys[3]))) + 2;
+	const int w = right - left + 1, h = top - bottom + 1;
+	if (replace == NULL || w * h > RENDER_ROTATION_CACHE_SLOT_SIZE) {
+		++render_rotation_cache.skipped;
+		return NULL;
+	}
+
+	++render_rotation_cache.misses;
+	*replace = (rotation_cache_entry_t){
+		.key = key,
+		.raster = {.w = w, .h = h, .p = rotation_cache.pixels[0][0] + (replace - rotation_cache.entries[0]) * RENDER_ROTATION_CACHE_SLOT_SIZE},
+		.x = -left,
+		.y = -bottom,
+		.last_used = rotation_cache.frame,
+	};
+	sprite_SetPixelsToZero (&replace->raster);
+	if (key.color_swap_palette) sprite_SampleColorSwapRotatedFlipped (key.sprite, &replace->raster, replace->x, replace->y, angle, key.originx, key.originy, key.flipx, key.flipy, *key.color_swap_palette);
+	else sprite_SampleRotatedFlipped (key.sprite, &replace->raster, replace->x, replace->y, angle, key.originx, key.originy, key.flipx, key.flipy);
+	return replace;
+}
+
+// Looks up or rasterizes every rotated sprite in the state, or clears render_rotated if the cache is off
+static void RotationCachePrepare (const render_state_t *render_state) {
+	const bool enabled = render_rotation_cache.enabled;
+	++rotation_cache.frame;
+	for (int i = 0; i < render_state->element_count; ++i) {
+		const auto element = &render_state->elements[i];
+		render_rotated[i] = NULL;
+		// Only index the sprites once it's known to be one, since the index is into another pool otherwise
+		if (!enabled || element->type != render_element_sprite) continue;
+		const auto sprite = &render_state->sprites.array[element->index];
+		if (sprite->rotation != 0) render_rotated[i] = RotationCacheGet (sprite);
+	}
+}
+
+static inline void DrawSprite (const render_state_sprite_t *s, bool ignore_camera, const rotation_cache_entry_t *rotated) {
+	int x = s->position.x, y = s->position.y;
+	if (!ignore_camera) {
+		x -= camera.x;
+		y -= camera.y;
+	}
+	y -= band.y;
+	if (rotated) {
+		sprite_Blit (&rotated->raster, frame, x - rotated->x, y - rotated->y);
+		return;
 	}
-	enum {flip_none = 0b00, flip_hori = 0b01, flip_vert = 0b10, flip_both = 0b11} flip = (s.flags.flip_vertically << 1) | s.flags.flip_horizontally;
-	if ( flip != flip_none && s.flags.rotation_by_quarters != 0 ) {
+	enum {flip_none = 0b00, flip_hori = 0b01, flip_vert = 0b10, flip_both = 0b11} flip = (s->flags.flip_vertically << 1) | s->flags.flip_horizontally;
+	int rotation_by_quarters = s->flags.rotation_by_quarters;
+	if ( flip != flip_none && rotation_by_quarters != 0 ) {
 		LOG ("Sprites cannot be both flipped and rotated!");
 		assert (false);
-		s.flags.rotation_by_quarters = 0;
-		// s.rotation = 0;
+		rotation_by_quarters = 0;
+		// s->rotation = 0;
 	}
 	
-	if (s.color_swap_palette) {
-		if (s.rotation != 0) {
-			sprite_SampleColorSwapRotatedFlipped (s.sprite, frame, s.position.x, s.position.y, s.rotation, s.originx, s.originy, s.flags.flip_horizontally, s.flags.flip_vertically, *s.color_swap_palette);
+	if (s->color_swap_palette) {
+		if (s->rotation != 0) {
+			sprite_SampleColorSwapRotatedFlipped (s->sprite, frame, x, y, s->rotation, s->originx, s->originy, s->flags.flip_horizontally, s->flags.flip_vertically, *s->color_swap_palette);
 		}
 		else {
 			switch (flip) {
 				case flip_none: {
-					switch (s.flags.rotation_by_quarters) {
-						case 0: sprite_BlitColorSwap (s.sprite, frame, s.position.x - s.originx, s.position.y - s.originy, *s.color_swap_palette); break;
-						case 1: sprite_BlitColorSwapRotated90 (s.sprite, frame, s.position.x,s.position.y, s.originx, s.originy, *s.color_swap_palette); break;
-						case 2: sprite_BlitColorSwapRotated180 (s.sprite, frame, s.position.x, s.position.y, s.originx, s.originy, *s.color_swap_palette); break;
-						case 3: sprite_BlitColorSwapRotated270 (s.sprite, frame, s.position.x, s.position.y, s.originx, s.originy, *s.color_swap_palette); break;
+					switch (rotation_by_quarters) {
+						case 0: sprite_BlitColorSwap (s->sprite, frame, x - s->originx, y - s->originy, *s->color_swap_palette); break;
+						case 1: sprite_BlitColorSwapRotated90 (s->sprite, frame, x,y, s->originx, s->originy, *s->color_swap_palette); break;
+						case 2: sprite_BlitColorSwapRotated180 (s->sprite, frame, x, y, s->originx, s->originy, *s->color_swap_palette); break;
+						case 3: sprite_BlitColorSwapRotated270 (s->sprite, frame, x, y, s->originx, s->originy, *s->color_swap_palette); break;
 					}
 				} break;
-				case flip_both: sprite_BlitColorSwapRotated180 (s.sprite, frame, s.position.x, s.position.y, s.originx, s.originy, *s.color_swap_palette); break;
-				case flip_hori: sprite_BlitColorSwapFlippedHorizontally (s.sprite, frame, s.position.x - s.originx, s.position.y - s.originy, *s.color_swap_palette); break;
-				case flip_vert: sprite_BlitColorSwapFlippedVertically (s.sprite, frame, s.position.x - s.originx, s.position.y - s.originy, *s.color_swap_palette); break;
+				case flip_both: sprite_BlitColorSwapRotated180 (s->sprite, frame, x, y, s->originx, s->originy, *s->color_swap_palette); break;
+				case flip_hori: sprite_BlitColorSwapFlippedHorizontally (s->sprite, frame, x - s->originx, y - s->originy, *s->color_swap_palette); break;
+				case flip_vert: sprite_BlitColorSwapFlippedVertically (s->sprite, frame, x - s->originx, y - s->originy, *s->color_swap_palette); break;
 			}
 		}
 	}
 	else {
-		if (s.rotation != 0) {
-			sprite_SampleRotatedFlipped(s.sprite, frame, s.position.x, s.position.y, s.rotation, s.originx, s.originy, s.flags.flip_horizontally, s.flags.flip_vertically);
+		if (s->rotation != 0) {
+			sprite_SampleRotatedFlipped(s->sprite, frame, x, y, s->rotation, s->originx, s->originy, s->flags.flip_horizontally, s->flags.flip_vertically);
 		}
 		else {
 			switch (flip) {
 				case flip_none: {
-					switch (s.flags.rotation_by_quarters) {
-						case 0: sprite_Blit (s.sprite, frame, s.position.x - s.originx, s.position.y - s.originy); break;
-						case 1: sprite_BlitRotated90 (s.sprite, frame, s.position.x,s.position.y, s.originx, s.originy); break;
-						case 2: sprite_BlitRotated180 (s.sprite, frame, s.position.x, s.position.y, s.originx, s.originy); break;
-						case 3: sprite_BlitRotated270 (s.sprite, frame, s.position.x, s.position.y, s.originx, s.originy); break;
+					switch (rotation_by_quarters) {
+						case 0: sprite_Blit (s->sprite, frame, x - s->originx, y - s->originy); break;
+						case 1: sprite_BlitRotated90 (s->sprite, frame, x,y, s->originx, s->originy); break;
+						case 2: sprite_BlitRotated180 (s->sprite, frame, x, y, s->originx, s->originy); break;
+						case 3: sprite_BlitRotated270 (s->sprite, frame, x, y, s->originx, s->originy); break;
 					}
 				} break;
-				case flip_both: sprite_BlitRotated180 (s.sprite, frame, s.position.x, s.position.y, s.originx, s.originy); break;
-				case flip_hori: sprite_BlitFlippedHorizontally (s.sprite, frame, s.position.x - s.originx, s.position.y - s.originy); break;
-				case flip_vert: sprite_BlitFlippedVertically (s.sprite, frame, s.position.x - s.originx, s.position.y - s.originy); break;
+				case flip_both: sprite_BlitRotated180 (s->sprite, frame, x, y, s->originx, s->originy); break;
+				case flip_hori: sprite_BlitFlippedHorizontally (s->sprite, frame, x - s->originx, y - s->originy); break;
+				case flip_vert: sprite_BlitFlippedVertically (s->sprite, frame, x - s->originx, y - s->originy); break;
 			}
 		}
 	}
 }
 
-static inline void DrawSpriteSilhouette (render_state_element_t element) {
-	auto color = element.sprite_silhouette.color;
-	auto s = element.sprite_silhouette.sprite;
-	if (!element.ignore_camera) {
-		s.position.x -= camera.x;
-		s.position.y -= camera.y;
+static inline void DrawSpriteSilhouette (const render_state_sprite_silhouette_t *silhouette, bool ignore_camera) {
+	const auto color = silhouette->color;
+	const auto s = &silhouette->sprite;
+	int x = s->position.x, y = s->position.y;
+	if (!ignore_camera) {
+		x -= camera.x;
+		y -= camera.y;
 	}
-	enum {flip_none = 0b00, flip_hori = 0b01, flip_vert = 0b10, flip_both = 0b11} flip = (s.flags.flip_vertically << 1) | s.flags.flip_horizontally;
-	if ( flip != flip_none && s.flags.rotation_by_quarters != 0 ) {
+	y -= band.y;
+	enum {flip_none = 0b00, flip_hori = 0b01, flip_vert = 0b10, flip_both = 0b11} flip = (s->flags.flip_vertically << 1) | s->flags.flip_horizontally;
+	int rotation_by_quarters = s->flags.rotation_by_quarters;
+	if ( flip != flip_none && rotation_by_quarters != 0 ) {
 		LOG ("Sprites cannot be both flipped and rotated!");
 		assert (false);
-		s.flags.rotation_by_quarters = 0;
-		// s.rotation = 0;
+		rotation_by_quarters = 0;
+		// s->rotation = 0;
 	}
-	if (s.rotation != 0) {
-		sprite_SampleRotatedFlippedColor(s.sprite, frame, s.position.x, s.position.y, s.rotation, s.originx, s.originy, s.flags.flip_horizontally, s.flags.flip_vertically, color);
+	if (s->rotation != 0) {
+		sprite_SampleRotatedFlippedColor(s->sprite, frame, x, y, s->rotation, s->originx, s->originy, s->flags.flip_horizontally, s->flags.flip_vertically, color);
 	}
 	else {
 		switch (flip) {
 			case flip_none: {
-				switch (s.flags.rotation_by_quarters) {
-					case 0: sprite_BlitColor (s.sprite, frame, s.position.x - s.originx, s.position.y - s.originy, color); break;
-					case 1: sprite_BlitRotated90Color (s.sprite, frame, s.position.x,s.position.y, color, s.originx, s.originy); break;
-					case 2: sprite_BlitRotated180Color (s.sprite, frame, s.position.x, s.position.y, color, s.originx, s.originy); break;
-					case 3: sprite_BlitRotated270Color (s.sprite, frame, s.position.x, s.position.y, color, s.originx, s.originy); break;
+				switch (rotation_by_quarters) {
+					case 0: sprite_BlitColor (s->sprite, frame, x - s->originx, y - s->originy, color); break;
+					case 1: sprite_BlitRotated90Color (s->sprite, frame, x,y, color, s->originx, s->originy); break;
+					case 2: sprite_BlitRotated180Color (s->sprite, frame, x, y, color, s->originx, s->originy); break;
+					case 3: sprite_BlitRotated270Color (s->sprite, frame, x, y, color, s->originx, s->originy); break;
 				}
 			} break;
-			case flip_both: sprite_BlitRotated180Color (s.sprite, frame, s.position.x, s.position.y, color, s.originx, s.originy); break;
-			case flip_hori: sprite_BlitFlippedHorizontallyColor (s.sprite, frame, s.position.x - s.originx, s.position.y - s.originy, color); break;
-			case flip_vert: sprite_BlitFlippedVerticallyColor (s.sprite, frame, s.position.x - s.originx, s.position.y - s.originy, color); break;
+			case flip_both: sprite_BlitRotated180Color (s->sprite, frame, x, y, color, s->originx, s->originy); break;
+			case flip_hori: sprite_BlitFlippedHorizontallyColor (s->sprite, frame, x - s->originx, y - s->originy, color); break;
+			case flip_vert: sprite_BlitFlippedVerticallyColor (s->sprite, frame, x - s->originx, y - s->originy, color); break;
 		}
 	}
 }
 
-static inline void DrawRectangle (render_state_element_t element) {
-	auto r = element.shape.rectangle;
-	if (!element.ignore_camera) {
+static inline void DrawRectangle (const render_shape_t *shape, bool ignore_camera) {
+	auto r = shape->rectangle;
+	if (!ignore_camera) {
 		r.x -= camera.x;
 		r.y -= camera.y;
 	}
+	r.y -= band.y;
 	int rb = r.y;
 	int rt = rb + r.h-1;
 	int rl = r.x;
@@ -698,17 +839,23 @@ static inline void DrawEllipseFilled (sprite_t *destination, int center_x, int c
 	#pragma pop_macro ("LINE")
 }
 
-static inline void DrawLine (render_state_element_t element) {
-	auto l = element.shape.line;
-	if (!element.ignore_camera) {
+static inline void DrawLine (const render_shape_t *shape, bool ignore_camera) {
+	auto l = shape->line;
+	if (!ignore_camera) {
 		l.x0 -= camera.x;
 		l.x1 -= camera.x;
 		l.y0 -= camera.y;
 		l.y1 -= camera.y;
 	}
+	l.y0 -= band.y;
+	l.y1 -= band.y;
 
 	if (l.color == 0) return;
 
+	// Clip to the whole frame even when drawing a band, so each band steps the same pixels
+	const int frame_bottom = -band.y;
+	const int frame_top = band.frame_h-1 - band.y;
+
 	if (l.x1 < l.x0) {
 		SWAP(l.x0, l.x1);
 		SWAP(l.y0, l.y1);
@@ -718,13 +865,13 @@ static inline void DrawLine (render_state_element_t element) {
 	int top = l.y1;
 	if (bottom > top) SWAP (bottom, top);
 
-	if (l.x0 > frame->w-1 || l.x1 < 0 || bottom > frame->h-1 || top < 0) return; // line is completely outside the screen
+	if (l.x0 > frame->w-1 || l.x1 < 0 || bottom > frame_top || top < frame_bottom) return; // line is completely outside the screen
 
 	if (l.x0 < 0) {
 		f32 width = l.x1 - l.x0;
 		int height = l.y1 - l.y0;
 		f32 distance = -l.x0 / width;
-		l.y0 += height * distance;
+		l.y0 += (int)floorf (height * distance);
 		l.x0 = 0;
 	}
 
@@ -732,26 +879,26 @@ static inline void DrawLine (render_state_element_t element) {
 		f32 width = l.x1 - l.x0;
 		int height = l.y1 - l.y0;
 		f32 distance = (frame->w-1 - l.x1) / width;
-		l.y1 -= height * distance;
+		l.y1 -= (int)ceilf (height * distance);
 		l.x1 = frame->w-1;
 	}
 
 	if (l.y0 > l.y1) { SWAP (l.x0, l.x1); SWAP (l.y0, l.y1); }
 
-	if (l.y0 < 0) {
+	if (l.y0 < frame_bottom) {
 		f32 width = l.x1 - l.x0;
 		f32 height = l.y1 - l.y0;
-		f32 distance = (f32)-l.y0 / height;
+		f32 distance = (f32)(frame_bottom - l.y0) / height;
 		l.x0 += width * distance;
-		l.y0 = 0;
+		l.y0 = frame_bottom;
 	}
 
-	if (l.y1 > frame->h-1) {
+	if (l.y1 > frame_top) {
 		f32 width = l.x1 - l.x0;
 		f32 height = l.y1 - l.y0;
-		f32 distance = (f32)(frame->h-1 - l.y1) / height;
+		f32 distance = (f32)(frame_top - l.y1) / height;
 		l.x1 += width * distance;
-		l.y1 = frame->h-1;
+		l.y1 = frame_top;
 	}
 
 	int dx = l.x1 - l.x0;
@@ -769,7 +916,7 @@ static inline void DrawLine (render_state_element_t element) {
 	if (ax > ay) {
 		d = ay - (ax / 2);
 		for (;;) {
-			frame->p[x + y * frame->w] = l.color;
+			if (y >= 0 && y < frame->h) frame->p[x + y * frame->w] = l.color;
 			if (x == l.x1) break;
 			if (d >= 0) {
 				y += sy;
@@ -782,7 +929,7 @@ static inline void DrawLine (render_state_element_t element) {
 	else {
 		d = ax - ay / 2;
 		for (;;) {
-			frame->p[x + y * frame->w] = l.color;
+			if (y >= 0 && y < frame->h) frame->p[x + y * frame->w] = l.color;
 			if (y == l.y1) break;
 			if (d >= 0) {
 				x += sx;
@@ -794,10 +941,13 @@ static inline void DrawLine (render_state_element_t element) {
 	}
 }
 
-static inline void DrawTriangle (render_state_element_t element) {
+static inline void DrawTriangle (const render_shape_t *shape, bool ignore_camera) {
 	// Incomplete. Only does edges, and does them kinda ugly
-	auto t = element.shape.triangle;
-	struct {int x, y;} ps[3] = {{t.x0,t.y0}, {t.x1,t.y1}, {t.x2,t.y2}};
+	#pragma push_macro ("PXY")
+	#undef PXY
+	#define PXY(a, b) do { auto xx = (a); auto yy = (b); if (xx >= 0 && xx < frame->w && yy >= 0 && yy < frame->h) frame->p[xx + yy*frame->w] = t.color_edge; } while (0)
+	const auto t = shape->triangle;
+	struct {int x, y;} ps[3] = {{t.x0,t.y0 - band.y}, {t.x1,t.y1 - band.y}, {t.x2,t.y2 - band.y}};
 	// Sort points by height
 	if (ps[2].y > ps[1].y) SWAP (ps[1], ps[2]);
 	if (ps[1].y > ps[0].y) SWAP (ps[0], ps[1]);
@@ -808,12 +958,17 @@ static inline void DrawTriangle (render_state_element_t element) {
 
 	if (ps[0].y == ps[1].y) { // Flat top triangle
 		if (ps[0].y == ps[2].y) { // Single horizontal line
-			element.shape.type = render_shape_line;
-			element.shape.line.x0 = MIN (ps[0].x, MIN (ps[1].x, ps[2].x));
-			element.shape.line.x1 = MAX (ps[0].x, MAX (ps[1].x, ps[2].x));
-			element.shape.line.y0 = element.shape.line.y1 = ps[0].y;
-			element.shape.line.color = t.color_edge;
-			DrawLine (element);
+			const render_shape_t line = {
+				.type = render_shape_line,
+				.line = {
+					.x0 = MIN (ps[0].x, MIN (ps[1].x, ps[2].x)),
+					.x1 = MAX (ps[0].x, MAX (ps[1].x, ps[2].x)),
+					.y0 = ps[0].y + band.y,
+					.y1 = ps[0].y + band.y,
+					.color = t.color_edge,
+				},
+			};
+			DrawLine (&line, ignore_camera);
 			return;
 		}
 		else {
@@ -889,7 +1044,7 @@ static inline void DrawTriangle (render_state_element_t element) {
 		if (l.ax > ay) {
 			l.d = ay - (l.ax / 2);
 			for (;;) {
-				frame->p[l.x + ly * frame->w] = t.color_edge;
+				PXY (l.x, ly);
 				if (l.x == tri1[1].x) break;
 				if (l.d >= 0) {
 					--ly;
@@ -902,7 +1057,7 @@ static inline void DrawTriangle (render_state_element_t element) {
 		else {
 			l.d = l.ax - ay / 2;
 			for (;;) {
-				frame->p[l.x + ly * frame->w] = t.color_edge;
+				PXY (l.x, ly);
 				if (ly == tri1[1].y) break;
 				if (l.d >= 0) {
 					l.x += l.sx;
@@ -917,7 +1072,7 @@ static inline void DrawTriangle (render_state_element_t element) {
 		if (r.ax > ay) {
 			r.d = ay - (r.ax / 2);
 			for (;;) {
-				frame->p[r.x + ry * frame->w] = t.color_edge;
+				PXY (r.x, ry);
 				if (r.x == tri1[2].x) break;
 				if (r.d >= 0) {
 					--ry;
@@ -930,7 +1085,7 @@ static inline void DrawTriangle (render_state_element_t element) {
 		else {
 			r.d = r.ax - ay / 2;
 			for (;;) {
-				frame->p[r.x + ry * frame->w] = t.color_edge;
+				PXY (r.x, ry);
 				if (ry == tri1[1].y) break;
 				if (r.d >= 0) {
 					r.x += r.sx;
@@ -969,7 +1124,7 @@ static inline void DrawTriangle (render_state_element_t element) {
 		if (l.ax > ay) {
 			l.d = ay - (l.ax / 2);
 			for (;;) {
-				frame->p[l.x + ly * frame->w] = t.color_edge;
+				PXY (l.x, ly);
 				if (l.x == tri2[2].x) break;
 				if (l.d >= 0) {
 					--ly;
@@ -982,7 +1137,7 @@ static inline void DrawTriangle (render_state_element_t element) {
 		else {
 			l.d = l.ax - ay / 2;
 			for (;;) {
-				frame->p[l.x + ly * frame->w] = t.color_edge;
+				PXY (l.x, ly);
 				if (ly == tri2[2].y) break;
 				if (l.d >= 0) {
 					l.x += l.sx;
@@ -997,7 +1152,7 @@ static inline void DrawTriangle (render_state_element_t element) {
 		if (r.ax > ay) {
 			r.d = ay - (r.ax / 2);
 			for (;;) {
-				frame->p[r.x + ry * frame->w] = t.color_edge;
+				PXY (r.x, ry);
 				if (r.x == tri2[2].x) break;
 				if (r.d >= 0) {
 					--ry;
@@ -1010,7 +1165,7 @@ static inline void DrawTriangle (render_state_element_t element) {
 		else {
 			r.d = r.ax - ay / 2;
 			for (;;) {
-				frame->p[r.x + ry * frame->w] = t.color_edge;
+				PXY (r.x, ry);
 				if (ry == tri2[2].y) break;
 				if (r.d >= 0) {
 					r.x += r.sx;
@@ -1021,51 +1176,55 @@ static inline void DrawTriangle (render_state_element_t element) {
 			}
 		}
 	}
+	#pragma pop_macro ("PXY")
 }
 
-static inline void DrawShape (render_state_element_t element) {
-	auto s = element.shape;
-	switch (s.type) {
+static inline void DrawShape (const render_shape_t *shape, bool ignore_camera) {
+	const auto s = shape;
+	switch (s->type) {
 		case render_shape_rectangle: {
-			DrawRectangle (element);
+			DrawRectangle (shape, ignore_camera);
 		} break;
 
 		case render_shape_circle: {
-			auto c = s.circle;
-			if (!element.ignore_camera) {
+			auto c = s->circle;
+			if (!ignore_camera) {
 				c.x -= camera.x;
 				c.y -= camera.y;
 			}
+			c.y -= band.y;
 			if (c.color_fill != 0) DrawCircleFilled (frame, c.x, c.y, c.r, c.color_fill);
 			if ((c.color_fill == 0 || c.color_edge != c.color_fill) && c.color_edge != 0) DrawCircle (frame, c.x, c.y, c.r, c.color_edge);
 		} break;
 
 		case render_shape_ellipse: {
-			auto e = s.ellipse;
-			if (!element.ignore_camera) {
+			auto e = s->ellipse;
+			if (!ignore_camera) {
 				e.x -= camera.x;
 				e.y -= camera.y;
 			}
+			e.y -= band.y;
 			if (e.color_fill != 0) DrawEllipseFilled (frame, e.x, e.y, e.rx, e.ry, e.color_fill);
 			if ((e.color_fill == 0 || e.color_edge != e.color_fill) && e.color_edge != 0) DrawEllipse (frame, e.x, e.y, e.rx, e.ry, e.color_edge);
 		} break;
 
 		case render_shape_line: {
-			DrawLine (element);
+			DrawLine (shape, ignore_camera);
 		} break;
 
 		case render_shape_dot: {
-			auto d = s.dot;
-			if (!element.ignore_camera) {
+			auto d = s->dot;
+			if (!ignore_camera) {
 				d.x -= camera.x;
 				d.y -= camera.y;
 			}
+			d.y -= band.y;
 			if (d.x < 0 || d.x > frame->w-1 || d.y < 0 || d.y > frame->h-1) break;
 			frame->p[d.x + d.y * frame->w] = d.color;
 		} break;
 
 		case render_shape_triangle: {
-			DrawTriangle (element);
+			DrawTriangle (shape, ignore_camera);
 		}
 	}
 }
@@ -1158,17 +1317,15 @@ static inline void DrawWrite_Length (const font_t *font, sprite_t *destination,
 
 								int yy = y + spr.y;
 								if (state.wave.height) {
-									yy += (f32)(state.wave.height / 2.f) * sin_turns ((f32)frame_index / (255 - state.wave.speed*16) + state.wave.offset) + 0.75f;
+									yy += (int)floorf ((f32)(state.wave.height / 2.f) * sin_turns ((f32)frame_index / (255 - state.wave.speed*16) + state.wave.offset) + 0.75f);
 									state.wave.offset -= (state.wave.steepness / 15.f) * .5f;
 								}
 
-								DrawSprite ((render_state_element_t){
-									.type = render_element_sprite,
-									.sprite = {
-										.position = {.x = spr.x + x, .y = yy},
-										.sprite = spr._,
-									},
-								});
+								// y is already relative to the band, which DrawSprite takes off again
+								DrawSprite (&(render_state_sprite_t){
+									.position = {.x = spr.x + x, .y = yy + band.y},
+									.sprite = spr._,
+								}, false, NULL);
 								x += spr._->w + spr.x;
 							} break;
 						}
@@ -1196,7 +1353,7 @@ static inline void DrawWrite_Length (const font_t *font, sprite_t *destination,
 
                     int yy = y - font->descent[i];
 					if (state.wave.height) {
-						yy += (f32)(state.wave.height / 2.f) * sin_turns ((f32)frame_index / (255 - state.wave.speed*16) + state.wave.offset) + 0.75f;
+						yy += (int)floorf ((f32)(state.wave.height / 2.f) * sin_turns ((f32)frame_index / (255 - state.wave.speed*16) + state.wave.offset) + 0.75f);
 						state.wave.offset -= (state.wave.steepness / 15.f) * .5f;
 					}
                     int right = x + font->bitmaps[i]->w-1;
@@ -1220,24 +1377,31 @@ static inline void DrawWrite (const font_t *font, sprite_t *destination, int lef
 	DrawWrite_Length(font, destination, left, top, text, strlen (text), frame_index);
 }
 
-static inline void DrawTexturedPoly (render_state_element_t element) {
-	auto p = element.textured_poly;
+static inline void DrawTexturedPoly (const render_state_textured_poly_t *poly, bool ignore_camera) {
+	auto p = *poly;
 	assert (p.vertex_count > 2);
-	if (!element.ignore_camera) {
+	if (!ignore_camera) {
 		p.x -= camera.x;
 		p.y -= camera.y;
 	}
+	p.y -= band.y;
 	
+	// Offset a copy of the vertices so the render state can be drawn more than once
+	textured_poly_vertex_t vertices[UINT8_MAX];
 	int top = 0;
 	i16 boty = INT16_MAX;
 	for (int i = 0; i < p.vertex_count; ++i) {
-		p.vertices[i].x += p.x;
-		p.vertices[i].y += p.y;
+		vertices[i] = p.vertices[i];
+		vertices[i].x += p.x;
+		vertices[i].y += p.y;
+	}
+	p.vertices = vertices;
+	for (int i = 0; i < p.vertex_count; ++i) {
 		if (p.vertices[i].y > p.vertices[top].y) top = i;
 		if (p.vertices[i].y < boty) boty = p.vertices[i].y;
 	}
 
-	if (top < 0 || boty > frame->h-1) return;
+	if (p.vertices[top].y < 0 || boty > frame->h-1) return;
 
 	// Find leftmost top, and rightmost top vertices
 	u8 l = top;
@@ -1259,7 +1423,7 @@ static inline void DrawTexturedPoly (render_state_element_t element) {
 	}
 
 	i16 y = p.vertices[top].y;
-	while (y >= boty) {
+	while (y >= boty && y >= 0) {
 		f32 ld = 0, rd = 0;
 		u8 lnext = (l+1) % p.vertex_count;
 		if (p.vertices[lnext].y >= p.vertices[l].y) lnext = l;
@@ -1297,7 +1461,7 @@ static inline void DrawTexturedPoly (render_state_element_t element) {
 		};
 
 		i16 drawl = MAX(0, left.x);
-		i16 drawr = MIN(frame->w-1, right.x);
+		i16 drawr = y > frame->h-1 ? -1 : MIN(frame->w-1, right.x);
 		for (i16 x = drawl; x <= drawr; ++x) {
 			i16 w = right.x - left.x + 1;
 			f32 d = (f32)(x - left.x) / w;
@@ -1313,6 +1477,487 @@ static inline void DrawTexturedPoly (render_state_element_t element) {
 	}
 }
 
+#ifdef RENDER_DRAW_TIMING
+render_draw_timing_t render_draw_timing = {};
+#define RENDER_DRAW_TIMING_START() const i64 render_draw_timing_start = zen_nTime ()
+#define RENDER_DRAW_TIMING_END(__entry__) do { (__entry__).nanoseconds += zen_nTime () - render_draw_timing_start; ++(__entry__).count; } while (false)
+#else
+#define RENDER_DRAW_TIMING_START()
+#define RENDER_DRAW_TIMING_END(__entry__)
+#endif
+
+// Element indices sorted by depth, front-most first. Written by Render_DrawState before any band is drawn.
+static u16 render_order[RENDER_MAX_ELEMENTS];
+static_assert (RENDER_MAX_ELEMENTS <= UINT16_MAX + 1);
+
+static void DrawElementsAndParticles (render_state_t *render_state) {
+	camera = render_state->camera;
+	for (int i = render_state->element_count-1; i >= 0; --i) {
+		const auto element = &render_state->elements[render_order[i]];
+		RENDER_DRAW_TIMING_START ();
+		switch (element->type) {
+			case render_element_sprite: {
+				DrawSprite (&render_state->sprites.array[element->index], element->ignore_camera, render_rotated[render_order[i]]);
+			} break;
+
+			case render_element_sprite_silhouette: {
+				DrawSpriteSilhouette (&render_state->sprite_silhouettes.array[element->index], element->ignore_camera);
+			} break;
+
+			case render_element_shape: {
+				DrawShape (&render_state->shapes.array[element->index], element->ignore_camera);
+			} break;
+
+			case render_element_text: {
+				auto text = render_state->texts.array[element->index];
+				if (!element->ignore_camera) {
+					text.x -= camera.x;
+					text.y -= camera.y;
+				}
+				DrawWrite_Length (&resources_framework_font, frame, text.x, text.y - band.y, text.string, text.length, render_state->state_count);
+			} break;
+
+			case render_element_darkness_rectangle: {
+				const auto r = &render_state->darkness_rectangles.array[element->index];
+				const int b = MAX (0, r->b - band.y), t = MIN (frame->h-1, r->t - band.y);
+				const int l = MAX (0, r->l), rr = MIN (frame->w-1, r->r);
+				for (int y = b; y <= t; ++y) {
+					for (int x = l; x <= rr; ++x) {
+						frame->p[x + frame->w * y] >>= r->levels;
+					}
+				}
+			} break;
+
+			case render_element_textured_poly: {
+				DrawTexturedPoly (&render_state->textured_polys.array[element->index], element->ignore_camera);
+			} break;
+
+			case render_element_type_count: break;
+		}
+		#ifdef RENDER_DRAW_TIMING
+		if (!band.split) RENDER_DRAW_TIMING_END (render_draw_timing.elements[element->type]);
+		#endif
+	}
+
+	// ************************************
+	// Pixel particles
+	// ************************************
+	RENDER_DRAW_TIMING_START ();
+	for (int i = 0; i < render_state->particles.count; ++i) {
+		int x = render_state->particles.array[i].position.x;
+		int y = render_state->particles.array[i].position.y;
+		assert (x >= 0 && x < frame->w && y >= 0 && y < band.frame_h);
+		y -= band.y;
+		if (y < 0 || y >= frame->h) continue;
+		frame->p[x + y * frame->w] = render_state->particles.array[i].pixel;
+	}
+	#ifdef RENDER_DRAW_TIMING
+	if (!band.split) RENDER_DRAW_TIMING_END (render_draw_timing.particles);
+	#endif
+}
+
+// Draws rows y0 up to y1 of destination from the calling thread. split is set when this isn't the whole frame.
+static void DrawRows (render_state_t *render_state, sprite_t *destination, int y0, int y1, bool split) {
+	sprite_t view = {.w = destination->w, .h = y1 - y0, .p = &destination->p[y0 * destination->w]};
+	frame = &view;
+	band = (typeof(band)){.y = y0, .frame_h = destination->h, .split = split};
+	DrawElementsAndParticles (render_state);
+}
+
+// Draws band index of count into destination from the calling thread
+static void DrawBand (render_state_t *render_state, sprite_t *destination, int index, int count) {
+	DrawRows (render_state, destination, destination->h * index / count, destination->h * (index+1) / count, count > 1);
+}
+
+// ************************************
+// Band threads
+// ************************************
+#ifndef RENDER_THREADS
+#define RENDER_THREADS 1
+#endif
+#ifndef RENDER_THREADS_MAX
+#define RENDER_THREADS_MAX 16
+#endif
+static_assert (RENDER_THREADS >= 1 && RENDER_THREADS <= RENDER_THREADS_MAX);
+
+static struct {
+	int count; // Threads drawing each frame, including the one calling Render_DrawState
+	int started; // Band threads created so far, which is at most RENDER_THREADS_MAX-1
+	pthread_t threads[RENDER_THREADS_MAX-1];
+	pthread_mutex_t mutex;
+	pthread_cond_t start, done;
+	u64 generation;
+	int remaining;
+	render_state_t *render_state;
+	sprite_t *destination;
+} render_threads = {
+	.count = RENDER_THREADS,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.start = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+static void *RenderBandThread (void *argument) {
+	const int index = (intptr_t)argument;
+	u64 generation = 0;
+	pthread_mutex_lock (&render_threads.mutex);
+	while (true) {
+		while (render_threads.generation == generation) pthread_cond_wait (&render_threads.start, &render_threads.mutex);
+		generation = render_threads.generation;
+		const int count = render_threads.count;
+		if (index >= count) continue;
+		const auto render_state = render_threads.render_state;
+		const auto destination = render_threads.destination;
+		pthread_mutex_unlock (&render_threads.mutex);
+
+		DrawBand (render_state, destination, index, count);
+
+		pthread_mutex_lock (&render_threads.mutex);
+		if (--render_threads.remaining == 0) pthread_cond_signal (&render_threads.done);
+	}
+	return NULL;
+}
+
+void Render_SetThreads (int count) {
+	render_threads.count = MAX (1, MIN (RENDER_THREADS_MAX, count));
+}
+
+static void DrawElementsInBands (render_state_t *render_state, sprite_t *destination) {
+	const int count = render_threads.count;
+	while (render_threads.started < count-1) {
+		if (pthread_create (&render_threads.threads[render_threads.started], NULL, RenderBandThread, (void *)(intptr_t)(render_threads.started+1))) {
+			LOG ("Failed to create render band thread. Drawing with %d threads", render_threads.started+1);
+			render_threads.count = render_threads.started+1;
+			break;
+		}
+		++render_threads.started;
+	}
+	if (render_threads.count == 1) {
+		DrawBand (render_state, destination, 0, 1);
+		return;
+	}
+
+	pthread_mutex_lock (&render_threads.mutex);
+	render_threads.render_state = render_state;
+	render_threads.destination = destination;
+	render_threads.remaining = render_threads.count-1;
+	++render_threads.generation;
+	pthread_cond_broadcast (&render_threads.start);
+	pthread_mutex_unlock (&render_threads.mutex);
+
+	DrawBand (render_state, destination, 0, render_threads.count);
+
+	pthread_mutex_lock (&render_threads.mutex);
+	while (render_threads.remaining > 0) pthread_cond_wait (&render_threads.done, &render_threads.mutex);
+	pthread_mutex_unlock (&render_threads.mutex);
+}
+
+// ************************************
+// Dirty rectangles
+// ************************************
+// Dirty regions are whole rows, since everything is drawn with the frame's width as its stride. Each element is summarised by a hash of what it draws and the rows it can reach; any element whose summary differs from the one at the same index last frame has its old and new rows redrawn.
+#ifndef RENDER_DIRTY_MAX_WIDTH
+#define RENDER_DIRTY_MAX_WIDTH RESOLUTION_WIDTH
+#endif
+#ifndef RENDER_DIRTY_MAX_HEIGHT
+#define RENDER_DIRTY_MAX_HEIGHT RESOLUTION_HEIGHT
+#endif
+
+render_dirty_rects_t render_dirty_rects = {};
+
+typedef struct {
+	int bottom, top; // Inclusive
+} dirty_rows_t;
+
+static struct {
+	bool valid; // Everything below describes what was last drawn into destination
+	const u8 *destination;
+	int w, h;
+	typeof((render_state_t){}.background) background;
+	i32 element_count;
+	u64 hashes[RENDER_MAX_ELEMENTS];
+	dirty_rows_t rows[RENDER_MAX_ELEMENTS];
+	u64 particles_hash;
+	bool particle_rows[RENDER_DIRTY_MAX_HEIGHT];
+	bool redraw[RENDER_DIRTY_MAX_HEIGHT]; // Rows redrawn by the last Render_DrawState
+	bool overwritten[RENDER_DIRTY_MAX_HEIGHT]; // Rows Render drew over after it
+	u8 background_pixels[RENDER_DIRTY_MAX_WIDTH * RENDER_DIRTY_MAX_HEIGHT]; // The background, drawn once each time it changes
+} dirty;
+
+static inline u64 DirtyHash (u64 hash, const void *data, size_t size) {
+	for (size_t i = 0; i < size; ++i) hash = (hash ^ ((const u8 *)data)[i]) * 1099511628211ull;
+	return hash;
+}
+
+static inline void DirtyMark (bool *rows, dirty_rows_t range, int h) {
+	for (int y = MAX (range.bottom, 0); y <= MIN (range.top, h-1); ++y) rows[y] = true;
+}
+
+// Rows a sprite drawn at y can reach
+static dirty_rows_t DirtySpriteRows (const render_state_sprite_t *s, int y) {
+	const int w = s->sprite->w, h = s->sprite->h;
+	if (s->rotation == 0 && s->flags.rotation_by_quarters == 0 && !(s->flags.flip_horizontally && s->flags.flip_vertically))
+		return (dirty_rows_t){y - s->originy, y - s->originy + h-1};
+	// Rotated: anywhere within reach of the origin, plus the rotation cache's margin
+	const int dx = MAX (s->originx, w - s->originx), dy = MAX (s->originy, h - s->originy);
+	const int r = (int)ceilf (sqrtf ((f32)(dx*dx + dy*dy))) + 3;
+	return (dirty_rows_t){y - r, y + r};
+}
+
+// Hash of everything that affects how element is drawn, and the rows it can reach in a frame width pixels wide. Sprites and palettes are identified by address, so their pixels are assumed not to change.
+static u64 DirtySummarise (const render_state_t *render_state, const render_state_element_t *element, int width, dirty_rows_t *rows) {
+	const u8 header[] = {element->type, element->ignore_camera, (u8)element->depth};
+	u64 hash = DirtyHash (14695981039346656037ull, header, sizeof (header));
+	const int camera_y = element->ignore_camera ? 0 : render_state->camera.y;
+	if (!element->ignore_camera) hash = DirtyHash (hash, &render_state->camera, sizeof (render_state->camera));
+	switch (element->type) {
+		case render_element_sprite: {
+			const auto s = &render_state->sprites.array[element->index];
+			hash = DirtyHash (hash, s, sizeof (*s));
+			*rows = DirtySpriteRows (s, s->position.y - camera_y);
+		} break;
+
+		case render_element_sprite_silhouette: {
+			const auto s = &render_state->sprite_silhouettes.array[element->index];
+			hash = DirtyHash (hash, s, sizeof (*s));
+			*rows = DirtySpriteRows (&s->sprite, s->sprite.position.y - camera_y);
+		} break;
+
+		case render_element_shape: {
+			const auto s = &render_state->shapes.array[element->index];
+			hash = DirtyHash (hash, s, sizeof (*s));
+			switch (s->type) {
+				case render_shape_rectangle: {
+					const auto r = s->rectangle;
+					int bottom = r.y - camera_y, top = bottom + r.h-1;
+					if (bottom > top) SWAP (bottom, top);
+					if (r.flags.center_vertically) {
+						bottom -= r.h/2;
+						top -= r.h/2;
+					}
+					*rows = (dirty_rows_t){bottom, top};
+				} break;
+				case render_shape_circle: *rows = (dirty_rows_t){s->circle.y - camera_y - s->circle.r - 1, s->circle.y - camera_y + s->circle.r + 1}; break;
+				case render_shape_ellipse: *rows = (dirty_rows_t){s->ellipse.y - camera_y - s->ellipse.ry - 1, s->ellipse.y - camera_y + s->ellipse.ry + 1}; break;
+				case render_shape_line: {
+					// DrawLine's clip to the right edge of the frame can overshoot the end by up to the line's height
+					const auto l = s->line;
+					const int camera_x = element->ignore_camera ? 0 : render_state->camera.x;
+					const int overshoot = MAX (l.x0, l.x1) - camera_x > width-1 ? abs (l.y1 - l.y0) : 0;
+					*rows = (dirty_rows_t){MIN (l.y0, l.y1) - camera_y - overshoot - 1, MAX (l.y0, l.y1) - camera_y + overshoot + 1};
+				} break;
+				case render_shape_dot: *rows = (dirty_rows_t){s->dot.y - camera_y, s->dot.y - camera_y}; break;
+				case render_shape_triangle: {
+					// Triangles ignore the camera, except when they're flat and drawn as a line
+					const auto t = s->triangle;
+					const int b = MIN (t.y0, MIN (t.y1, t.y2)), tt = MAX (t.y0, MAX (t.y1, t.y2));
+					*rows = (dirty_rows_t){MIN (b, b - camera_y) - 1, MAX (tt, tt - camera_y) + 1};
+				} break;
+			}
+		} break;
+
+		case render_element_text: {
+			const auto text = &render_state->texts.array[element->index];
+			const i16 position[] = {text->x, text->y, text->length};
+			hash = DirtyHash (hash, position, sizeof (position));
+			hash = DirtyHash (hash, text->string, text->length);
+			const auto payload_count = Render_TextGetPayloadCountFromString (text->string);
+			const auto payloads = &((const render_text_payload_t *)text->string)[-payload_count];
+			hash = DirtyHash (hash, payloads, payload_count * sizeof (*payloads));
+			// Waves move with the frame index
+			for (const char *c = text->string; (c = strchr (c, '\\')) && c[1]; c += 2) {
+				if (c[1] == 'w' || c[1] == 'W') {
+					hash = DirtyHash (hash, &render_state->state_count, sizeof (render_state->state_count));
+					break;
+				}
+			}
+			// Lines go down from y. Waves move letters up to 8 pixels either way, and sprites in the text have their own offsets.
+			int margin = 9;
+			for (int i = 0; i < payload_count; ++i) {
+				if (payloads[i].tag == render_text_payload_sprite)
+					margin = MAX (margin, 9 + abs (payloads[i]._.sprite.y) + payloads[i]._.sprite._->h + abs (camera_y));
+			}
+			const int top = text->y - camera_y;
+			*rows = (dirty_rows_t){top - font_StringDimensions (&resources_framework_font, text->string, NULL).h - margin, top + margin};
+		} break;
+
+		case render_element_darkness_rectangle: {
+			const auto r = &render_state->darkness_rectangles.array[element->index];
+			hash = DirtyHash (hash, r, sizeof (*r));
+			*rows = (dirty_rows_t){r->b, r->t};
+		} break;
+
+		case render_element_textured_poly: {
+			const auto p = &render_state->textured_polys.array[element->index];
+			const auto texture = p->texture;
+			const i16 position[] = {p->x, p->y, p->vertex_count};
+			hash = DirtyHash (hash, &texture, sizeof (texture));
+			hash = DirtyHash (hash, position, sizeof (position));
+			hash = DirtyHash (hash, p->vertices, p->vertex_count * sizeof (*p->vertices));
+			int b = INT16_MAX, t = INT16_MIN;
+			for (int i = 0; i < p->vertex_count; ++i) {
+				b = MIN (b, p->vertices[i].y);
+				t = MAX (t, p->vertices[i].y);
+			}
+			*rows = (dirty_rows_t){p->y - camera_y + b - 1, p->y - camera_y + t + 1};
+		} break;
+
+		case render_element_type_count: break;
+	}
+	return hash;
+}
+
+static bool DirtyFits (const sprite_t *destination) {
+	return destination->w <= RENDER_DIRTY_MAX_WIDTH && destination->h <= RENDER_DIRTY_MAX_HEIGHT;
+}
+
+// Draws the background and only the rows of render_state which differ from what was drawn into destination last time
+static void DrawDirtyRows (render_state_t *render_state, sprite_t *destination) {
+	const int w = destination->w, h = destination->h;
+	// Padding differences in the background only cost a full redraw
+	const bool new_background = !dirty.valid || memcmp (&dirty.background, &render_state->background, sizeof (dirty.background)) != 0;
+	const bool full = new_background || dirty.destination != destination->p || dirty.w != w || dirty.h != h || render_state->background.type == background_type_none;
+	if (new_background) {
+		RENDER_DRAW_TIMING_START ();
+		sprite_t cache = {.w = w, .h = h, .p = dirty.background_pixels};
+		memset (cache.p, 0, w * h);
+		frame = &cache;
+		DrawBackground (render_state);
+		frame = destination;
+		dirty.background = render_state->background;
+		RENDER_DRAW_TIMING_END (render_draw_timing.background);
+	}
+
+	memset (dirty.redraw, full, h);
+	for (int y = 0; y < h; ++y) dirty.redraw[y] |= dirty.overwritten[y];
+	memset (dirty.overwritten, 0, h);
+
+	const int count = render_state->element_count;
+	for (int i = 0; i < MAX (count, dirty.element_count); ++i) {
+		if (i >= count) {
+			DirtyMark (dirty.redraw, dirty.rows[i], h);
+			continue;
+		}
+		dirty_rows_t rows;
+		const u64 hash = DirtySummarise (render_state, &render_state->elements[i], w, &rows);
+		if (i >= dirty.element_count || hash != dirty.hashes[i] || rows.bottom != dirty.rows[i].bottom || rows.top != dirty.rows[i].top) {
+			if (i < dirty.element_count) DirtyMark (dirty.redraw, dirty.rows[i], h);
+			DirtyMark (dirty.redraw, rows, h);
+		}
+		dirty.hashes[i] = hash;
+		dirty.rows[i] = rows;
+	}
+	dirty.element_count = count;
+
+	const auto particles = &render_state->particles;
+	const u64 particles_hash = DirtyHash (DirtyHash (14695981039346656037ull, &particles->count, sizeof (particles->count)), particles->array, particles->count * sizeof (*particles->array));
+	if (particles_hash != dirty.particles_hash) {
+		for (int y = 0; y < h; ++y) {
+			dirty.redraw[y] |= dirty.particle_rows[y];
+			dirty.particle_rows[y] = false;
+		}
+		for (int i = 0; i < particles->count; ++i) {
+			const int y = particles->array[i].position.y;
+			if (y < 0 || y >= h) continue;
+			dirty.particle_rows[y] = dirty.redraw[y] = true;
+		}
+		dirty.particles_hash = particles_hash;
+	}
+
+	dirty.valid = true;
+	dirty.destination = destination->p;
+	dirty.w = w;
+	dirty.h = h;
+	++render_dirty_rects.frames;
+	if (full) ++render_dirty_rects.full_frames;
+
+	RENDER_DRAW_TIMING_START ();
+	for (int y0 = 0, y1; y0 < h; y0 = y1) {
+		if (!dirty.redraw[y0]) {
+			y1 = y0+1;
+			continue;
+		}
+		y1 = y0+1;
+		while (y1 < h && dirty.redraw[y1]) ++y1;
+		if (render_state->background.type != background_type_none) memcpy (&destination->p[y0 * w], &dirty.background_pixels[y0 * w], (y1 - y0) * w);
+		DrawRows (render_state, destination, y0, y1, y1 - y0 < h);
+		render_dirty_rects.rows += y1 - y0;
+	}
+	RENDER_DRAW_TIMING_END (render_draw_timing.bands);
+}
+
+// Render draws its overlays straight into the frame after Render_DrawState, so those rows are redrawn next frame
+static void DirtyOverwritten (int bottom, int top) {
+	if (dirty.valid) DirtyMark (dirty.overwritten, (dirty_rows_t){bottom, top}, dirty.h);
+}
+
+// The row ranges of the frame which changed since the last: everything the last Render_DrawState redrew and everything drawn over since. Ranges past max are merged into the last one.
+static int DirtyChangedRows (os_row_range_t *ranges, int max) {
+	int count = 0;
+	for (int y0 = 0, y1; y0 < dirty.h; y0 = y1) {
+		y1 = y0+1;
+		if (!dirty.redraw[y0] && !dirty.overwritten[y0]) continue;
+		while (y1 < dirty.h && (dirty.redraw[y1] || dirty.overwritten[y1])) ++y1;
+		if (count == max) ranges[count-1].top = y1-1;
+		else ranges[count++] = (os_row_range_t){.bottom = y0, .top = y1-1};
+	}
+	return count;
+}
+
+// Render_DrawState with render_dirty_rects.enabled already loaded, so Render can use the same value for the whole frame
+static void DrawState (render_state_t *render_state, sprite_t *destination, bool dirty_rects_enabled) {
+	frame = destination;
+	band = (typeof(band)){.frame_h = destination->h};
+
+	if (render_state->element_count > RENDER_MAX_ELEMENTS) {
+		LOG ("RENDER WARNING: Render element count maximum exceeded (%d > %d)", render_state->element_count, RENDER_MAX_ELEMENTS);
+		render_state->element_count = RENDER_MAX_ELEMENTS;
+	}
+
+	const bool dirty_rects = dirty_rects_enabled && DirtyFits (destination);
+	if (!dirty_rects) {
+		dirty.valid = false;
+		// Draw background. Always on this thread, since the stripe and checker patterns carry their state from row to row.
+		RENDER_DRAW_TIMING_START ();
+		DrawBackground (render_state);
+		RENDER_DRAW_TIMING_END (render_draw_timing.background);
+	}
+
+	const auto count = render_state->element_count;
+
+	// Sort render objects by depth with a counting sort into an index array, leaving the elements where they are. Front-most elements go toward render_order[0] and keep submission order within a depth, and elements are drawn starting from render_order[count-1] down to render_order[0]
+	// High depth means draw on top, low depth means draw further behind
+	{
+		RENDER_DRAW_TIMING_START ();
+		int bucket[256] = {}; // Indexed by INT8_MAX - depth, so the highest depth comes first
+		for (int i = 0; i < count; ++i) ++bucket[(u8)(INT8_MAX - render_state->elements[i].depth)];
+		for (int i = 0, total = 0; i < 256; ++i) {
+			const int c = bucket[i];
+			bucket[i] = total;
+			total += c;
+		}
+		for (int i = 0; i < count; ++i) render_order[bucket[(u8)(INT8_MAX - render_state->elements[i].depth)]++] = i;
+		RENDER_DRAW_TIMING_END (render_draw_timing.sort);
+	}
+
+	RotationCachePrepare (render_state);
+
+	if (dirty_rects) DrawDirtyRows (render_state, destination);
+	// Elements and particles, split into horizontal bands across render_threads.count threads. Each band clips to its own rows, so the result is the same for any number of threads.
+	else {
+		RENDER_DRAW_TIMING_START ();
+		DrawElementsInBands (render_state, destination);
+		RENDER_DRAW_TIMING_END (render_draw_timing.bands);
+	}
+
+	frame = destination;
+	band = (typeof(band)){.frame_h = destination->h};
+}
+
+void Render_DrawState (render_state_t *render_state, sprite_t *destination) {
+	DrawState (render_state, destination, atomic_load_explicit (&render_dirty_rects.enabled, memory_order_relaxed));
+}
+
 void *Render (void*) {
 	LOG ("Render thread started");
 	render_data.thread_initialized = true;
@@ -1338,11 +1983,8 @@ void *Render (void*) {
 
 	static u64 frame_index = 0;
 
-	int i = 0;
-	do {
-		int j = i++ % 3;
-		if(!render_data.render_states[j].busy && render_data.render_states[j].state_count > 0) break;
-	} while (true);
+	// Wait for the update thread to finish its first state
+	while (!(atomic_load_explicit (&render_state_middle, memory_order_acquire) & RENDER_STATE_FRESH)) os_uSleepEfficient (1000);
 
 	LOG ("Render loop beginning");
 
@@ -1388,24 +2030,7 @@ void *Render (void*) {
 		os_SetWindowFrameBuffer (frame->p, frame->w, frame->h);
 
 		// Select most recently updated render state for this render
-		render_state_t *render_state;
-		{
-			int found = -1;
-			u64 highest_state_count = 0;
-
-			pthread_mutex_lock (&update_render_swap_state_mutex);
-			for(int i = 0; i < 3; ++i) {
-				if(!render_data.render_states[i].busy && render_data.render_states[i].state_count > highest_state_count) {
-					found = i;
-					highest_state_count = render_data.render_states[i].state_count;
-				}
-			}
-			assert (found != -1);
-			render_state = &render_data.render_states[found];
-			render_state->busy = true;
-
-			pthread_mutex_unlock (&update_render_swap_state_mutex);
-		}
+		render_state_t *render_state = Render_AcquireNewestState ();
 
 		if (!show_fps && render_state->debug.show_framerate) reset_fps = true;
 		show_fps = render_state->debug.show_framerate;
@@ -1413,79 +2038,10 @@ void *Render (void*) {
 		assert (render_state->state_count >= frame_index);
 		frame_index = render_state->state_count;
 
-		if (render_state->element_count > RENDER_MAX_ELEMENTS) {
-			LOG ("RENDER WARNING: Render element count maximum exceeded (%d > %d)", render_state->element_count, RENDER_MAX_ELEMENTS);
-			render_state->element_count = RENDER_MAX_ELEMENTS;
-		}
-
+		const bool dirty_rects = atomic_load_explicit (&render_dirty_rects.enabled, memory_order_relaxed);
 		const auto frame_start = os_uTime ();
 
-		// Draw background
-		DrawBackground (render_state);
-
-		auto count = render_state->element_count;
-
-		// Sort render objects. Front-most elements go toward [0], and elements are drawn starting from [count-1] down to [0]
-		// High depth means draw on top, low depth means draw further behind
-		for (int r = 1; r < count; ++r) {
-			auto elementr = &render_state->elements[r];
-			for (int l = r-1; l >= 0 && render_state->elements[l].depth < elementr->depth; --l) {
-				SWAP (render_state->elements[l], *elementr);
-				--elementr;
-			}
-		}
-
-		camera = render_state->camera;
-		auto element = &render_state->elements[count-1];
-		repeat (count) {
-			switch (element->type) {
-				case render_element_sprite: {
-					DrawSprite (*element);
-				} break;
-
-				case render_element_sprite_silhouette: {
-					DrawSpriteSilhouette (*element);
-				} break;
-
-				case render_element_shape: {
-					DrawShape (*element);
-				} break;
-
-				case render_element_text: {
-					auto text = element->text;
-					if (!element->ignore_camera) {
-						text.x -= camera.x;
-						text.y -= camera.y;
-					}
-					DrawWrite_Length (&resources_framework_font, frame, text.x, text.y, text.string, text.length, render_state->state_count);
-				} break;
-
-				case render_element_darkness_rectangle: {
-					const auto r = element->darkness_rectangle;
-					for (i16 y = r.b; y <= r.t; ++y) {
-						for (i16 x = r.l; x <= r.r; ++x) {
-							frame->p[x + frame->w * y] >>= r.levels;
-						}
-					}
-				} break;
-
-				case render_element_textured_poly: {
-					DrawTexturedPoly (*element);
-				} break;
-			}
-			--element;
-		}
-
-		// ************************************
-		// Pixel particles
-		// ************************************
-		for (int i = 0; i < render_state->particles.count; ++i) {
-			int x = render_state->particles.array[i].position.x;
-			int y = render_state->particles.array[i].position.y;
-			assert (x >= 0 && x < frame->w && y >= 0 && y < frame->h);
-			// if (x < 0 || x >= frame->w || y < 0 || y >= frame->h) continue;
-			frame->p[x + y * frame->w] = render_state->particles.array[i].pixel;
-		}
+		DrawState (render_state, frame, dirty_rects);
 
 		const auto frame_end = os_uTime ();
 		const auto frame_time = frame_end - frame_start;
@@ -1505,29 +2061,36 @@ void *Render (void*) {
 			char str[32];
 			snprintf (str, sizeof(str), "R%4"PRId64"us", max_recorded_frame_time);
 			DrawWrite (&resources_framework_font, frame, 1, frame->h-2-resources_framework_font.line_height, str, render_state->state_count);
+			DirtyOverwritten (frame->h-2 - resources_framework_font.line_height*3, frame->h-2 - resources_framework_font.line_height);
 		}
 
 		if (render_state->debug.show_framerate) {
 			char str[32];
 			snprintf (str,sizeof (str), "FPS%d", fps_this_frame);
 			DrawWrite (&resources_framework_font, frame, 1, frame->h-2, str, render_state->state_count);
+			DirtyOverwritten (frame->h-2 - resources_framework_font.line_height*2, frame->h-2);
 		}
 
-		if (render_state->cursor.sprite != NULL)
+		if (render_state->cursor.sprite != NULL) {
 			sprite_Blit (render_state->cursor.sprite, frame, render_state->cursor.x, render_state->cursor.y);
+			DirtyOverwritten (render_state->cursor.y, render_state->cursor.y + render_state->cursor.sprite->h-1);
+		}
+
+		// Only upload the rows that changed
+		if (dirty_rects && dirty.valid) {
+			os_row_range_t ranges[OS_FRAME_BUFFER_DIRTY_ROWS_MAX];
+			os_SetWindowFrameBufferDirtyRows (ranges, DirtyChangedRows (ranges, _Countof (ranges)));
+		}
 
 		/**********************************************
 		 * Present frame and wait for next screen refresh
 		 **********************************************/
 		// Update window
 		os_DrawScreen ();
-		
-		asm volatile("" ::: "memory");
-		render_state->busy = false;
-		asm volatile("" ::: "memory");
+		frame_presented = frame;
 
-		// Swap frame
-		frame_select = !frame_select;
+		// Swap frame. Dirty rectangles redraw over the last frame, so they keep it.
+		if (!dirty_rects) frame_select = !frame_select;
 		frame = (render_data.frame[frame_select]);
 
 		// Sleep until next frame
@@ -1637,9 +2200,257 @@ void Render_Screenshot (sprite_t *destination) {
 	render_data.pause_thread = true;
 	while (render_data.pause_thread) os_uSleepEfficient(1000);
 
-	sprite_t *frame = render_data.frame[!frame_select];
+	sprite_t *frame = frame_presented ? frame_presented : render_data.frame[!frame_select];
 	for (int y = 0; y < RESOLUTION_HEIGHT; ++y) {
 		memcpy (&destination->p[y * destination->w], &frame->p[y * RESOLUTION_WIDTH], RESOLUTION_WIDTH);
 	}
 	render_data.resume_thread = true;
 }
+
+// ************************************
+// Render state capture
+// ************************************
+#ifndef RENDER_CAPTURE_SPRITES_MAX
+#define RENDER_CAPTURE_SPRITES_MAX 1024
+#endif
+#ifndef RENDER_CAPTURE_PALETTES_MAX
+#define RENDER_CAPTURE_PALETTES_MAX 64
+#endif
+
+#ifndef RENDER_CAPTURE_PARTICLES_MAX
+#define RENDER_CAPTURE_PARTICLES_MAX 65536
+#endif
+
+static struct {
+	render_state_t state;
+	render_state_particle_t particles[RENDER_CAPTURE_PARTICLES_MAX];
+	const void *sprites[RENDER_CAPTURE_SPRITES_MAX];
+	const void *palettes[RENDER_CAPTURE_PALETTES_MAX];
+	u32 sprite_count, palette_count;
+	bool overflowed;
+} capture_write;
+
+static struct {
+	sprite_t *sprites;
+	u8 (*palettes)[256];
+	u32 sprite_count, palette_count;
+	bool invalid;
+} capture_read;
+
+// Moves text strings and poly vertices from pointing into from to pointing into to, keeping their offset
+static void CaptureRebaseMem (render_state_t *state, uintptr_t from, uintptr_t to) {
+	for (int i = 0; i < state->texts.count; ++i) {
+		auto text = &state->texts.array[i];
+		text->string = (char *)((uintptr_t)text->string - from + to);
+	}
+	for (int i = 0; i < state->textured_polys.count; ++i) {
+		auto poly = &state->textured_polys.array[i];
+		poly->vertices = (textured_poly_vertex_t *)((uintptr_t)poly->vertices - from + to);
+	}
+}
+
+// Replaces every sprite and palette pointer in state with Remap's return value. Text strings must point into state->mem.
+static void CaptureRemap (render_state_t *state, const void *(*Remap) (const void *pointer, bool is_palette)) {
+	for (int i = 0; i < state->sprites.count; ++i) {
+		auto sprite = &state->sprites.array[i];
+		sprite->sprite = Remap (sprite->sprite, false);
+		sprite->color_swap_palette = Remap (sprite->color_swap_palette, true);
+	}
+	for (int i = 0; i < state->sprite_silhouettes.count; ++i) {
+		auto sprite = &state->sprite_silhouettes.array[i].sprite;
+		sprite->sprite = Remap (sprite->sprite, false);
+		sprite->color_swap_palette = Remap (sprite->color_swap_palette, true);
+	}
+	for (int i = 0; i < state->texts.count; ++i) {
+		// Payloads are stored in reverse order before the string
+		const auto string = state->texts.array[i].string;
+		const auto payload_count = Render_TextGetPayloadCountFromString (string);
+		auto payload = &((render_text_payload_t *)string)[-1];
+		if ((char *)&payload[1-payload_count] < state->mem.bytes) continue;
+		repeat (payload_count) {
+			switch (payload->tag) {
+				case render_text_payload_sprite: payload->_.sprite._ = Remap (payload->_.sprite._, false); break;
+			}
+			--payload;
+		}
+	}
+	for (int i = 0; i < state->textured_polys.count; ++i) {
+		auto poly = &state->textured_polys.array[i];
+		poly->texture = Remap (poly->texture, false);
+	}
+	if (state->background.type == background_type_sprite)
+		state->background.sprite = (sprite_t *)Remap (state->background.sprite, false);
+	state->cursor.sprite = Remap (state->cursor.sprite, false);
+}
+
+static const void *CapturePointerToIndex (const void *pointer, bool is_palette) {
+	if (pointer == NULL) return NULL;
+	auto table = is_palette ? capture_write.palettes : capture_write.sprites;
+	auto count = is_palette ? &capture_write.palette_count : &capture_write.sprite_count;
+	const u32 max = is_palette ? RENDER_CAPTURE_PALETTES_MAX : RENDER_CAPTURE_SPRITES_MAX;
+	u32 i = 0;
+	while (i < *count && table[i] != pointer) ++i;
+	if (i == *count) {
+		if (*count >= max) {
+			capture_write.overflowed = true;
+			return NULL;
+		}
+		table[(*count)++] = pointer;
+	}
+	return (const void *)(uintptr_t)(i+1);
+}
+
+static const void *CaptureIndexToPointer (const void *pointer, bool is_palette) {
+	const uintptr_t index = (uintptr_t)pointer;
+	if (index == 0) return NULL;
+	if (index > (is_palette ? capture_read.palette_count : capture_read.sprite_count)) {
+		capture_read.invalid = true;
+		return NULL;
+	}
+	return is_palette ? (const void *)&capture_read.palettes[index-1] : (const void *)&capture_read.sprites[index-1];
+}
+
+bool Render_CaptureWrite (const char *filename) {
+	if (!render_data.thread_initialized) {
+		LOG ("No render state available to capture");
+		return false;
+	}
+	// The render thread's front state is the newest one that's sure to stay put: the update thread may swap the middle state at any time. Pause the render thread at the top of its loop, where it isn't touching it, just long enough to copy it.
+	render_data.resume_thread = false;
+	render_data.pause_thread = true;
+	while (render_data.pause_thread) os_uSleepEfficient (1000);
+	const render_state_t *source = &render_data.render_states[render_state_front];
+	capture_write.state = *source;
+	// Particles beyond RENDER_CAPTURE_PARTICLES_MAX are left out
+	capture_write.state.particles.count = MIN (source->particles.count, RENDER_CAPTURE_PARTICLES_MAX);
+	memcpy (capture_write.particles, source->particles.array, capture_write.state.particles.count * sizeof (*source->particles.array));
+	render_data.resume_thread = true;
+
+	auto state = &capture_write.state;
+	if (state->state_count == 0) {
+		LOG ("No render state available to capture");
+		return false;
+	}
+	if (state->element_count > RENDER_MAX_ELEMENTS) state->element_count = RENDER_MAX_ELEMENTS;
+	capture_write.sprite_count = capture_write.palette_count = 0;
+	capture_write.overflowed = false;
+	CaptureRebaseMem (state, (uintptr_t)source->mem.bytes, (uintptr_t)state->mem.bytes);
+	CaptureRemap (state, CapturePointerToIndex);
+	CaptureRebaseMem (state, (uintptr_t)state->mem.bytes, 1);
+	state->particles.capacity = state->particles.count;
+	state->particles.array = NULL;
+	if (capture_write.overflowed) {
+		LOG ("Render state capture has too many unique sprites or palettes (max %d, %d)", RENDER_CAPTURE_SPRITES_MAX, RENDER_CAPTURE_PALETTES_MAX);
+		return false;
+	}
+
+	size_t pixel_offset = sizeof (render_capture_header_t) + sizeof (render_state_t) + capture_write.sprite_count * sizeof (sprite_t) + capture_write.palette_count * 256;
+	size_t size = pixel_offset;
+	for (u32 i = 0; i < capture_write.sprite_count; ++i) {
+		const sprite_t *sprite = capture_write.sprites[i];
+		size += sprite->w * sprite->h;
+	}
+	size += state->particles.count * sizeof (render_state_particle_t);
+
+	FILE *phil = fopen (filename, "wb");
+	if (!phil) {
+		LOG ("Failed to open file [%s]", filename);
+		return false;
+	}
+	defer { fclose (phil); }
+
+	const render_capture_header_t header = {
+		.magic = "KRSC",
+		.version = RENDER_CAPTURE_VERSION,
+		.state_size = sizeof (render_state_t),
+		.width = RESOLUTION_WIDTH,
+		.height = RESOLUTION_HEIGHT,
+		.sprite_count = capture_write.sprite_count,
+		.palette_count = capture_write.palette_count,
+		.size = size,
+	};
+	fwrite (&header, sizeof (header), 1, phil);
+	fwrite (state, sizeof (*state), 1, phil);
+	for (u32 i = 0; i < capture_write.sprite_count; ++i) {
+		const sprite_t *sprite = capture_write.sprites[i];
+		const sprite_t entry = {.w = sprite->w, .h = sprite->h, .p = (u8 *)pixel_offset};
+		fwrite (&entry, sizeof (entry), 1, phil);
+		pixel_offset += sprite->w * sprite->h;
+	}
+	for (u32 i = 0; i < capture_write.palette_count; ++i)
+		fwrite (capture_write.palettes[i], 256, 1, phil);
+	for (u32 i = 0; i < capture_write.sprite_count; ++i) {
+		const sprite_t *sprite = capture_write.sprites[i];
+		fwrite (sprite->p, sprite->w * sprite->h, 1, phil);
+	}
+	fwrite (capture_write.particles, sizeof (render_state_particle_t), state->particles.count, phil);
+	if (ferror (phil)) {
+		LOG ("Failed to write render state capture [%s]", filename);
+		return false;
+	}
+	LOG ("Captured render state %"PRIu64" (%d elements, %d particles, %u sprites) to [%s]", state->state_count, state->element_count, state->particles.count, capture_write.sprite_count, filename);
+	return true;
+}
+
+bool Render_CaptureRead (render_state_t *state, u8 *capture, size_t capture_size) {
+	constexpr size_t state_offset = sizeof (render_capture_header_t);
+	constexpr size_t tables_offset = state_offset + sizeof (render_state_t);
+	if (capture_size < tables_offset) return false;
+	const render_capture_header_t *header = (render_capture_header_t *)capture;
+	if (memcmp (header->magic, "KRSC", 4) != 0) {
+		LOG ("Not a render state capture");
+		return false;
+	}
+	if (header->version != RENDER_CAPTURE_VERSION || header->state_size != sizeof (render_state_t) || header->size != capture_size) {
+		LOG ("Render state capture is from an incompatible build (version %u, state size %u, expected %d, %zu)", header->version, header->state_size, RENDER_CAPTURE_VERSION, sizeof (render_state_t));
+		return false;
+	}
+	if (tables_offset + (size_t)header->sprite_count * sizeof (sprite_t) + (size_t)header->palette_count * 256 > capture_size) return false;
+
+	capture_read.sprites = (sprite_t *)&capture[tables_offset];
+	capture_read.palettes = (u8 (*)[256])&capture_read.sprites[header->sprite_count];
+	capture_read.sprite_count = header->sprite_count;
+	capture_read.palette_count = header->palette_count;
+	capture_read.invalid = false;
+	for (u32 i = 0; i < capture_read.sprite_count; ++i) {
+		auto sprite = &capture_read.sprites[i];
+		const uintptr_t offset = (uintptr_t)sprite->p;
+		if (offset + sprite->w * sprite->h > capture_size) return false;
+		sprite->p = &capture[offset];
+		sprite->spans = NULL;
+	}
+
+	memcpy (state, &capture[state_offset], sizeof (*state));
+	if (state->element_count < 0 || state->element_count > RENDER_MAX_ELEMENTS || state->particles.count < 0) return false;
+	// Particles are the last thing in the file
+	const size_t particles_size = state->particles.count * sizeof (render_state_particle_t);
+	if (particles_size > capture_size - tables_offset) return false;
+	state->particles.capacity = state->particles.count;
+	state->particles.array = (render_state_particle_t *)&capture[capture_size - particles_size];
+	#define POOL_INVALID(__pool__) (state->__pool__.count > _Countof (state->__pool__.array))
+	if (POOL_INVALID (sprites) || POOL_INVALID (sprite_silhouettes) || POOL_INVALID (shapes) || POOL_INVALID (texts) || POOL_INVALID (darkness_rectangles) || POOL_INVALID (textured_polys)) return false;
+	#undef POOL_INVALID
+	const u16 pool_counts[render_element_type_count] = {
+		[render_element_sprite] = state->sprites.count,
+		[render_element_shape] = state->shapes.count,
+		[render_element_text] = state->texts.count,
+		[render_element_sprite_silhouette] = state->sprite_silhouettes.count,
+		[render_element_darkness_rectangle] = state->darkness_rectangles.count,
+		[render_element_textured_poly] = state->textured_polys.count,
+	};
+	for (int i = 0; i < state->element_count; ++i) {
+		const auto element = &state->elements[i];
+		if (element->type >= render_element_type_count || element->index >= pool_counts[element->type]) return false;
+	}
+	for (int i = 0; i < state->texts.count; ++i) {
+		const uintptr_t offset = (uintptr_t)state->texts.array[i].string;
+		if (offset == 0 || offset > RENDER_STATE_MEM_AMOUNT) return false;
+	}
+	for (int i = 0; i < state->textured_polys.count; ++i) {
+		const uintptr_t offset = (uintptr_t)state->textured_polys.array[i].vertices;
+		if (offset == 0 || offset > RENDER_STATE_MEM_AMOUNT) return false;
+	}
+	CaptureRebaseMem (state, 1, (uintptr_t)state->mem.bytes);
+	CaptureRemap (state, CaptureIndexToPointer);
+	return !capture_read.invalid;
+}
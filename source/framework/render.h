@@ -84,50 +84,96 @@ typedef struct [[gnu::packed]] {
 } render_state_particle_t;
 
 typedef struct [[gnu::packed]] {
-	struct {
-		enum : u8 {render_element_sprite, render_element_shape, render_element_text, render_element_sprite_silhouette, render_element_darkness_rectangle, render_element_textured_poly} type : 3;
-		bool ignore_camera : 1;
-	};
+	render_state_sprite_t sprite;
+	u8 color;
+} render_state_sprite_silhouette_t;
+
+typedef struct [[gnu::packed]] {
+	char *string;
+	i16 x, y, length;
+} render_state_text_t;
+
+typedef struct [[gnu::packed]] {
+	i16 l, b, r, t;
+	u8 levels : 3; // Maximum value of 7
+} render_state_darkness_rectangle_t;
+
+typedef struct [[gnu::packed]] {
+	textured_poly_vertex_t *vertices;
+	const sprite_t *texture;
+	i16 x, y;
+	u8 vertex_count;
+} render_state_textured_poly_t;
+
+// Everything the depth sort and the draw loop read for an element. Its payload is entry index of the render state's pool for its type.
+typedef struct [[gnu::packed]] {
+	enum : u8 {render_element_sprite, render_element_shape, render_element_text, render_element_sprite_silhouette, render_element_darkness_rectangle, render_element_textured_poly, render_element_type_count} type : 3;
+	bool ignore_camera : 1;
 	i8 depth;
-	union {
-		render_state_sprite_t sprite;
-		render_shape_t shape;
-		struct [[gnu::packed]] {
-			char *string;
-			i16 x, y, length;
-		} text;
-		struct [[gnu::packed]] {
-			render_state_sprite_t sprite;
-			u8 color;
-		} sprite_silhouette;
-		struct [[gnu::packed]] {
-			i16 l, b, r, t;
-			u8 levels : 3; // Maximum value of 7
-		} darkness_rectangle;
-		struct [[gnu::packed]] {
-			textured_poly_vertex_t *vertices;
-			const sprite_t *texture;
-			i16 x, y;
-			u8 vertex_count;
-		} textured_poly;
-	};
-	#define RENDER_MAX_ELEMENTS 4096
+	u16 index;
 } render_state_element_t;
 
+// Elements beyond these are dropped. Lower them to shrink render_state_t (and the three render_data keeps) where the framework is embedded in tools.
+#ifndef RENDER_MAX_ELEMENTS
+#define RENDER_MAX_ELEMENTS 4096
+#endif
+#ifndef RENDER_MAX_SPRITES
+#define RENDER_MAX_SPRITES 2048
+#endif
+#ifndef RENDER_MAX_SPRITE_SILHOUETTES
+#define RENDER_MAX_SPRITE_SILHOUETTES 256
+#endif
+#ifndef RENDER_MAX_SHAPES
+#define RENDER_MAX_SHAPES 1024
+#endif
+#ifndef RENDER_MAX_TEXTS
+#define RENDER_MAX_TEXTS 256
+#endif
+#ifndef RENDER_MAX_DARKNESS_RECTANGLES
+#define RENDER_MAX_DARKNESS_RECTANGLES 256
+#endif
+#ifndef RENDER_MAX_TEXTURED_POLYS
+#define RENDER_MAX_TEXTURED_POLYS 256
+#endif
+
 typedef struct render_state_s {
-	volatile bool busy;
 	u64 state_count;
-	render_state_element_t elements[RENDER_MAX_ELEMENTS];
 	i32 element_count;
+	render_state_element_t elements[RENDER_MAX_ELEMENTS];
+	// Element payloads, one pool per type, filled in submission order
+	struct {
+		u16 count;
+		render_state_sprite_t array[RENDER_MAX_SPRITES];
+	} sprites;
+	struct {
+		u16 count;
+		render_state_sprite_silhouette_t array[RENDER_MAX_SPRITE_SILHOUETTES];
+	} sprite_silhouettes;
+	struct {
+		u16 count;
+		render_shape_t array[RENDER_MAX_SHAPES];
+	} shapes;
+	struct {
+		u16 count;
+		render_state_text_t array[RENDER_MAX_TEXTS];
+	} texts;
+	struct {
+		u16 count;
+		render_state_darkness_rectangle_t array[RENDER_MAX_DARKNESS_RECTANGLES];
+	} darkness_rectangles;
+	struct {
+		u16 count;
+		render_state_textured_poly_t array[RENDER_MAX_TEXTURED_POLYS];
+	} textured_polys;
 	#define RENDER_STATE_MEM_AMOUNT UINT16_MAX
 	struct {
 		u16 position;
 		char bytes[RENDER_STATE_MEM_AMOUNT];
 	} mem;
-	#define PARTICLES_MAX 4096
+	// Packed, so only particles on screen take up room. array points into the render particle storage, which has room for capacity per state (see Render_SetParticleStorage).
 	struct {
-		i16 count;
-		render_state_particle_t array[PARTICLES_MAX];
+		i32 count, capacity;
+		render_state_particle_t *array;
 	} particles;
 	struct {
 		int x, y;
@@ -176,6 +222,59 @@ typedef struct render_data_s {
 
 void *Render(void*);
 
+// Draws the background, elements and particles of render_state into destination - everything Render() does each frame except debug overlays, the cursor and presenting.
+void Render_DrawState (render_state_t *render_state, sprite_t *destination);
+
+// Number of threads Render_DrawState splits the frame between, in horizontal bands (default RENDER_THREADS, which defaults to 1). Output is identical for any count. Call from the thread that calls Render_DrawState.
+void Render_SetThreads (int count);
+
+// Opt-in cache of rotated sprites. With it enabled, each rotated Render_Sprite has its rotation rounded to 1/RENDER_ROTATION_CACHE_ANGLES of a turn (default 256). It is rasterized once per sprite, angle, origin, flip and color swap palette, and blitted from then on, so sprites redrawn at the same few angles every frame skip resampling. Off by default, since the rounding changes how rotated sprites look. Enable from any thread; it takes effect from the next frame. The counters are written by the render thread and only ever go up.
+typedef struct {
+	_Atomic bool enabled;
+	u64 hits, misses;
+	u64 skipped; // Too big for a cache slot, or every slot it could use was already used this frame
+} render_rotation_cache_t;
+extern render_rotation_cache_t render_rotation_cache;
+
+// Opt-in dirty rectangle mode: Render_DrawState redraws and Render uploads only the rows that changed since the last frame drawn into the same destination. Off by default; enable from any thread and it takes effect from the next frame.
+typedef struct {
+	_Atomic bool enabled;
+	u64 frames, full_frames; // Frames drawn in dirty rectangle mode, and how many of those were redrawn completely
+	u64 rows; // Rows redrawn, over all frames
+} render_dirty_rects_t;
+extern render_dirty_rects_t render_dirty_rects;
+
+#ifdef RENDER_DRAW_TIMING
+// Accumulated by Render_DrawState when RENDER_DRAW_TIMING is defined (see source/bench/render_bench.c). Reads the clock around every element, so leave it off in the game.
+typedef struct {
+	i64 nanoseconds, count;
+} render_draw_timing_entry_t;
+typedef struct {
+	render_draw_timing_entry_t background, sort, elements[render_element_type_count], particles;
+	render_draw_timing_entry_t bands; // All elements and particles. Per element type and particle times are only recorded when drawing on one thread.
+} render_draw_timing_t;
+extern render_draw_timing_t render_draw_timing;
+#endif
+
+// Render state capture file. The state is written with every pointer replaced by a 1-based index into the sprite and palette tables which follow it (or a 1-based offset into mem.bytes for text strings and poly vertices), so a capture can be replayed without the game's resources. Only valid for a build with the same render_state_t layout.
+#define RENDER_CAPTURE_VERSION 4
+typedef struct {
+	char magic[4]; // "KRSC"
+	u32 version;
+	u32 state_size;
+	u16 width, height;
+	u32 sprite_count, palette_count;
+	u32 size; // Size of the whole file in bytes
+	u32 reserved;
+} render_capture_header_t;
+static_assert (sizeof (render_capture_header_t) % 8 == 0);
+// Layout: header, render_state_t, sprite_t[sprite_count] (.p = byte offset from start of file), u8[palette_count][256], pixel data, render_state_particle_t[particles.count]
+
+// Writes a copy of the render state most recently taken by the render thread to filename, pausing the render thread briefly. Safe to call from any thread other than update and render.
+bool Render_CaptureWrite (const char *filename);
+// Fills state from a whole capture file loaded into capture (8 byte aligned). The capture's sprite table is fixed up in place and state points into it, so load each capture once and keep it alive as long as state is used.
+bool Render_CaptureRead (render_state_t *state, u8 *capture, size_t capture_size);
+
 void Render_SelectStateToEdit ();
 void Render_FinishEditingState ();
 
@@ -235,7 +334,14 @@ typedef typeof((render_state_t){}.background) Render_Background_arguments;
 #define Render_Background(...) Render_Background_ ((Render_Background_arguments){__VA_ARGS__})
 void Render_Background_ (Render_Background_arguments background);
 
+// Ignored if it's off screen or the state is out of room for particles
 void Render_Particle (int x, int y, u8 pixel, bool ignore_camera);
+// Each of the three render states has room for RENDER_PARTICLES_DEFAULT particles unless given storage (RENDER_PARTICLES_STORAGE_BYTES (per_state) bytes) to split between them, which must stay valid until replaced. NULL goes back to the built in storage. Call from the update thread. The states already published keep their old storage until the update thread has filled two more, so keep the old storage valid until then.
+#ifndef RENDER_PARTICLES_DEFAULT
+#define RENDER_PARTICLES_DEFAULT 4096
+#endif
+#define RENDER_PARTICLES_STORAGE_BYTES(__per_state__) (3 * (size_t)(__per_state__) * sizeof (render_state_particle_t))
+bool Render_SetParticleStorage (void *storage, size_t size);
 
 render_state_t *Render_GetCurrentEditableState ();
 
@@ -31,6 +31,7 @@ typedef struct {
 
 ADSR_t ADSRf_to_ADSR (ADSRf_t in);
 
+// The sound thread. Plays through the platform's audio output, or when the SOUND_BACKEND environment variable is set, through "null" (discards the output, taking as long as playing it would) or "wav:filename" (writes the output to a WAV file as it plays). Falls back to null if the audio output can't be opened, so the synth runs at its usual load either way.
 void *Sound(void*);
 
 typedef struct SoundFXPlay_args SoundFXPlay_args;
@@ -46,6 +47,9 @@ struct SoundFXPlay_args {
     i8 square_duty_cycle;
     i16 square_duty_cycle_sweep;
     const sound_t *next;
+    u8 priority;
+    u8 max_instances;
+    bool cache;
 };
 #define SoundFXPlay_args_default .frequency = 500, .volume = 1.0, .ADSR = {.peak = 1, .sustain = .75, .attack = .005, .decay = .002, .release = .005}
 void SoundFXPlay_ (SoundFXPlay_args args);
@@ -63,18 +67,84 @@ void SoundStopChannel (int channel);
 
 void SoundFXPrepare (const sound_t *sound);
 
+// Queues sound's chain to be rendered into the sound cache on the sound thread, so plays of it mix cached samples instead of synthesizing. Chains which loop or use noise aren't cached.
+void SoundFXCache (const sound_t *sound);
+
+typedef struct {
+    u32 sounds, samples; // Cached so far
+    u32 hits; // Plays mixed from the cache
+    u32 rejected; // Sounds which didn't fit in the cache
+} sound_cache_stats_t;
+sound_cache_stats_t SoundFXCacheStats ();
+
 void SoundMusicPlay (const sound_music_t *music);
 
 void SoundMusicStop ();
 void SoundMusicResume ();
 void SoundMusicSetVolume (f32 volume_0_to_1);
 f32 SoundMusicGetVolume ();
+// Renders music channels on this many worker threads, up to SOUND_MUSIC_WORKERS_MAX, alongside the sound thread. 0, the default, renders them all on the sound thread; the output is the same either way.
+void SoundMusicSetWorkers (int workers);
 void SoundFXStop ();
 void SoundFXSetVolume (f32 volume_0_to_1);
 f32 SoundFXGetVolume ();
 
+// Which sound effect gives up its channel when a new one starts and every FX channel is busy. Only sounds with priority lower than or equal to the new sound's are considered, and of those the lowest priority ones. None means the new sound isn't played.
+typedef enum {sound_steal_oldest, sound_steal_quietest, sound_steal_none} sound_steal_policy_e;
+void SoundFXSetStealPolicy (sound_steal_policy_e policy);
+
+// Sound effect channel use since startup. Safe to call from any thread.
+typedef struct {
+    u32 voices; // FX channels playing at the end of the last buffer
+    u32 most_voices;
+    u32 steals; // Sounds cut off to make room for a higher or equal priority sound
+    u32 replaced; // Sounds cut off because another copy started while at max_instances
+    u32 dropped; // Sounds not played because every channel was busy with higher priority sounds
+} sound_voice_stats_t;
+sound_voice_stats_t SoundVoiceStats ();
+
 void SoundStopAll ();
 
+// Counts of commands sent to the sound thread (everything except volume changes) since startup. Commands are dropped when SOUND_COMMAND_QUEUE_SIZE are already waiting for the sound thread. Call from the thread which plays sounds.
+typedef struct {
+    u32 sent, dropped;
+    u32 most_pending; // Most commands waiting at once
+} sound_command_stats_t;
+sound_command_stats_t SoundCommandStats ();
+
+#define SOUND_OUTPUT_PERIOD_SAMPLES_MIN 48 // 1ms
+// How the platform's audio output is buffered, where the framework chooses it (currently Linux). The sound thread generates period_samples at a time and the audio server holds up to buffer_periods of them, so latency is about period_samples * buffer_periods / SAMPLING_RATE seconds.
+typedef struct {
+    u16 period_samples; // SOUND_OUTPUT_PERIOD_SAMPLES_MIN to SAMPLE_BUFFER_SIZE_MAX. Default 240 (5ms)
+    u8 buffer_periods; // Default 2
+    u8 prebuffer_periods; // Queued before playback starts or restarts after an underrun. Default 1
+    // Adds a period to the buffer after an underrun and removes one after SOUND_OUTPUT_SHRINK_SECONDS without any, staying within buffer_periods_min and buffer_periods_max
+    bool adaptive;
+    u8 buffer_periods_min, buffer_periods_max; // Default 2 and 16
+} sound_output_config_t;
+// Applied by the sound thread before its next period. Zero fields take their defaults, so a config only needs the fields it changes. Changes restart the output stream, which is audible as a short gap, so set it once at startup or from an options menu.
+void SoundOutputConfigure (sound_output_config_t config);
+sound_output_config_t SoundOutputGetConfig ();
+
+// Measured by the platform's audio output. All zero on platforms which don't report them. Safe to call from any thread.
+typedef struct {
+    u32 latency_us; // Time from the sound thread writing a sample to it being played, as last measured
+    u32 underruns; // Times the output ran dry since startup
+    u16 period_samples;
+    u8 buffer_periods; // Current depth, which changes in adaptive mode
+    u32 refill_us; // How long the synth took to make the last period, on platforms which use sound_backend_t (currently Linux)
+} sound_output_stats_t;
+sound_output_stats_t SoundOutputStats ();
+
+// Synth timing since startup. Safe to call from any thread.
+typedef struct {
+    u32 refills;
+    u32 deadline_misses; // Refills which took longer than the samples they made take to play
+    u32 worst_us; // Longest refill
+    u32 worker_channels; // Music channels rendered by worker threads rather than the sound thread
+} sound_synth_stats_t;
+sound_synth_stats_t SoundSynthStats ();
+
 typedef struct {
     bool quit;
     bool prepared_sounds_ready;
@@ -5,7 +5,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "turns_math.h"
+#include "discrete_random.h"
+#include "osinterface.h"
 
 #define MUSIC_CHANNELS_FIRST 0
 #define MUSIC_CHANNELS 10
@@ -14,26 +18,27 @@
 #define FX_CHANNELS 10
 #define FX_CHANNELS_LAST (MUSIC_CHANNELS + FX_CHANNELS - 1)
 #define SOUND_CHANNELS (MUSIC_CHANNELS + FX_CHANNELS)
+#define CACHE_CHANNEL SOUND_CHANNELS // Extra channel which renders sounds into the cache
 
 sound_extern_t sound_extern_data;
 
 typedef struct {
     sound_t sound;
-    u8 ADSR_state;
     u32 t;
-    f32 d; // Wave position where 0 = start, 1 = full period. Not reset to 0 when sound channels change, in order to transition between waves smoothly. This value is like degrees or radians, but measures turns.
-	f32 vibrato_d; // Same as d, but for vibrato
+    u32 phase; // Wave position in turns as 0.32 fixed point, so it wraps around at the end of each period on its own. Not reset to 0 when sound channels change, in order to transition between waves smoothly.
+	u32 vibrato_phase; // Same as phase, but for vibrato
     union {
         struct {
             i16 current_duty_cycle;
         } pulse;
     } u;
+    const f32 *cached; // The rest of the chain from the sound cache, or NULL to synthesize it
 } sound_channel_t;
 
 typedef enum {music_state_pause, music_state_playing} music_state_e;
 
 typedef struct {
-    sound_channel_t channels[SOUND_CHANNELS];
+    sound_channel_t channels[SOUND_CHANNELS + 1];
     struct {
         f32 volume;
     } fx;
@@ -56,70 +61,174 @@ static sound_internal_t sound = {
     },
 };
 
-typedef enum { sound_command_fx_stop, sound_command_fx_play, sound_command_fx_prepare, sound_command_fx_play_prepared, sound_command_fx_volume_set, sound_command_music_new, sound_command_music_pause, sound_command_music_resume, sound_command_music_volume_set } sound_command_e;
+typedef enum { sound_command_fx_stop, sound_command_fx_play, sound_command_fx_prepare, sound_command_fx_play_prepared, sound_command_fx_cache, sound_command_music_new, sound_command_music_pause, sound_command_music_resume } sound_command_e;
 
+typedef struct {
+    sound_command_e type;
+    union {
+        struct {
+            sound_t sound;
+        } fx_play;
+        struct {
+            const sound_t *sound;
+        } fx_prepare, fx_cache;
+        struct {
+            const sound_music_t *music;
+        } music_new;
+    } data;
+} sound_command_t;
+
+// Commands go from the update thread to the sound thread through a single producer, single consumer ring. Each side only writes its own index, publishing it with release after it's done with the command, and reads the other side's with acquire, so a command is always completely written before the sound thread reads it and completely read before its slot is reused. When the ring is full new commands are dropped and counted, rather than overwriting ones the sound thread hasn't run yet.
+// Volume changes don't need to be in order with other commands, so instead of queueing they're stored directly and the sound thread picks up only the latest.
+#ifndef SOUND_COMMAND_QUEUE_SIZE
+#define SOUND_COMMAND_QUEUE_SIZE 256
+#endif
+static_assert ((SOUND_COMMAND_QUEUE_SIZE & (SOUND_COMMAND_QUEUE_SIZE - 1)) == 0, "SOUND_COMMAND_QUEUE_SIZE must be a power of 2");
 static struct {
-    u8 executed, filled; // when filled < executed, execute until overflow, then check again.
-    // SIZE must be 256 so the overflow logic works
-    #define COMMAND_BUFFER_SIZE 256
-    struct {
-        sound_command_e type;
-        union {
-            struct {
-                sound_t sound;
-            } fx_play;
-            struct {
-                const sound_t *sound;
-            } fx_prepare;
-            struct {
-                f32 volume;
-            } fx_volume_set;
-            struct {
-                const sound_music_t *music;
-            } music_new;
-            struct {
-                f32 volume;
-            } music_volume_set;
-        } data;
-    } commands[COMMAND_BUFFER_SIZE];
-} command_buffer;
-
-#define SoundAddCommand(...) _SoundAddCommand ((typeof(command_buffer.commands[0])){__VA_ARGS__})
-static void _SoundAddCommand (typeof(command_buffer.commands[0]) command) {
-    int i = command_buffer.filled % COMMAND_BUFFER_SIZE;
-    command_buffer.commands[i] = command;
-    ++command_buffer.filled;
-}
-
-static inline int SelectFXChannel () {
-    for (int i = FX_CHANNELS_FIRST; i <= FX_CHANNELS_LAST; ++i) {
-        if (sound.channels[i].sound.waveform == sound_waveform_none) {
-            return i;
+    alignas (64) _Atomic u32 written; // Written by the producer
+    alignas (64) _Atomic u32 read; // Written by the consumer
+    alignas (64) sound_command_stats_t stats; // Written by the producer
+    sound_command_t commands[SOUND_COMMAND_QUEUE_SIZE];
+} command_queue;
+static _Atomic f32 volume_fx_requested = 1, volume_music_requested = 1;
+
+#define SoundAddCommand(...) SoundAddCommand_ ((sound_command_t){__VA_ARGS__})
+static bool SoundAddCommand_ (sound_command_t command) {
+    const u32 written = atomic_load_explicit (&command_queue.written, memory_order_relaxed);
+    const u32 pending = written - atomic_load_explicit (&command_queue.read, memory_order_acquire);
+    if (pending >= SOUND_COMMAND_QUEUE_SIZE) {
+        if (command_queue.stats.dropped++ == 0) LOG ("Sound command queue is full. Dropping commands until the sound thread catches up");
+        return false;
+    }
+    command_queue.commands[written % SOUND_COMMAND_QUEUE_SIZE] = command;
+    atomic_store_explicit (&command_queue.written, written + 1, memory_order_release);
+    ++command_queue.stats.sent;
+    if (pending + 1 > command_queue.stats.most_pending) command_queue.stats.most_pending = pending + 1;
+    return true;
+}
+
+// Takes the oldest command off the queue. Returns false if there are none. Sound thread only.
+static bool SoundTakeCommand (sound_command_t *command) {
+    const u32 read = atomic_load_explicit (&command_queue.read, memory_order_relaxed);
+    if (read == atomic_load_explicit (&command_queue.written, memory_order_acquire)) return false;
+    *command = command_queue.commands[read % SOUND_COMMAND_QUEUE_SIZE];
+    atomic_store_explicit (&command_queue.read, read + 1, memory_order_release);
+    return true;
+}
+
+sound_command_stats_t SoundCommandStats () { return command_queue.stats; }
+
+// ADSR envelope level at time t of source
+static f32 ADSREnvelope (const sound_t *source, i32 t) {
+    const auto ADSR = source->ADSR;
+    if (t < ADSR.attack) return (f32)t / ADSR.attack * ADSR.peak;
+    if (t < ADSR.attack + ADSR.decay) {
+        f32 ratio = (f32)(t - ADSR.attack) / ADSR.decay;
+        return (1 - ratio) * ADSR.peak + ratio * ADSR.sustain;
+    }
+    if (t <= (i32)source->duration - ADSR.release) return ADSR.sustain;
+    i32 r = t + (ADSR.release - (i32)source->duration);
+    return r <= 0 ? 0 : (1.f - (f32)r / ADSR.release) * ADSR.sustain;
+}
+
+// What an FX channel is playing as a whole. Kept apart from sound_channel_t since that's reset for each sound in a chain.
+static struct {
+    sound_t first; // The sound which was played, for matching copies of it
+    u64 started; // Value of samples_played when it started
+} fx_voices[SOUND_CHANNELS];
+static u64 samples_played;
+static _Atomic sound_steal_policy_e steal_policy_requested = sound_steal_oldest;
+static struct {
+    _Atomic u32 voices, most_voices, steals, replaced, dropped;
+} voice_stats;
+
+void SoundFXSetStealPolicy (sound_steal_policy_e policy) { atomic_store_explicit (&steal_policy_requested, policy, memory_order_relaxed); }
+
+sound_voice_stats_t SoundVoiceStats () {
+    return (sound_voice_stats_t){
+        .voices = atomic_load_explicit (&voice_stats.voices, memory_order_relaxed),
+        .most_voices = atomic_load_explicit (&voice_stats.most_voices, memory_order_relaxed),
+        .steals = atomic_load_explicit (&voice_stats.steals, memory_order_relaxed),
+        .replaced = atomic_load_explicit (&voice_stats.replaced, memory_order_relaxed),
+        .dropped = atomic_load_explicit (&voice_stats.dropped, memory_order_relaxed),
+    };
+}
+
+static inline bool SoundsAreCopies (const sound_t *a, const sound_t *b) {
+    return a->waveform == b->waveform && a->frequency == b->frequency && a->duration == b->duration && a->next == b->next;
+}
+
+// Returns the cached samples of first's chain, or NULL if it isn't fully rendered yet. If render is set and it isn't cached, it's queued for FXCacheRender.
+static const f32 *FXCacheFind (const sound_t *first, bool render);
+
+// Picks the FX channel a new sound should play on, stopping whatever was there, and records the new voice. Returns -1 if the sound shouldn't play.
+static int SelectFXChannel (const sound_t *new_sound) {
+    int selected = -1;
+    if (new_sound->max_instances) {
+        // At the limit, replace the oldest copy
+        int copies = 0, oldest = -1;
+        for (int i = FX_CHANNELS_FIRST; i <= FX_CHANNELS_LAST; ++i) {
+            const auto waveform = sound.channels[i].sound.waveform;
+            if (waveform == sound_waveform_none || waveform == sound_waveform_preparing || !SoundsAreCopies (&fx_voices[i].first, new_sound)) continue;
+            ++copies;
+            if (oldest == -1 || fx_voices[i].started < fx_voices[oldest].started) oldest = i;
+        }
+        if (copies >= new_sound->max_instances) {
+            selected = oldest;
+            atomic_fetch_add_explicit (&voice_stats.replaced, 1, memory_order_relaxed);
+        }
+    }
+    for (int i = FX_CHANNELS_FIRST; i <= FX_CHANNELS_LAST && selected == -1; ++i) {
+        if (sound.channels[i].sound.waveform == sound_waveform_none) selected = i;
+    }
+    const auto policy = atomic_load_explicit (&steal_policy_requested, memory_order_relaxed);
+    if (selected == -1 && policy != sound_steal_none) {
+        // Lowest priority first, then the oldest or quietest
+        u8 lowest = 0;
+        f32 best = 0;
+        for (int i = FX_CHANNELS_FIRST; i <= FX_CHANNELS_LAST; ++i) {
+            const auto channel = &sound.channels[i];
+            const u8 priority = fx_voices[i].first.priority;
+            if (channel->sound.waveform == sound_waveform_preparing || priority > new_sound->priority) continue;
+            f32 score;
+            if (policy == sound_steal_oldest) score = samples_played - fx_voices[i].started;
+            else score = channel->sound.waveform == sound_waveform_silence ? 0 : -absf (ADSREnvelope (&channel->sound, channel->t));
+            if (selected == -1 || priority < lowest || (priority == lowest && score > best)) {
+                selected = i;
+                lowest = priority;
+                best = score;
+            }
         }
+        if (selected != -1) atomic_fetch_add_explicit (&voice_stats.steals, 1, memory_order_relaxed);
     }
-    return -1;
+    if (selected == -1) {
+        atomic_fetch_add_explicit (&voice_stats.dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+    fx_voices[selected].first = *new_sound;
+    fx_voices[selected].started = samples_played;
+    return selected;
 }
 
 static inline void SoundExecuteCommands () {
-    u8 filled = command_buffer.filled; // Latch this value since other threads could be modifying it while we work through commands
-    u8 count = filled - command_buffer.executed;
-    if (filled < command_buffer.executed) { // Filled has looped around so we need to execute the remaining commands
-        count = COMMAND_BUFFER_SIZE - command_buffer.executed + filled;
-    }
-    while (count--) {
-        typeof(command_buffer.commands[0]) c = command_buffer.commands[command_buffer.executed++];
+    sound.fx.volume = atomic_load_explicit (&volume_fx_requested, memory_order_relaxed);
+    sound.music.volume = atomic_load_explicit (&volume_music_requested, memory_order_relaxed);
+    sound_command_t c;
+    // At most a ring's worth per buffer, so a steady flood of commands can't keep the sound thread from filling it
+    repeat (SOUND_COMMAND_QUEUE_SIZE) {
+        if (!SoundTakeCommand (&c)) break;
         switch (c.type) {
             case sound_command_fx_stop: {
                 for (int i = FX_CHANNELS_FIRST; i <= FX_CHANNELS_LAST; ++i)
                     sound.channels[i].sound.waveform = sound_waveform_none;
             } break;
             case sound_command_fx_play: {
-                int selected_channel = SelectFXChannel ();
+                int selected_channel = SelectFXChannel (&c.data.fx_play.sound);
                 if (selected_channel == -1) break;
-                sound.channels[selected_channel] = (typeof(sound.channels[selected_channel])){ .sound = c.data.fx_play.sound };
+                sound.channels[selected_channel] = (typeof(sound.channels[selected_channel])){ .sound = c.data.fx_play.sound, .cached = FXCacheFind (&c.data.fx_play.sound, c.data.fx_play.sound.cache) };
             } break;
             case sound_command_fx_prepare: {
-                int selected_channel = SelectFXChannel ();
+                int selected_channel = SelectFXChannel (c.data.fx_prepare.sound);
                 if (selected_channel == -1) break;
                 memset (&sound.channels[selected_channel], 0, sizeof (sound.channels[selected_channel]));
                 sound.channels[selected_channel].sound.waveform = sound_waveform_preparing;
@@ -129,10 +238,8 @@ static inline void SoundExecuteCommands () {
             case sound_command_fx_play_prepared: {
                 sound_extern_data.prepared_sounds_ready = true;
             } break;
-            case sound_command_fx_volume_set: {
-                assert (c.data.fx_volume_set.volume >= 0);
-                assert (c.data.fx_volume_set.volume <= 1);
-                sound.fx.volume = c.data.fx_volume_set.volume;
+            case sound_command_fx_cache: {
+                FXCacheFind (c.data.fx_cache.sound, true);
             } break;
             case sound_command_music_new: {
                 sound.music.state = music_state_playing;
@@ -150,9 +257,6 @@ static inline void SoundExecuteCommands () {
             case sound_command_music_resume: {
                 sound.music.state = music_state_playing;
             } break;
-            case sound_command_music_volume_set: {
-                sound.music.volume = c.data.music_volume_set.volume;
-            } break;
         }
     }
 }
@@ -167,9 +271,9 @@ void SoundMusicResume () {
 void SoundMusicSetVolume (f32 volume_0_to_1) {
     if (volume_0_to_1 < 0) volume_0_to_1 = 0;
     if (volume_0_to_1 > 1) volume_0_to_1 = 1;
-    SoundAddCommand (.type = sound_command_music_volume_set, .data.music_volume_set.volume = volume_0_to_1);
+    atomic_store_explicit (&volume_music_requested, volume_0_to_1, memory_order_relaxed);
 }
-f32 SoundMusicGetVolume () { return sound.music.volume; }
+f32 SoundMusicGetVolume () { return atomic_load_explicit (&volume_music_requested, memory_order_relaxed); }
 
 void SoundFXStop () {
     SoundAddCommand (.type = sound_command_fx_stop);
@@ -177,9 +281,61 @@ void SoundFXStop () {
 void SoundFXSetVolume (f32 volume_0_to_1) {
     if (volume_0_to_1 < 0) volume_0_to_1 = 0;
     if (volume_0_to_1 > 1) volume_0_to_1 = 1;
-    SoundAddCommand (.type = sound_command_fx_volume_set, .data.fx_volume_set.volume = volume_0_to_1);
+    atomic_store_explicit (&volume_fx_requested, volume_0_to_1, memory_order_relaxed);
+}
+f32 SoundFXGetVolume () { return atomic_load_explicit (&volume_fx_requested, memory_order_relaxed); }
+
+static constexpr sound_output_config_t output_config_default = {
+    .period_samples = SAMPLING_RATE / 200,
+    .buffer_periods = 2,
+    .prebuffer_periods = 1,
+    .buffer_periods_min = 2,
+    .buffer_periods_max = 16,
+};
+static _Atomic sound_output_config_t output_config = output_config_default;
+static _Atomic u32 output_config_generation = 1;
+
+void SoundOutputConfigure (sound_output_config_t config) {
+    if (config.period_samples == 0) config.period_samples = output_config_default.period_samples;
+    if (config.buffer_periods == 0) config.buffer_periods = output_config_default.buffer_periods;
+    if (config.prebuffer_periods == 0) config.prebuffer_periods = output_config_default.prebuffer_periods;
+    if (config.buffer_periods_min == 0) config.buffer_periods_min = output_config_default.buffer_periods_min;
+    if (config.buffer_periods_max == 0) config.buffer_periods_max = output_config_default.buffer_periods_max;
+    atomic_store_explicit (&output_config, config, memory_order_relaxed);
+    atomic_fetch_add_explicit (&output_config_generation, 1, memory_order_release);
+}
+sound_output_config_t SoundOutputGetConfig () { return atomic_load_explicit (&output_config, memory_order_relaxed); }
+
+bool SoundOutputConfigChanged (sound_output_config_t *config, u32 *generation) {
+    const auto latest = atomic_load_explicit (&output_config_generation, memory_order_acquire);
+    if (latest == *generation) return false;
+    *generation = latest;
+    *config = atomic_load_explicit (&output_config, memory_order_relaxed);
+    return true;
+}
+
+static struct {
+    _Atomic u32 latency_us, underruns, refill_us;
+    _Atomic u16 period_samples;
+    _Atomic u8 buffer_periods;
+} output_stats;
+
+void SoundOutputReport (u32 latency_us, bool underrun, u16 period_samples, u8 buffer_periods) {
+    atomic_store_explicit (&output_stats.latency_us, latency_us, memory_order_relaxed);
+    if (underrun) atomic_fetch_add_explicit (&output_stats.underruns, 1, memory_order_relaxed);
+    atomic_store_explicit (&output_stats.period_samples, period_samples, memory_order_relaxed);
+    atomic_store_explicit (&output_stats.buffer_periods, buffer_periods, memory_order_relaxed);
+}
+
+sound_output_stats_t SoundOutputStats () {
+    return (sound_output_stats_t){
+        .latency_us = atomic_load_explicit (&output_stats.latency_us, memory_order_relaxed),
+        .underruns = atomic_load_explicit (&output_stats.underruns, memory_order_relaxed),
+        .period_samples = atomic_load_explicit (&output_stats.period_samples, memory_order_relaxed),
+        .buffer_periods = atomic_load_explicit (&output_stats.buffer_periods, memory_order_relaxed),
+        .refill_us = atomic_load_explicit (&output_stats.refill_us, memory_order_relaxed),
+    };
 }
-f32 SoundFXGetVolume () { return sound.fx.volume; }
 
 #ifdef __linux__
 #define PERIOD_SIZE (SAMPLING_RATE / 200)
@@ -191,9 +347,9 @@ f32 SoundFXGetVolume () { return sound.fx.volume; }
 
 // Two 5ms buffers
 // SAMPLE_BUFFER_SIZE_MAX is the maximum size allowed. On Linux we only use 240 (5ms). Windows must be discovered at runtime, seems to usually be 256. Mac lets us set it to 240 but can reset itself.
-// Currently one buffer holds 5ms uncompressed samples, the next buffer holds 5ms compressed. When the audio system requests samples, we copy over the compressed ones, compress the uncompressed and generate 5ms of new samples. If there are problems with variable chunk sizes in future, we could just generate some max amount of samples (10ms or so?) then compress the amount requested and refill exactly that amount. Just have to track the chunk sizes to lerp compression value correctly.
+// Each RefillSampleBuffer swaps buffers and fills the new one with sample_buffer_size samples, ready to play, so the platform can still be playing the other. The limiter works sample by sample, so sizes can change from call to call.
 sample_buffer_t sample_buffer[2] = {};
-bool sample_buffer_swap = 0; // Use this to index the buffer which is compressed and ready for playback.
+bool sample_buffer_swap = 0; // Use this to index the buffer which is ready for playback.
 i16 sample_buffer_size = 0;
 
 ADSR_t ADSRf_to_ADSR (ADSRf_t in) { return (ADSR_t){.peak = in.peak, .attack = in.attack * SAMPLING_RATE, .decay = in.decay * SAMPLING_RATE, .sustain = in.sustain, .release = in.release * SAMPLING_RATE}; }
@@ -215,6 +371,9 @@ sound_t SoundGenerate_(SoundFXPlay_args args) {
         .vibrato = args.vibrato,
         .square_duty_cycle = args.square_duty_cycle,
         .square_duty_cycle_sweep = args.square_duty_cycle_sweep,
+        .priority = args.priority,
+        .max_instances = args.max_instances,
+        .cache = args.cache,
     };
     // if (sound.waveform == sound_waveform_pulse) {
     //     if (sound.vibrato.frequency_range < sound.frequency * .005f) sound.vibrato.frequency_range = sound.frequency * .005f;
@@ -252,6 +411,10 @@ u32 SoundFXPlayGroup (const sound_group_t *group) {
 
 void SoundFXPlayPrepared () {SoundAddCommand (.type = sound_command_fx_play_prepared);}
 
+void SoundFXCache (const sound_t *sound) {
+    SoundAddCommand (.type = sound_command_fx_cache, .data.fx_cache.sound = sound);
+}
+
 void SoundMusicPlay (const sound_music_t *new_music) {
     assert (new_music->count <= MUSIC_CHANNELS);
     SoundAddCommand (.type = sound_command_music_new, .data.music_new.music = new_music);
@@ -266,185 +429,609 @@ void SoundStopAll () {
 }
 
 static inline f32 CosineInterpolate (f32 d) { return (1.f - cos_turns(d/2)) / 2.f; }
-static inline i16 Lerpi16 (i16 from, i16 to, f32 ratio) { return (1-ratio)*from + to*ratio;}
+// The synth renders a whole buffer one channel at a time rather than one sample at a time across all channels. Each run of samples goes through three passes: phase (serial, since every sample's phase depends on the last), oscillator and envelope. The last two have no dependencies between samples and no per-sample switches, so the compiler can vectorize them. Channels are summed into a music and an FX bus in channel order, so the mix is the same as summing sample by sample.
+// Working space for the passes. Each thread rendering channels has its own.
+typedef struct {
+    u32 phase[SAMPLE_BUFFER_SIZE_MAX];
+    i32 increment[SAMPLE_BUFFER_SIZE_MAX]; // Phase change per sample, saturated to the range of i32
+    f32 wave[SAMPLE_BUFFER_SIZE_MAX];
+} synth_scratch_t;
+static struct {
+    synth_scratch_t scratch; // The sound thread's
+    f32 music[SAMPLE_BUFFER_SIZE_MAX];
+    f32 fx[SAMPLE_BUFFER_SIZE_MAX];
+} synth;
 
-static inline f32 PolyBLEP (f32 t, f32 frequency) {
-    f32 dt = frequency / SAMPLING_RATE;
-    if (t < dt) {
-        t /= dt;
-        return t + t - t*t - 1;
+// Noise is a random value held for a period, drawn from each channel's own generator so the sequence doesn't depend on which other channels are playing.
+static struct {
+    u64 random_state;
+    f32 value;
+} noise_channels[SOUND_CHANNELS + 1];
+
+// Oscillators read one period of their waveform from a table, interpolating between entries. Saw and triangle have a table per octave, each built from only the harmonics which stay below the Nyquist frequency for the notes which use it, so high notes don't alias. Pulse is the difference of two saws. Octave n is used by phase increments below 1 << (WAVETABLE_OCTAVE_0_BITS + n) and has 1 << (WAVETABLE_OCTAVES - 1 - n) harmonics, about 47Hz * 2^n and up.
+#define WAVETABLE_BITS 11
+#define WAVETABLE_SIZE (1 << WAVETABLE_BITS)
+#define WAVETABLE_OCTAVES 10
+#define WAVETABLE_OCTAVE_0_BITS (31 - (WAVETABLE_OCTAVES - 1))
+static struct {
+    bool initialized;
+    // One extra entry repeating the first, so interpolation never wraps
+    f32 sine[WAVETABLE_SIZE + 1];
+    f32 saw[WAVETABLE_OCTAVES][WAVETABLE_SIZE + 1];
+    f32 triangle[WAVETABLE_OCTAVES][WAVETABLE_SIZE + 1];
+} wavetables;
+
+static void SynthInitialize () {
+    for (int i = 0; i < WAVETABLE_SIZE; ++i) wavetables.sine[i] = sin_turns ((f32)i / WAVETABLE_SIZE);
+    for (int octave = 0; octave < WAVETABLE_OCTAVES; ++octave) {
+        const int harmonics = 1 << (WAVETABLE_OCTAVES - 1 - octave);
+        for (int i = 0; i < WAVETABLE_SIZE; ++i) {
+            // Fourier series of a saw rising from -1 to 1 and a triangle starting at -1
+            f32 saw = 0, triangle = 0;
+            for (int h = 1; h <= harmonics; ++h) {
+                saw += wavetables.sine[(h * i) % WAVETABLE_SIZE] / h;
+                if (h % 2) triangle += wavetables.sine[(h * i + WAVETABLE_SIZE / 4) % WAVETABLE_SIZE] / (h * h);
+            }
+            wavetables.saw[octave][i] = saw * (-2 / 3.14159265f);
+            wavetables.triangle[octave][i] = triangle * (-8 / (3.14159265f * 3.14159265f));
+        }
+        wavetables.saw[octave][WAVETABLE_SIZE] = wavetables.saw[octave][0];
+        wavetables.triangle[octave][WAVETABLE_SIZE] = wavetables.triangle[octave][0];
     }
-    else if (t > 1 - dt) {
-        t = (t - 1) / dt;
-        return t*t +t + t + 1;
+    wavetables.sine[WAVETABLE_SIZE] = wavetables.sine[0];
+    for (int c = 0; c < SOUND_CHANNELS; ++c) {
+        noise_channels[c].random_state = c;
+        DiscreteRandom_Seed (&noise_channels[c].random_state);
     }
-    else return 0;
-}
-
-static inline f32 CreateNextSample () {
-    static f32 noise_channels[SOUND_CHANNELS];
-    f32 value_music = 0;
-    f32 value_fx = 0;
-    f32 *value = &value_music;
-    for (int c = (sound.music.state != music_state_playing ? FX_CHANNELS_FIRST : MUSIC_CHANNELS_FIRST); c < SOUND_CHANNELS; ++c) {
-        if (c > MUSIC_CHANNELS_LAST) value = &value_fx;
-        auto channel = &sound.channels[c];
-        auto sound = &channel->sound;
-        f32 sample = 0;
-        f32 envelope = 1;
-        if (!(sound->waveform == sound_waveform_none || sound->waveform == sound_waveform_preparing)) {
-            channel->t++;
-            if (sound->waveform != sound_waveform_silence) {
-                i16 freq = Lerpi16(sound->frequency, sound->frequency + sound->sweep, (f32)channel->t / sound->duration);
-                if (sound->vibrato.vibrations_per_hundred_seconds) {
-                    auto vibrato_range = sound->vibrato.frequency_range;
-                    i16 vibrato = sin_turns (channel->vibrato_d) * vibrato_range;
-                    freq += vibrato;
-                    channel->vibrato_d += sound->vibrato.vibrations_per_hundred_seconds / (f32)(SAMPLING_RATE * 100);
-                }
-                // At this point, due to sweep and vibrato, freq may be negative. Turns out that's totally fine and allows for some nice effects!
-                int prevd = channel->d;
-                f32 d_change = (f32)freq / SAMPLING_RATE;
-                channel->d += d_change;
-                switch (sound->waveform) {
-                    case sound_waveform_sine: sample = sin_turns (channel->d); break;
-                    case sound_waveform_triangle: {
-                        f32 a = (channel->d - (int)channel->d);
-                        if (a > .5) a = 1 - a;
-                        sample = a * 4 - 1;
-                    } break;
-                    case sound_waveform_saw: {
-                        sample = (channel->d - (int)channel->d) * 2 - 1;
-                        sample -= PolyBLEP (channel->d - (int)channel->d, freq);
-                    } break;
-                    case sound_waveform_pulse: {
-                        f32 pos = channel->d - (int)channel->d;
-                        // Duty cycle 0 = 50%. 127 = 98%, -128 = 99%
-                        // Duty cycle as int8, loops with overflow. Convert to f32. Divide by 129 means computed duty cycle is never 0 (avoid pop when temporarily hitting 0) and 127 == -127 for perfect looping through -128
-                        i8 duty_cycle1 = (sound->square_duty_cycle + (i32)channel->t * sound->square_duty_cycle_sweep / (i32)sound->duration);
-                        f32 duty_cycle = absf(duty_cycle1) / 257.f + .5f;
-                        // if (duty_cycle < 0.5) duty_cycle = 1 - duty_cycle;
-                        assert (duty_cycle >= 0.5 && duty_cycle < 1);
-                        // sample = -2 * duty_cycle;
-                        // if (pos < duty_cycle) sample += 2;
-                        sample = pos >= duty_cycle ? -1 : 1;
-                        const auto BLEP0 = PolyBLEP (pos, freq);
-                        sample += BLEP0;
-                        f32 pos2 = pos + 1 - duty_cycle;
-                        pos2 -= (int)pos2;
-                        const auto BLEP1 = PolyBLEP (pos2, freq);
-                        sample -= BLEP1;
-                    } break;
-                    case sound_waveform_noise: {
-                        channel->d += 3 * d_change;
-                        if (prevd != (int)channel->d) {
-                            noise_channels[c] = rand() / (f32)RAND_MAX * 2 - 1;
-                        }
-                        sample = noise_channels[c];
-                    } break;
-                    case sound_waveform_none: case sound_waveform_preparing: case sound_waveform_silence: unreachable(); break;
-                }
-                // assert (sample >=-1 && sample <= 1);
-                
-                envelope = 1;
-                switch (channel->ADSR_state) {
-                    case 0: {
-                        if (channel->t < sound->ADSR.attack) {
-                            envelope = (f32)channel->t / sound->ADSR.attack * sound->ADSR.peak;
-                            break;
-                        }
-                        channel->ADSR_state = 1;
-                    }
-                    case 1: {
-                        i32 t = channel->t - sound->ADSR.attack;
-                        if (t < sound->ADSR.decay) {
-                            f32 ratio = (f32)t / sound->ADSR.decay;
-                            envelope = (1 - ratio) * sound->ADSR.peak + ratio * sound->ADSR.sustain;
-                            break;
-                        }
-                        channel->ADSR_state = 2;
-                    }
-                    case 2: {
-                        i32 t = sound->duration - channel->t;
-                        if (t >= sound->ADSR.release) {
-                            envelope = sound->ADSR.sustain;
-                            break;
-                        }
-                        channel->ADSR_state = 3;
-                    }
-                    case 3: {
-                        i32 t = channel->t + (sound->ADSR.release - sound->duration);
-                        if (t <= 0) envelope = 0;
-                        else envelope = (1.f - (f32)t / sound->ADSR.release) * sound->ADSR.sustain;
-                        break;
-                    }
-                }
-                sample *= envelope;
-                // assert (sample >=-1 && sample <= 1);
-                *value += sample;
+    wavetables.initialized = true;
+}
+
+static inline f32 WavetableSample (const f32 *table, u32 phase) {
+    const u32 index = phase >> (32 - WAVETABLE_BITS);
+    const f32 fraction = (u32)(phase << WAVETABLE_BITS) * 0x1p-32f;
+    return table[index] + (table[index + 1] - table[index]) * fraction;
+}
+
+static inline int WavetableOctave (i32 increment) {
+    const u32 magnitude = increment < 0 ? -(u32)increment : (u32)increment;
+    const int octave = (32 - __builtin_clz (magnitude | 1)) - WAVETABLE_OCTAVE_0_BITS;
+    return octave < 0 ? 0 : octave >= WAVETABLE_OCTAVES ? WAVETABLE_OCTAVES - 1 : octave;
+}
+
+// Advances channel c's phase through count samples, storing each sample's phase and phase increment. Noise is generated here since it changes value when the phase crosses a whole turn.
+static void SynthPhase (synth_scratch_t *scratch, int c, int count) {
+    auto channel = &sound.channels[c];
+    const auto source = &channel->sound;
+    // Frequency as 16.16 fixed point, stepping through the sweep
+    const u32 duration = MAX (source->duration, 1u);
+    const i64 sweep = (i64)source->sweep * 65536;
+    i64 frequency = (i64)source->frequency * 65536 + sweep * (channel->t + 1) / duration;
+    const i64 frequency_step = sweep / duration;
+    const u32 vibrato_increment = ((u64)source->vibrato.vibrations_per_hundred_seconds << 32) / (SAMPLING_RATE * 100);
+    for (int i = 0; i < count; ++i, frequency += frequency_step) {
+        i64 f = frequency;
+        if (vibrato_increment) {
+            f += (i64)(i32)(WavetableSample (wavetables.sine, channel->vibrato_phase) * source->vibrato.frequency_range) * 65536;
+            channel->vibrato_phase += vibrato_increment;
+        }
+        // At this point, due to sweep and vibrato, f may be negative. Turns out that's totally fine and allows for some nice effects!
+        const i64 increment = f * 65536 / SAMPLING_RATE;
+        if (source->waveform == sound_waveform_noise) {
+            // Noise runs at 4 times the frequency
+            const i64 phase = channel->phase + 4 * increment;
+            if (phase >> 32) noise_channels[c].value = DiscreteRandom_Rangef (&noise_channels[c].random_state, -1, 1);
+            scratch->wave[i] = noise_channels[c].value;
+            channel->phase = phase;
+        }
+        else channel->phase += increment;
+        scratch->phase[i] = channel->phase;
+        scratch->increment[i] = increment > INT32_MAX ? INT32_MAX : increment < -INT32_MAX ? -INT32_MAX : increment;
+    }
+}
+
+// Fills scratch->wave with count samples of the channel's waveform from the phases SynthPhase stored. t0 is the channel's time before the first sample.
+static void SynthOscillator (synth_scratch_t *scratch, const sound_channel_t *channel, u32 t0, int count) {
+    const auto source = &channel->sound;
+    const u32 *restrict phase = scratch->phase;
+    const i32 *restrict increment = scratch->increment;
+    f32 *restrict wave = scratch->wave;
+    switch (source->waveform) {
+        case sound_waveform_sine: {
+            for (int i = 0; i < count; ++i) wave[i] = WavetableSample (wavetables.sine, phase[i]);
+        } break;
+        case sound_waveform_triangle: {
+            for (int i = 0; i < count; ++i) wave[i] = WavetableSample (wavetables.triangle[WavetableOctave (increment[i])], phase[i]);
+        } break;
+        case sound_waveform_saw: {
+            for (int i = 0; i < count; ++i) wave[i] = WavetableSample (wavetables.saw[WavetableOctave (increment[i])], phase[i]);
+        } break;
+        case sound_waveform_pulse: {
+            for (int i = 0; i < count; ++i) {
+                const u32 t = t0 + 1 + i;
+                // Duty cycle 0 = 50%. 127 = 98%, -128 = 99%
+                // Duty cycle as int8, loops with overflow. Convert to f32. Divide by 129 means computed duty cycle is never 0 (avoid pop when temporarily hitting 0) and 127 == -127 for perfect looping through -128
+                i8 duty_cycle1 = (source->square_duty_cycle + (i32)t * source->square_duty_cycle_sweep / (i32)source->duration);
+                f32 duty_cycle = absf(duty_cycle1) / 257.f + .5f;
+                // 1 until duty_cycle, then -1: a saw minus the same saw delayed by duty_cycle, shifted to centre on 0
+                const f32 *table = wavetables.saw[WavetableOctave (increment[i])];
+                const u32 offset = (1 - duty_cycle) * 0x1p32f;
+                wave[i] = WavetableSample (table, phase[i] + offset) - WavetableSample (table, phase[i]) + 2 * duty_cycle - 1;
             }
-            
-            if (channel->t >= sound->duration){
-                if (sound->next) {
-                    auto tempd = channel->d;
-                    auto tempvd = channel->vibrato_d;
-                    auto tempstuff = channel->u;
-                    *channel = (typeof(*channel)){.sound = *sound->next};
-                    if (envelope > 0) {
-                        channel->d = tempd;
-                        channel->vibrato_d = tempvd;
-                        channel->u = tempstuff;
-                    }
+        } break;
+        case sound_waveform_noise: break; // Filled by SynthPhase
+        case sound_waveform_none: case sound_waveform_preparing: case sound_waveform_silence: unreachable(); break;
+    }
+}
+
+// Multiplies count samples of scratch->wave by the ADSR envelope and adds them to bus. The envelope is linear within each stage, so each stage gets its own loop. t0 is the channel's time before the first sample. Returns the envelope at the last sample.
+static f32 SynthEnvelope (const synth_scratch_t *scratch, const sound_t *source, u32 t0, int count, f32 *restrict bus) {
+    const auto ADSR = source->ADSR;
+    const f32 *restrict wave = scratch->wave;
+    const i32 first = t0 + 1, end = first + count;
+    const i32 attack_end = ADSR.attack, decay_end = ADSR.attack + ADSR.decay, sustain_end = (i32)source->duration - ADSR.release;
+    i32 t = first;
+    for (const i32 stop = MIN (MAX (attack_end, t), end); t < stop; ++t)
+        bus[t - first] += wave[t - first] * ((f32)t / ADSR.attack * ADSR.peak);
+    for (const i32 stop = MIN (MAX (decay_end, t), end); t < stop; ++t) {
+        f32 ratio = (f32)(t - ADSR.attack) / ADSR.decay;
+        bus[t - first] += wave[t - first] * ((1 - ratio) * ADSR.peak + ratio * ADSR.sustain);
+    }
+    for (const i32 stop = MIN (MAX (sustain_end + 1, t), end); t < stop; ++t)
+        bus[t - first] += wave[t - first] * ADSR.sustain;
+    for (; t < end; ++t) {
+        i32 r = t + (ADSR.release - (i32)source->duration);
+        bus[t - first] += wave[t - first] * (r <= 0 ? 0 : (1.f - (f32)r / ADSR.release) * ADSR.sustain);
+    }
+    return ADSREnvelope (source, end - 1);
+}
+
+// Renders count samples of channel c into bus, moving on to the channel's next sound whenever one ends.
+static void SynthChannel (synth_scratch_t *scratch, int c, f32 *restrict bus, int count) {
+    auto channel = &sound.channels[c];
+    int done = 0;
+    while (done < count) {
+        const auto source = &channel->sound;
+        if (source->waveform == sound_waveform_none || source->waveform == sound_waveform_preparing) return;
+        // Stop the run where the sound ends
+        int run = count - done;
+        if (source->duration <= channel->t) run = 1;
+        else if (source->duration - channel->t < run) run = source->duration - channel->t;
+        f32 envelope = 1;
+        if (channel->cached) {
+            for (int i = 0; i < run; ++i) bus[done + i] += channel->cached[i];
+            channel->cached += run;
+        }
+        else if (source->waveform != sound_waveform_silence) {
+            SynthPhase (scratch, c, run);
+            SynthOscillator (scratch, channel, channel->t, run);
+            envelope = SynthEnvelope (scratch, source, channel->t, run, bus + done);
+        }
+        channel->t += run;
+        done += run;
+
+        if (channel->t >= source->duration){
+            if (source->next) {
+                auto tempd = channel->phase;
+                auto tempvd = channel->vibrato_phase;
+                auto tempstuff = channel->u;
+                *channel = (typeof(*channel)){.sound = *source->next, .cached = channel->cached};
+                if (envelope > 0) {
+                    channel->phase = tempd;
+                    channel->vibrato_phase = tempvd;
+                    channel->u = tempstuff;
                 }
-                else sound->waveform = sound_waveform_none;
             }
+            else source->waveform = sound_waveform_none;
         }
     }
-    // if (fabs (value) > 1) {
-    //     static int clips = 0;
-    //     LOG ("Clip[%d]", ++clips);
-    // }
+}
+
+// Sound effect cache. Each cached chain is rendered once by the synth on CACHE_CHANNEL, starting from the same zero phase a new FX channel does, so mixing it back is bit for bit the same as synthesizing it. Samples are handed out from a fixed arena and never freed. Chains are rendered in the order they were added, at most SOUND_CACHE_RENDER_SAMPLES samples per refill, and are synthesized as usual until they're done.
+#ifndef SOUND_CACHE_SAMPLES
+#define SOUND_CACHE_SAMPLES (SAMPLING_RATE * 2)
+#endif
+#ifndef SOUND_CACHE_SOUNDS
+#define SOUND_CACHE_SOUNDS 32
+#endif
+#ifndef SOUND_CACHE_RENDER_SAMPLES
+#define SOUND_CACHE_RENDER_SAMPLES 1024 // About as much work as one more FX voice at the default period
+#endif
+static struct {
+    u32 count, used;
+    u32 rendering, rendered; // The first entry not rendered yet, and how many of its samples are
+    struct {
+        sound_t sound;
+        u32 offset, length;
+    } entries[SOUND_CACHE_SOUNDS];
+    f32 samples[SOUND_CACHE_SAMPLES];
+} fx_cache;
+static struct {
+    _Atomic u32 sounds, samples, hits, rejected;
+} fx_cache_stats;
+
+sound_cache_stats_t SoundFXCacheStats () {
+    return (sound_cache_stats_t){
+        .sounds = atomic_load_explicit (&fx_cache_stats.sounds, memory_order_relaxed),
+        .samples = atomic_load_explicit (&fx_cache_stats.samples, memory_order_relaxed),
+        .hits = atomic_load_explicit (&fx_cache_stats.hits, memory_order_relaxed),
+        .rejected = atomic_load_explicit (&fx_cache_stats.rejected, memory_order_relaxed),
+    };
+}
 
-    return ((value_music * sound.music.volume) + (value_fx * sound.fx.volume)) * sound.master_volume;
+// Everything which affects how a sound is synthesized
+static inline bool SoundsAreIdentical (const sound_t *a, const sound_t *b) {
+    return a->waveform == b->waveform && a->duration == b->duration && a->next == b->next && a->frequency == b->frequency && a->sweep == b->sweep
+        && a->ADSR.peak == b->ADSR.peak && a->ADSR.attack == b->ADSR.attack && a->ADSR.decay == b->ADSR.decay && a->ADSR.sustain == b->ADSR.sustain && a->ADSR.release == b->ADSR.release
+        && a->vibrato.frequency_range == b->vibrato.frequency_range && a->vibrato.vibrations_per_hundred_seconds == b->vibrato.vibrations_per_hundred_seconds
+        && a->square_duty_cycle == b->square_duty_cycle && a->square_duty_cycle_sweep == b->square_duty_cycle_sweep;
+}
+
+static const f32 *FXCacheFind (const sound_t *first, bool render) {
+    for (u32 i = 0; i < fx_cache.count; ++i) {
+        if (SoundsAreIdentical (&fx_cache.entries[i].sound, first)) {
+            if (i >= fx_cache.rendering) return NULL;
+            atomic_fetch_add_explicit (&fx_cache_stats.hits, 1, memory_order_relaxed);
+            return &fx_cache.samples[fx_cache.entries[i].offset];
+        }
+    }
+    if (!render || first->waveform == sound_waveform_none) return NULL;
+
+    // Each sound in the chain lasts at least one sample, so a chain which loops soon outgrows the free space
+    const u32 free = SOUND_CACHE_SAMPLES - fx_cache.used;
+    u32 length = 0;
+    for (auto s = first; s && s->waveform != sound_waveform_none && length <= free; s = s->next) {
+        if (s->waveform == sound_waveform_noise) return NULL;
+        length += MAX (s->duration, 1u);
+    }
+    if (length > free || fx_cache.count == SOUND_CACHE_SOUNDS) {
+        if (atomic_fetch_add_explicit (&fx_cache_stats.rejected, 1, memory_order_relaxed) == 0) LOG ("Sound cache is full. Sounds which don't fit will be synthesized");
+        return NULL;
+    }
+
+    fx_cache.entries[fx_cache.count++] = (typeof(fx_cache.entries[0])){*first, fx_cache.used, length};
+    fx_cache.used += length;
+    return NULL;
+}
+
+// Renders up to SOUND_CACHE_RENDER_SAMPLES more samples of the entries waiting to be cached
+static void FXCacheRender () {
+    u32 budget = SOUND_CACHE_RENDER_SAMPLES;
+    while (budget && fx_cache.rendering < fx_cache.count) {
+        const auto entry = &fx_cache.entries[fx_cache.rendering];
+        if (fx_cache.rendered == 0) sound.channels[CACHE_CHANNEL] = (sound_channel_t){.sound = entry->sound};
+        const u32 run = MIN (MIN (entry->length - fx_cache.rendered, budget), SAMPLE_BUFFER_SIZE_MAX);
+        SynthChannel (&synth.scratch, CACHE_CHANNEL, &fx_cache.samples[entry->offset + fx_cache.rendered], run);
+        fx_cache.rendered += run;
+        budget -= run;
+        if (fx_cache.rendered == entry->length) {
+            ++fx_cache.rendering;
+            fx_cache.rendered = 0;
+            atomic_store_explicit (&fx_cache_stats.sounds, fx_cache.rendering, memory_order_relaxed);
+            atomic_store_explicit (&fx_cache_stats.samples, entry->offset + entry->length, memory_order_relaxed);
+        }
+    }
+}
+
+// Output limiter. Keeps the mix within -1 to 1 by turning it down smoothly just before loud peaks, instead of clipping them. Samples go through a delay of SOUND_LIMITER_LOOKAHEAD samples. Meanwhile the gain each one needs (1, or 1 / its level above 1) goes through a running minimum over the lookahead, then a running average over the same length, so by the time a peak leaves the delay the gain has ramped down to what it needs. The gain then recovers by SOUND_LIMITER_RELEASE of the way to full each sample. All of it is constant time per sample.
+#ifndef SOUND_LIMITER_LOOKAHEAD
+#define SOUND_LIMITER_LOOKAHEAD 48 // 1ms
+#endif
+#ifndef SOUND_LIMITER_RELEASE
+#define SOUND_LIMITER_RELEASE .0005f // About 40ms to recover
+#endif
+#define LIMITER_UNITY (1 << 24) // Gains are 8.24 fixed point so the running sum is exact
+static struct {
+    u32 position;
+    int slot; // position % SOUND_LIMITER_LOOKAHEAD
+    f32 delay[SOUND_LIMITER_LOOKAHEAD];
+    // Running minimum: a ring of gains which increase from oldest to newest, with the position each was needed at. The oldest is the minimum.
+    struct {
+        u32 gain, position;
+    } minimum[SOUND_LIMITER_LOOKAHEAD + 1];
+    int minimum_first, minimum_last;
+    // Running average of the minimum
+    u32 held[SOUND_LIMITER_LOOKAHEAD];
+    i64 held_sum;
+    f32 gain;
+    bool idle; // Nothing in the lookahead needs limiting and the gain is back to 1
+} limiter;
+
+static void LimiterInitialize () {
+    for (int i = 0; i < SOUND_LIMITER_LOOKAHEAD; ++i) limiter.held[i] = LIMITER_UNITY;
+    limiter.held_sum = (i64)SOUND_LIMITER_LOOKAHEAD * LIMITER_UNITY;
+    limiter.minimum[0].gain = LIMITER_UNITY;
+    limiter.gain = 1;
+    limiter.idle = true;
+}
+
+// Takes the next sample of the mix and returns the one from SOUND_LIMITER_LOOKAHEAD samples earlier, limited
+static inline f32 Limit (f32 sample) {
+    const u32 position = limiter.position++;
+    const int slot = limiter.slot;
+    if (++limiter.slot == SOUND_LIMITER_LOOKAHEAD) limiter.slot = 0;
+    const f32 delayed = limiter.delay[slot];
+    limiter.delay[slot] = sample;
+    const f32 level = absf (sample);
+    if (level <= 1 && limiter.idle) {
+        limiter.minimum[limiter.minimum_first].position = position;
+        return delayed;
+    }
+    const u32 required = level > 1 ? (u32)(LIMITER_UNITY / level) : LIMITER_UNITY;
+
+    // Minimum over the last SOUND_LIMITER_LOOKAHEAD + 1 samples. Gains that can't be the minimum again, because this one is lower and will stay in the window longer, are dropped from the back.
+    constexpr int capacity = _Countof (limiter.minimum);
+    auto m = &limiter.minimum;
+    int last = limiter.minimum_last;
+    while ((*m)[last].gain >= required && last != limiter.minimum_first) last = last == 0 ? capacity - 1 : last - 1;
+    if ((*m)[last].gain < required) last = last == capacity - 1 ? 0 : last + 1;
+    (*m)[last] = (typeof((*m)[0])){required, position};
+    limiter.minimum_last = last;
+    if (position - (*m)[limiter.minimum_first].position > SOUND_LIMITER_LOOKAHEAD) limiter.minimum_first = limiter.minimum_first == capacity - 1 ? 0 : limiter.minimum_first + 1;
+    const u32 held = (*m)[limiter.minimum_first].gain;
+
+    limiter.held_sum += held - (i64)limiter.held[slot];
+    limiter.held[slot] = held;
+    const f32 target = limiter.held_sum * (1.f / ((f32)SOUND_LIMITER_LOOKAHEAD * LIMITER_UNITY));
+    f32 gain = target;
+    if (target > limiter.gain) {
+        gain = limiter.gain + (target - limiter.gain) * SOUND_LIMITER_RELEASE;
+        if (target - gain < 0x1p-12f) gain = target; // Otherwise it would stall just short, where a step rounds to nothing
+    }
+    limiter.gain = gain;
+    limiter.idle = gain == 1 && held == LIMITER_UNITY && limiter.held_sum == (i64)SOUND_LIMITER_LOOKAHEAD * LIMITER_UNITY;
+
+    // The gain can round to a hair over what was needed
+    return MIN (MAX (delayed * gain, -1.f), 1.f);
+}
+
+// Music worker threads. For each buffer the sound thread publishes the sample count, resets the channel counter and wakes the workers, then claims channels from the counter along with them. Each channel is rendered into its own buffer, then the sound thread waits for any still being rendered and sums them in channel order. With no workers the sound thread renders and sums them the same way, so the output doesn't depend on the worker count even where the compiler fuses multiply-adds.
+#ifndef SOUND_MUSIC_WORKERS_MAX
+#define SOUND_MUSIC_WORKERS_MAX 4
+#endif
+static struct {
+    _Atomic int requested;
+    int running; // Sound thread only
+    pthread_t threads[SOUND_MUSIC_WORKERS_MAX];
+    synth_scratch_t scratch[SOUND_MUSIC_WORKERS_MAX];
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t done; // Signalled under mutex by a worker once it's finished its channels
+    u32 generation; // Bumped for each buffer, under mutex
+    bool quit; // Under mutex
+    _Atomic int count; // Samples in this buffer
+    _Atomic int next_channel, finished;
+    f32 channels[MUSIC_CHANNELS][SAMPLE_BUFFER_SIZE_MAX];
+} music_workers = {.mutex = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+static struct {
+    _Atomic u32 refills, deadline_misses, worst_us, worker_channels;
+} synth_stats;
+
+void SoundMusicSetWorkers (int workers) { atomic_store_explicit (&music_workers.requested, MAX (0, MIN (workers, SOUND_MUSIC_WORKERS_MAX)), memory_order_relaxed); }
+
+sound_synth_stats_t SoundSynthStats () {
+    return (sound_synth_stats_t){
+        .refills = atomic_load_explicit (&synth_stats.refills, memory_order_relaxed),
+        .deadline_misses = atomic_load_explicit (&synth_stats.deadline_misses, memory_order_relaxed),
+        .worst_us = atomic_load_explicit (&synth_stats.worst_us, memory_order_relaxed),
+        .worker_channels = atomic_load_explicit (&synth_stats.worker_channels, memory_order_relaxed),
+    };
+}
+
+// Renders unclaimed music channels until there are none left. Returns how many this thread rendered.
+static int RenderMusicChannels (synth_scratch_t *scratch) {
+    int rendered = 0;
+    for (int c; (c = atomic_fetch_add_explicit (&music_workers.next_channel, 1, memory_order_acq_rel)) < MUSIC_CHANNELS; ++rendered) {
+        const int count = atomic_load_explicit (&music_workers.count, memory_order_relaxed);
+        memset (music_workers.channels[c], 0, count * sizeof (f32));
+        SynthChannel (scratch, MUSIC_CHANNELS_FIRST + c, music_workers.channels[c], count);
+        atomic_fetch_add_explicit (&music_workers.finished, 1, memory_order_release);
+    }
+    return rendered;
+}
+
+static void *MusicWorker (void *scratch) {
+    u32 seen = 0;
+    pthread_mutex_lock (&music_workers.mutex);
+    while (true) {
+        while (!music_workers.quit && music_workers.generation == seen) pthread_cond_wait (&music_workers.wake, &music_workers.mutex);
+        if (music_workers.quit) break;
+        seen = music_workers.generation;
+        pthread_mutex_unlock (&music_workers.mutex);
+        const int rendered = RenderMusicChannels (scratch);
+        if (rendered) atomic_fetch_add_explicit (&synth_stats.worker_channels, rendered, memory_order_relaxed);
+        pthread_mutex_lock (&music_workers.mutex);
+        if (rendered) pthread_cond_signal (&music_workers.done);
+    }
+    pthread_mutex_unlock (&music_workers.mutex);
+    return NULL;
+}
+
+// Starts or stops workers to match SoundMusicSetWorkers. Sound thread only.
+static void MusicWorkersUpdate () {
+    const int requested = atomic_load_explicit (&music_workers.requested, memory_order_relaxed);
+    if (requested == music_workers.running) return;
+    if (music_workers.running) {
+        pthread_mutex_lock (&music_workers.mutex);
+        music_workers.quit = true;
+        pthread_cond_broadcast (&music_workers.wake);
+        pthread_mutex_unlock (&music_workers.mutex);
+        for (int i = 0; i < music_workers.running; ++i) pthread_join (music_workers.threads[i], NULL);
+        music_workers.quit = false;
+        music_workers.running = 0;
+    }
+    // Channels left unclaimed by a worker which hasn't woken up yet mustn't be picked up as part of a later buffer
+    atomic_store_explicit (&music_workers.next_channel, MUSIC_CHANNELS, memory_order_relaxed);
+    music_workers.generation = 0;
+    for (; music_workers.running < requested; ++music_workers.running) {
+        if (pthread_create (&music_workers.threads[music_workers.running], NULL, MusicWorker, &music_workers.scratch[music_workers.running])) {
+            LOG ("Failed to create music worker thread");
+            break;
+        }
+    }
+}
+
+static void RenderMusic (int count) {
+    atomic_store_explicit (&music_workers.count, count, memory_order_relaxed);
+    atomic_store_explicit (&music_workers.finished, 0, memory_order_relaxed);
+    atomic_store_explicit (&music_workers.next_channel, 0, memory_order_release);
+    if (music_workers.running) {
+        pthread_mutex_lock (&music_workers.mutex);
+        ++music_workers.generation;
+        pthread_cond_broadcast (&music_workers.wake);
+        pthread_mutex_unlock (&music_workers.mutex);
+    }
+    RenderMusicChannels (&synth.scratch);
+    if (atomic_load_explicit (&music_workers.finished, memory_order_acquire) < MUSIC_CHANNELS) {
+        pthread_mutex_lock (&music_workers.mutex);
+        while (atomic_load_explicit (&music_workers.finished, memory_order_acquire) < MUSIC_CHANNELS) pthread_cond_wait (&music_workers.done, &music_workers.mutex);
+        pthread_mutex_unlock (&music_workers.mutex);
+    }
+    for (int c = 0; c < MUSIC_CHANNELS; ++c)
+        for (int i = 0; i < count; ++i) synth.music[i] += music_workers.channels[c][i];
 }
 
 void RefillSampleBuffer () {
+    const i64 start = os_uTime ();
     assert (sample_buffer_size <= SAMPLE_BUFFER_SIZE_MAX);
+    if (!wavetables.initialized) {
+        SynthInitialize ();
+        LimiterInitialize ();
+    }
     SoundExecuteCommands ();
+    FXCacheRender ();
 
     if (sound_extern_data.prepared_sounds_ready) {
         for (int c = 0; c < SOUND_CHANNELS; ++c) {
             if (sound.channels[c].sound.waveform == sound_waveform_preparing) {
                 assert (sound.channels[c].sound.next);
-                sound.channels[c] = (typeof(sound.channels[c])){.sound = *sound.channels[c].sound.next};
+                const auto next = sound.channels[c].sound.next;
+                sound.channels[c] = (typeof(sound.channels[c])){.sound = *next, .cached = FXCacheFind (next, next->cache)};
             }
         }
         sound_extern_data.prepared_sounds_ready = false;
     }
 
     sample_buffer_swap = !sample_buffer_swap;
-    static f32 compressor_level = 1;
-
-    // Fill used-up buffer with new, uncompressed samples
-    f32 peak = 1;
-    for (int i = 0; i < sample_buffer_size; ++i) {
-        f32 sample = CreateNextSample();
-        f32 sampleabs = fabs (sample);
-        if (sampleabs > peak) peak = sampleabs;
-        sample_buffer[!sample_buffer_swap].samples[i] = sample;
+
+    memset (synth.music, 0, sample_buffer_size * sizeof (synth.music[0]));
+    memset (synth.fx, 0, sample_buffer_size * sizeof (synth.fx[0]));
+    MusicWorkersUpdate ();
+    if (sound.music.state == music_state_playing) RenderMusic (sample_buffer_size);
+    for (int c = FX_CHANNELS_FIRST; c <= FX_CHANNELS_LAST; ++c) SynthChannel (&synth.scratch, c, synth.fx, sample_buffer_size);
+    samples_played += sample_buffer_size;
+    u32 voices = 0;
+    for (int c = FX_CHANNELS_FIRST; c <= FX_CHANNELS_LAST; ++c) voices += sound.channels[c].sound.waveform != sound_waveform_none;
+    atomic_store_explicit (&voice_stats.voices, voices, memory_order_relaxed);
+    if (voices > atomic_load_explicit (&voice_stats.most_voices, memory_order_relaxed)) atomic_store_explicit (&voice_stats.most_voices, voices, memory_order_relaxed);
+    f32 *output = sample_buffer[sample_buffer_swap].samples;
+    for (int i = 0; i < sample_buffer_size; ++i)
+        output[i] = Limit (((synth.music[i] * sound.music.volume) + (synth.fx[i] * sound.fx.volume)) * sound.master_volume);
+
+    const u32 took = os_uTime () - start;
+    atomic_fetch_add_explicit (&synth_stats.refills, 1, memory_order_relaxed);
+    if ((i64)took * SAMPLING_RATE > (i64)sample_buffer_size * 1000000) atomic_fetch_add_explicit (&synth_stats.deadline_misses, 1, memory_order_relaxed);
+    if (took > atomic_load_explicit (&synth_stats.worst_us, memory_order_relaxed)) atomic_store_explicit (&synth_stats.worst_us, took, memory_order_relaxed);
+}
+
+const sound_backend_t *SoundBackendRequested (const char **argument) {
+    const char *requested = getenv ("SOUND_BACKEND");
+    *argument = NULL;
+    if (requested == NULL || requested[0] == '\0') return NULL;
+    for (auto backend = (const sound_backend_t *[]){&sound_backend_null, &sound_backend_wav, NULL}; *backend; ++backend) {
+        const size_t length = strlen ((*backend)->name);
+        if (strncmp (requested, (*backend)->name, length) != 0) continue;
+        if (requested[length] == ':') *argument = requested + length + 1;
+        else if (requested[length] != '\0') continue;
+        return *backend;
     }
-    if (peak > 1) peak += 0.00001f; // Tiny bit of extra for f32ing point inaccuracy
-    else peak = 1; // Peak lower than 1, set to 1
-    sample_buffer[!sample_buffer_swap].peak = peak;
-
-    // Compress other buffer
-    // Starting from compression level previous frame ended with, lerp to peak of (greater of current or next frame).
-    f32 compressor_target = MAX (sample_buffer[sample_buffer_swap].peak, sample_buffer[!sample_buffer_swap].peak);
-    for (int i = 0; i < sample_buffer_size; ++i) {
-        f32 d = (f32)i / sample_buffer_size;
-        f32 compression = (1-d)*compressor_level + d*compressor_target;
-        sample_buffer[sample_buffer_swap].samples[i] /= compression;
-        assert (fabs (sample_buffer[sample_buffer_swap].samples[i]) <= 1);
+    LOG ("Unknown SOUND_BACKEND [%s]. Expected null or wav:filename", requested);
+    return NULL;
+}
+
+void SoundRunBackend (const sound_backend_t *backend, const char *argument) {
+    if (!backend->Open (argument)) return;
+    LOG ("Sound output: %s", backend->name);
+    sound_output_config_t config;
+    u32 config_generation = 0;
+    while (!sound_extern_data.quit) {
+        if (SoundOutputConfigChanged (&config, &config_generation)) {
+            config.period_samples = MAX (SOUND_OUTPUT_PERIOD_SAMPLES_MIN, MIN (config.period_samples, SAMPLE_BUFFER_SIZE_MAX));
+            if (!backend->Configure (&config)) break;
+            sample_buffer_size = config.period_samples;
+        }
+        const i64 refill_start = os_uTime ();
+        RefillSampleBuffer ();
+        atomic_store_explicit (&output_stats.refill_us, os_uTime () - refill_start, memory_order_relaxed);
+        if (!backend->Write (sample_buffer[sample_buffer_swap].samples, sample_buffer_size)) break;
     }
-    compressor_level = compressor_target;
+    backend->Close ();
+}
+
+// The null and wav backends wait until the period they were given would have finished playing, keeping to a clock rather than sleeping a period each time, so time spent in the synth doesn't add up. If they fall more than a period behind it counts as an underrun and the clock restarts from now.
+static struct {
+    i64 next_us;
+    u32 period_us;
+    u16 period_samples;
+} pace;
+
+static bool PaceConfigure (sound_output_config_t *config) {
+    pace.period_samples = config->period_samples;
+    pace.period_us = config->period_samples * 1000000ll / SAMPLING_RATE;
+    pace.next_us = os_uTime ();
+    return true;
+}
+
+static void Pace (int count) {
+    pace.next_us += count * 1000000ll / SAMPLING_RATE;
+    const i64 now = os_uTime ();
+    const bool underrun = now - pace.next_us > pace.period_us;
+    if (underrun) pace.next_us = now;
+    else os_uSleepPrecise (pace.next_us - now);
+    SoundOutputReport (pace.period_us, underrun, pace.period_samples, 1);
+}
+
+static bool NullOpen (const char *argument) { return true; }
+static bool NullWrite (const f32 *samples, int count) { Pace (count); return true; }
+static void NullClose () {}
+const sound_backend_t sound_backend_null = {"null", NullOpen, PaceConfigure, NullWrite, NullClose};
+
+// 32 bit float mono at SAMPLING_RATE. The sizes in the header are filled in on close.
+static struct {
+    FILE *file;
+    u32 samples;
+} wav;
+
+static bool WavOpen (const char *filename) {
+    if (filename == NULL || filename[0] == '\0') filename = "sound.wav";
+    wav.file = fopen (filename, "wb");
+    if (wav.file == NULL) { LOG ("Failed to open [%s] for sound output", filename); return false; }
+    wav.samples = 0;
+    const struct [[gnu::packed]] {
+        char riff[4]; u32 riff_size; char wave[4];
+        char fmt[4]; u32 fmt_size; u16 format, channels; u32 rate, byte_rate; u16 block_align, bits;
+        char data[4]; u32 data_size;
+    } header = {
+        {'R', 'I', 'F', 'F'}, 0, {'W', 'A', 'V', 'E'},
+        {'f', 'm', 't', ' '}, 16, 3, 1, SAMPLING_RATE, SAMPLING_RATE * sizeof (f32), sizeof (f32), 32,
+        {'d', 'a', 't', 'a'}, 0,
+    };
+    if (fwrite (&header, sizeof (header), 1, wav.file) != 1) { LOG ("Failed to write [%s]", filename); fclose (wav.file); return false; }
+    return true;
+}
+
+static bool WavWrite (const f32 *samples, int count) {
+    if (fwrite (samples, sizeof (f32), count, wav.file) != (size_t)count) { LOG ("Failed to write sound output"); return false; }
+    wav.samples += count;
+    Pace (count);
+    return true;
+}
+
+static void WavClose () {
+    const u32 data_size = wav.samples * sizeof (f32), riff_size = data_size + 36;
+    fseek (wav.file, 4, SEEK_SET);
+    fwrite (&riff_size, sizeof (riff_size), 1, wav.file);
+    fseek (wav.file, 40, SEEK_SET);
+    fwrite (&data_size, sizeof (data_size), 1, wav.file);
+    fclose (wav.file);
 }
+const sound_backend_t sound_backend_wav = {"wav", WavOpen, PaceConfigure, WavWrite, WavClose};
@@ -6,10 +6,31 @@ extern sound_extern_t sound_extern_data;
 typedef struct {
     i16 played;
     f32 samples[SAMPLE_BUFFER_SIZE_MAX];
-    f32 peak;
 } sample_buffer_t;
 extern sample_buffer_t sample_buffer[2];
 extern bool sample_buffer_swap;
 extern i16 sample_buffer_size;
 void RefillSampleBuffer ();
+// For the platform's sound thread. Returns true and fills config if SoundOutputConfigure has been called since generation was last updated. Start generation at 0 to get the initial config.
+bool SoundOutputConfigChanged (sound_output_config_t *config, u32 *generation);
+// Publishes what SoundOutputStats returns
+void SoundOutputReport (u32 latency_us, bool underrun, u16 period_samples, u8 buffer_periods);
+
+// An output the sound thread can write to, for platforms whose audio API lets the thread push samples rather than calling back for them
+typedef struct {
+    const char *name;
+    bool (*Open) (const char *argument); // argument is what followed "name:" in SOUND_BACKEND, or NULL
+    // Starts or restarts output with config, which it may adjust. Called before the first Write and again whenever SoundOutputConfigure changes it.
+    bool (*Configure) (sound_output_config_t *config);
+    bool (*Write) (const f32 *samples, int count); // Blocks until the output is ready for the next period
+    void (*Close) ();
+} sound_backend_t;
+// Discards the output, taking as long as playing it would
+extern const sound_backend_t sound_backend_null;
+// Writes the output to a WAV file, taking as long as playing it would
+extern const sound_backend_t sound_backend_wav;
+// Returns the backend named by the SOUND_BACKEND environment variable, setting argument to what follows its name, or NULL if it isn't set or isn't recognised
+const sound_backend_t *SoundBackendRequested (const char **argument);
+// Runs the sound thread on backend until sound_extern_data.quit, or until the backend fails
+void SoundRunBackend (const sound_backend_t *backend, const char *argument);
 #define SAMPLING_RATE 48000
\ No newline at end of file
@@ -16,6 +16,8 @@
 #include "framework_types.h"
 
 #include <assert.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include "turns_math.h"
 
 typedef enum {sprite_flip_none, sprite_flip_y, sprite_flip_x, sprite_flip_both} sprite_flip_e;
@@ -72,6 +74,328 @@ u8 sprite_SamplePixel_ (sprite_SamplePixel_arguments arguments) {
 
 // --------------------------------------------------------------------------------
 
+// Row kernels for the unrotated blits. Each writes count pixels of a source row into destination wherever the source pixel isn't 0. Reversed kernels read the source row backwards from source_last, for horizontal flipping. Writing a span twice gives the same result as writing it once, so the vector kernels finish a row with one overlapping vector instead of a scalar tail.
+
+static void BlitRowScalar (u8 *restrict destination, const u8 *restrict source, int count) {
+	for (int i = 0; i < count; ++i)
+		if (source[i] != 0)
+			destination[i] = source[i];
+}
+
+static void BlitRowReversedScalar (u8 *restrict destination, const u8 *restrict source_last, int count) {
+	for (int i = 0; i < count; ++i)
+		if (source_last[-i] != 0)
+			destination[i] = source_last[-i];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPRITE_BLIT_X86
+#include <immintrin.h>
+
+[[gnu::target("sse2")]] static inline __m128i BlitMaskSSE2 (__m128i source, __m128i destination) {
+	const __m128i transparent = _mm_cmpeq_epi8 (source, _mm_setzero_si128 ());
+	return _mm_or_si128 (_mm_and_si128 (transparent, destination), _mm_andnot_si128 (transparent, source));
+}
+
+[[gnu::target("sse2")]] static inline __m128i ReverseBytesSSE2 (__m128i v) {
+	v = _mm_shuffle_epi32 (v, _MM_SHUFFLE (0, 1, 2, 3));
+	v = _mm_shufflelo_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));
+	v = _mm_shufflehi_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));
+	return _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+}
+
+[[gnu::target("sse2")]] static void BlitRowSSE2 (u8 *restrict destination, const u8 *restrict source, int count) {
+	if (count < 8) { BlitRowScalar (destination, source, count); return; }
+	if (count < 16) {
+		for (int i = 0; i < 2; ++i) {
+			const int at = i ? count - 8 : 0;
+			const __m128i s = _mm_loadl_epi64 ((const __m128i *)&source[at]);
+			const __m128i d = _mm_loadl_epi64 ((const __m128i *)&destination[at]);
+			_mm_storel_epi64 ((__m128i *)&destination[at], BlitMaskSSE2 (s, d));
+		}
+		return;
+	}
+	for (int i = 0;; i += 16) {
+		if (i > count - 16) i = count - 16;
+		const __m128i s = _mm_loadu_si128 ((const __m128i *)&source[i]);
+		const __m128i d = _mm_loadu_si128 ((const __m128i *)&destination[i]);
+		_mm_storeu_si128 ((__m128i *)&destination[i], BlitMaskSSE2 (s, d));
+		if (i == count - 16) break;
+	}
+}
+
+[[gnu::target("sse2")]] static void BlitRowReversedSSE2 (u8 *restrict destination, const u8 *restrict source_last, int count) {
+	if (count < 8) { BlitRowReversedScalar (destination, source_last, count); return; }
+	if (count < 16) {
+		for (int i = 0; i < 2; ++i) {
+			const int at = i ? count - 8 : 0;
+			// Reversing all 16 bytes moves the 8 loaded ones into the high half
+			const __m128i s = _mm_srli_si128 (ReverseBytesSSE2 (_mm_loadl_epi64 ((const __m128i *)&source_last[-at-7])), 8);
+			const __m128i d = _mm_loadl_epi64 ((const __m128i *)&destination[at]);
+			_mm_storel_epi64 ((__m128i *)&destination[at], BlitMaskSSE2 (s, d));
+		}
+		return;
+	}
+	for (int i = 0;; i += 16) {
+		if (i > count - 16) i = count - 16;
+		const __m128i s = ReverseBytesSSE2 (_mm_loadu_si128 ((const __m128i *)&source_last[-i-15]));
+		const __m128i d = _mm_loadu_si128 ((const __m128i *)&destination[i]);
+		_mm_storeu_si128 ((__m128i *)&destination[i], BlitMaskSSE2 (s, d));
+		if (i == count - 16) break;
+	}
+}
+
+[[gnu::target("avx2")]] static inline __m256i BlitMaskAVX2 (__m256i source, __m256i destination) {
+	return _mm256_blendv_epi8 (source, destination, _mm256_cmpeq_epi8 (source, _mm256_setzero_si256 ()));
+}
+
+[[gnu::target("avx2")]] static void BlitRowAVX2 (u8 *restrict destination, const u8 *restrict source, int count) {
+	if (count < 32) { BlitRowSSE2 (destination, source, count); return; }
+	for (int i = 0;; i += 32) {
+		if (i > count - 32) i = count - 32;
+		const __m256i s = _mm256_loadu_si256 ((const __m256i *)&source[i]);
+		const __m256i d = _mm256_loadu_si256 ((const __m256i *)&destination[i]);
+		_mm256_storeu_si256 ((__m256i *)&destination[i], BlitMaskAVX2 (s, d));
+		if (i == count - 32) break;
+	}
+}
+
+[[gnu::target("avx2")]] static void BlitRowReversedAVX2 (u8 *restrict destination, const u8 *restrict source_last, int count) {
+	if (count < 32) { BlitRowReversedSSE2 (destination, source_last, count); return; }
+	const __m256i reverse_lanes = _mm256_setr_epi8 (
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	for (int i = 0;; i += 32) {
+		if (i > count - 32) i = count - 32;
+		__m256i s = _mm256_loadu_si256 ((const __m256i *)&source_last[-i-31]);
+		s = _mm256_permute4x64_epi64 (_mm256_shuffle_epi8 (s, reverse_lanes), _MM_SHUFFLE (1, 0, 3, 2));
+		const __m256i d = _mm256_loadu_si256 ((const __m256i *)&destination[i]);
+		_mm256_storeu_si256 ((__m256i *)&destination[i], BlitMaskAVX2 (s, d));
+		if (i == count - 32) break;
+	}
+}
+#endif
+
+typedef struct {
+	void (*Row) (u8 *restrict destination, const u8 *restrict source, int count);
+	void (*RowReversed) (u8 *restrict destination, const u8 *restrict source_last, int count);
+} blit_kernel_t;
+static const blit_kernel_t blit_kernels[] = {
+	[sprite_blit_kernel_scalar] = {BlitRowScalar, BlitRowReversedScalar},
+#ifdef SPRITE_BLIT_X86
+	[sprite_blit_kernel_sse2] = {BlitRowSSE2, BlitRowReversedSSE2},
+	[sprite_blit_kernel_avx2] = {BlitRowAVX2, BlitRowReversedAVX2},
+#endif
+};
+// NULL until the first blit or sprite_SetBlitKernel. Only ever points into blit_kernels, so threads racing to pick one on the first frame store the same pointer.
+static const blit_kernel_t *_Atomic blit_kernel;
+
+sprite_blit_kernel_e sprite_SetBlitKernel (sprite_blit_kernel_e kernel) {
+	sprite_blit_kernel_e supported = sprite_blit_kernel_scalar;
+#ifdef SPRITE_BLIT_X86
+	if (__builtin_cpu_supports ("avx2")) supported = sprite_blit_kernel_avx2;
+	else if (__builtin_cpu_supports ("sse2")) supported = sprite_blit_kernel_sse2;
+#endif
+	if (kernel == sprite_blit_kernel_auto || kernel > supported) kernel = supported;
+	atomic_store_explicit (&blit_kernel, &blit_kernels[kernel], memory_order_relaxed);
+	return kernel;
+}
+
+static inline const blit_kernel_t *BlitKernel () {
+	const blit_kernel_t *kernel = atomic_load_explicit (&blit_kernel, memory_order_relaxed);
+	if (kernel) return kernel;
+	return &blit_kernels[sprite_SetBlitKernel (sprite_blit_kernel_auto)];
+}
+
+// Palette swapped rows are looked up into a small buffer which is then blitted with the plain kernel. The transparency test is on the swapped value, same as the per-pixel blits.
+static void BlitRowColorSwap (u8 *restrict destination, const u8 *restrict source, int step, int count, const u8 color_swap_palette[256]) {
+	u8 swapped[256];
+	while (count > 0) {
+		const int n = MIN(count, (int)sizeof(swapped));
+		for (int i = 0; i < n; ++i, source += step)
+			swapped[i] = color_swap_palette[*source];
+		BlitKernel ()->Row (destination, swapped, n);
+		destination += n;
+		count -= n;
+	}
+}
+
+// --------------------------------------------------------------------------------
+
+// Opaque span tables
+
+static int CountRuns (const u8 *row, int w) {
+	int runs = 0;
+	for (int x = 0; x < w; ++x)
+		if (row[x] != 0 && (x == 0 || row[x-1] == 0)) ++runs;
+	return runs;
+}
+
+size_t sprite_SpansSize (const sprite_t *sprite) {
+	size_t runs = 0;
+	for (int y = 0; y < sprite->h; ++y) runs += CountRuns (&sprite->p[y * sprite->w], sprite->w);
+	return sizeof (sprite_spans_t) + (sprite->h + 1) * sizeof (u32) + runs * sizeof (sprite_span_t);
+}
+
+const sprite_spans_t *sprite_BuildSpans (const sprite_t *sprite, void *storage, size_t storage_size) {
+	if (storage_size < sprite_SpansSize (sprite)) return NULL;
+	sprite_spans_t *spans = storage;
+	u32 *row = (u32 *)&spans[1];
+	sprite_span_t *runs = (sprite_span_t *)&row[sprite->h + 1];
+	u32 count = 0;
+	for (int y = 0; y < sprite->h; ++y) {
+		const u8 *pixels = &sprite->p[y * sprite->w];
+		row[y] = count;
+		for (int x = 0; x < sprite->w; ++x) {
+			if (pixels[x] == 0) continue;
+			const int start = x;
+			while (x < sprite->w && pixels[x] != 0) ++x;
+			runs[count++] = (sprite_span_t){.start = start, .length = x - start};
+		}
+	}
+	row[sprite->h] = count;
+	*spans = (sprite_spans_t){.row = row, .runs = runs};
+	return spans;
+}
+
+#ifndef SPRITE_SPANS_ARENA_SIZE
+#define SPRITE_SPANS_ARENA_SIZE (256*1024)
+#endif
+#ifndef SPRITE_SPANS_MAX
+#define SPRITE_SPANS_MAX 256
+#endif
+
+// Open addressing by sprite address. The table is never more than 3/4 full so lookups always reach an empty slot. Entries are published by storing the sprite pointer last, so render threads can look up while sprite_LoadSpans runs.
+static struct {
+	alignas (max_align_t) u8 arena[SPRITE_SPANS_ARENA_SIZE];
+	size_t arena_used;
+	_Atomic int count; // Read by FindSpans to skip the probe while nothing's loaded
+	struct {
+		const sprite_t *_Atomic sprite;
+		const sprite_spans_t *spans;
+	} table[SPRITE_SPANS_MAX * 4 / 3 + 1];
+} loaded_spans;
+
+static inline size_t LoadedSpansSlot (const sprite_t *sprite) {
+	return (size_t)(((uintptr_t)sprite >> 3) * 0x9E3779B97F4A7C15ull >> 32) % _Countof (loaded_spans.table);
+}
+
+bool sprite_LoadSpans (const sprite_t *sprite) {
+	size_t slot = LoadedSpansSlot (sprite);
+	for (const sprite_t *at; (at = atomic_load_explicit (&loaded_spans.table[slot].sprite, memory_order_relaxed)) != NULL; slot = (slot + 1) % _Countof (loaded_spans.table))
+		if (at == sprite) return true;
+	if (loaded_spans.count >= SPRITE_SPANS_MAX) {
+		LOG ("Can't load spans for sprite %p: SPRITE_SPANS_MAX (%d) sprites already loaded", sprite, SPRITE_SPANS_MAX);
+		return false;
+	}
+	const size_t size = (sprite_SpansSize (sprite) + alignof (max_align_t) - 1) & ~(alignof (max_align_t) - 1);
+	if (loaded_spans.arena_used + size > sizeof (loaded_spans.arena)) {
+		LOG ("Can't load spans for sprite %p: %zu bytes needed, %zu left in SPRITE_SPANS_ARENA_SIZE", sprite, size, sizeof (loaded_spans.arena) - loaded_spans.arena_used);
+		return false;
+	}
+	loaded_spans.table[slot].spans = sprite_BuildSpans (sprite, &loaded_spans.arena[loaded_spans.arena_used], size);
+	loaded_spans.arena_used += size;
+	++loaded_spans.count;
+	atomic_store_explicit (&loaded_spans.table[slot].sprite, sprite, memory_order_release);
+	return true;
+}
+
+static inline const sprite_spans_t *FindSpans (const sprite_t *sprite) {
+	if (sprite->spans) return sprite->spans;
+	if (atomic_load_explicit (&loaded_spans.count, memory_order_relaxed) == 0) return NULL;
+	for (size_t slot = LoadedSpansSlot (sprite);; slot = (slot + 1) % _Countof (loaded_spans.table)) {
+		const sprite_t *at = atomic_load_explicit (&loaded_spans.table[slot].sprite, memory_order_acquire);
+		if (at == sprite) return loaded_spans.table[slot].spans;
+		if (at == NULL) return NULL;
+	}
+}
+
+// From the start of a row's first run to the end of its last. The plain and flipped blits run their kernel across this rather than copying each run, since masked vector writes beat a call per run when runs are short; it still skips the transparent margins. Row sy must have a run.
+static inline sprite_span_t RowExtent (const sprite_spans_t *spans, int sy) {
+	const sprite_span_t first = spans->runs[spans->row[sy]], last = spans->runs[spans->row[sy+1]-1];
+	return (sprite_span_t){.start = first.start, .length = last.start + last.length - first.start};
+}
+
+// Clips a run on source row to the destination columns left to right. mirror_w is 0 for unflipped blits, or the source width-1 to mirror the run for horizontally flipped ones. Returns false if nothing is left.
+static inline bool ClipSpan (sprite_span_t run, int x, int mirror_w, int left, int right, int *l, int *r) {
+	int start = run.start, end = run.start + run.length - 1;
+	if (mirror_w) {
+		start = mirror_w - end;
+		end = mirror_w - run.start;
+	}
+	*l = MAX(left, x + start);
+	*r = MIN(right, x + end);
+	return *l <= *r;
+}
+
+// --------------------------------------------------------------------------------
+
+// Rotated sampling
+
+typedef enum {sample_write_pixel, sample_write_color, sample_write_color_swap} sample_write_e;
+
+// Narrows [*first, *last] to the k where 0 <= start + k*step < limit. Returns false if none are left. The bounds are estimated in floating point and then nudged until they satisfy the exact integer test, which is cheaper than 64 bit integer division.
+static inline bool ClipSampleSpan (i64 start, i64 step, i64 limit, int *first, int *last) {
+	if (step == 0) return start >= 0 && start < limit && *first <= *last;
+	#define INSIDE(k__) (start + (k__)*step >= 0 && start + (k__)*step < limit)
+	f64 a = -start / (f64)step, b = (limit-1 - start) / (f64)step;
+	if (a > b) { f64 swap = a; a = b; b = swap; }
+	i64 lo = (i64)ceil (a), hi = (i64)floor (b);
+	while (!INSIDE (lo) && lo <= hi) ++lo;
+	while (lo > *first && INSIDE (lo-1)) --lo;
+	while (!INSIDE (hi) && hi >= lo) --hi;
+	while (hi < *last && INSIDE (hi+1)) ++hi;
+	#undef INSIDE
+	if (lo > *first) *first = lo;
+	if (hi < *last) *last = hi;
+	return *first <= *last;
+}
+
+// Every rotated sample variant is this function with constant flip and write arguments, so each gets its own loop. Destination pixels are mapped back into the source in 16.16 fixed point: along a row the source position moves by a constant step, and the columns where it lands inside the source are solved for each row up front, so the inner loop never tests bounds. Positions only depend on the pixel's offset from x,y, so drawing the sprite and destination moved by the same whole number of pixels gives the same pixels (render.c draws in bands this way).
+[[gnu::always_inline]] static inline void SampleRotated (const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, bool flipx, bool flipy, sample_write_e write, u8 color, const u8 *color_swap_palette) {
+	f32 sin_angle = sin_turns(angle);
+	f32 cos_angle = cos_turns(angle);
+	f32 sin_bangle = sin_turns(angle + 0.25f);
+	f32 cos_bangle = cos_turns(angle + 0.25f);
+
+	f32 b = -originy;
+	f32 t = source->h-originy;
+	int corners[] = {
+		(int)floorf(-originx*sin_angle + b*cos_angle) + y,
+		(int)floorf(-originx*sin_angle + t*cos_angle) + y,
+		(int)floorf((source->w-originx)*sin_angle + b*cos_angle) + y,
+		(int)floorf((source->w-originx)*sin_angle + t*cos_angle) + y,
+	};
+	const int bottom = MAX(0, MIN(corners[0], MIN(corners[1], MIN(corners[2], corners[3]))));
+	const int top =    MIN(destination->h-1, MAX(corners[0], MAX(corners[1], MAX(corners[2], corners[3])))+1);
+
+	// Source position of the pixel at sprite offset (spritex, spritey) is u = spritex*du - spritey*dv + originx, v = spritex*dv + spritey*du + originy
+	const i64 du = llroundf (sin_bangle * 65536), dv = llroundf (cos_bangle * 65536);
+	const i64 u_origin = llroundf (originx * 65536), v_origin = llroundf (originy * 65536);
+	const i64 u_limit = (i64)source->w << 16, v_limit = (i64)source->h << 16;
+	const int source_right = source->w-1, source_top = source->h-1;
+
+	for (int ty = bottom; ty <= top; ++ty) {
+		const int spritey = ty-y;
+		const i64 u0 = u_origin - spritey*dv, v0 = v_origin + spritey*du;
+		int first = -x, last = destination->w-1 - x;
+		if (!ClipSampleSpan (u0, du, u_limit, &first, &last) || !ClipSampleSpan (v0, dv, v_limit, &first, &last)) continue;
+		// Inside the span u and v are in [0, 2^32), so they wrap back into range when stepped as u32
+		u32 u = u0 + first*du, v = v0 + first*dv;
+		u8 *out = &destination->p[first + x + ty*destination->w];
+		for (int i = first; i <= last; ++i, u += du, v += dv, ++out) {
+			int sourcex = u >> 16, sourcey = v >> 16;
+			if (flipx) sourcex = source_right - sourcex;
+			if (flipy) sourcey = source_top - sourcey;
+			u8 pixel = source->p[sourcex + sourcey * source->w];
+			if (write == sample_write_color_swap) pixel = color_swap_palette[pixel];
+			if (pixel != 0) *out = write == sample_write_color ? color : pixel;
+		}
+	}
+}
+
+// --------------------------------------------------------------------------------
+
 // Base functions (copy-paste this whole section and edit to create new variants)
 
 void sprite_Blit(const sprite_t *source, sprite_t *destination, int x, int y) {
@@ -80,13 +404,20 @@ void sprite_Blit(const sprite_t *source, sprite_t *destination, int x, int y) {
 	right   = MIN(destination->w-1, x+source->w-1);
 	bottom  = MAX(0, y);
 	top     = MIN(destination->h-1, y+source->h-1);
-	for(int y2 = bottom; y2 <= top; ++y2) {
-		for(int x2 = left; x2 <= right; ++x2) {
-			u8 source_pixel = source->p[x2-x + (y2-y)*source->w];
-			if (source_pixel != 0)
-				destination->p[x2 + y2*destination->w] = source_pixel;
+	const sprite_spans_t *spans = FindSpans (source);
+	if (spans) {
+		for(int y2 = bottom; y2 <= top; ++y2) {
+			const int sy = y2-y;
+			u8 *row = &destination->p[y2*destination->w];
+			if (spans->row[sy] == spans->row[sy+1]) continue;
+			int l, r;
+			if (ClipSpan (RowExtent (spans, sy), x, 0, left, right, &l, &r))
+				BlitKernel ()->Row (&row[l], &source->p[l-x + sy*source->w], r-l+1);
 		}
+		return;
 	}
+	for(int y2 = bottom; y2 <= top; ++y2)
+		BlitKernel ()->Row (&destination->p[left + y2*destination->w], &source->p[left-x + (y2-y)*source->w], right-left+1);
 }
 
 void sprite_BlitRotated90(const sprite_t *source, sprite_t *destination, int x, int y, int originx, int originy) {
@@ -148,13 +479,20 @@ void sprite_BlitFlippedHorizontally(const sprite_t *source, sprite_t *destinatio
 	bottom  = MAX(0, y);
 	top     = MIN(destination->h-1, y+source->h-1);
 	w = source->w-1;
-	for(int y2 = bottom; y2 <= top; ++y2) {
-		for(int x2 = left; x2 <= right; ++x2) {
-			u8 source_pixel = source->p[w - (x2-x) + (y2-y)*source->w];
-			if (source_pixel != 0)
-				destination->p[x2 + y2*destination->w] = source_pixel;
+	const sprite_spans_t *spans = FindSpans (source);
+	if (spans) {
+		for(int y2 = bottom; y2 <= top; ++y2) {
+			const int sy = y2-y;
+			u8 *row = &destination->p[y2*destination->w];
+			if (spans->row[sy] == spans->row[sy+1]) continue;
+			int l, r;
+			if (ClipSpan (RowExtent (spans, sy), x, w, left, right, &l, &r))
+				BlitKernel ()->RowReversed (&row[l], &source->p[w - (l-x) + sy*source->w], r-l+1);
 		}
+		return;
 	}
+	for(int y2 = bottom; y2 <= top; ++y2)
+		BlitKernel ()->RowReversed (&destination->p[left + y2*destination->w], &source->p[w - (left-x) + (y2-y)*source->w], right-left+1);
 }
 
 void sprite_BlitFlippedVertically(const sprite_t *source, sprite_t *destination, int x, int y) {
@@ -164,163 +502,32 @@ void sprite_BlitFlippedVertically(const sprite_t *source, sprite_t *destination,
 	bottom  = MAX(0, y);
 	top     = MIN(destination->h-1, y+source->h-1);
 	h = source->h-1;
-	for(int y2 = bottom; y2 <= top; ++y2) {
-		for(int x2 = left; x2 <= right; ++x2) {
-			u8 source_pixel = source->p[x2-x + (h-(y2-y))*source->w];
-			if (source_pixel != 0)
-				destination->p[x2 + y2*destination->w] = source_pixel;
+	const sprite_spans_t *spans = FindSpans (source);
+	if (spans) {
+		for(int y2 = bottom; y2 <= top; ++y2) {
+			const int sy = h-(y2-y);
+			u8 *row = &destination->p[y2*destination->w];
+			if (spans->row[sy] == spans->row[sy+1]) continue;
+			int l, r;
+			if (ClipSpan (RowExtent (spans, sy), x, 0, left, right, &l, &r))
+				BlitKernel ()->Row (&row[l], &source->p[l-x + sy*source->w], r-l+1);
 		}
+		return;
 	}
+	for(int y2 = bottom; y2 <= top; ++y2)
+		BlitKernel ()->Row (&destination->p[left + y2*destination->w], &source->p[left-x + (h-(y2-y))*source->w], right-left+1);
 }
 
 void sprite_SampleRotated(const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy) {
-	f32 sin_angle = sin_turns(angle);
-	f32 cos_angle = cos_turns(angle);
-	f32 sin_bangle = sin_turns(angle + 0.25f);
-	f32 cos_bangle = cos_turns(angle + 0.25f);
-
-	f32 l = -originx;
-	f32 r = source->w-originx;
-	f32 b = -originy;
-	f32 t = source->h-originy;
-
-	int corners[] = {
-		(int)(l*cos_angle - b*sin_angle + x),
-		(int)(l*sin_angle + b*cos_angle + y),
-
-		(int)(l*cos_angle - t*sin_angle + x),
-		(int)(l*sin_angle + t*cos_angle + y),
-
-		(int)(r*cos_angle - b*sin_angle + x),
-		(int)(r*sin_angle + b*cos_angle + y),
-
-		(int)(r*cos_angle - t*sin_angle + x),
-		(int)(r*sin_angle + t*cos_angle + y),
-	};
-
-	int left =   MIN(destination->w-1, MAX(0, MIN(corners[0], MIN(corners[2], MIN(corners[4], corners[6])))  ));
-	int right =  MIN(destination->w-1, MAX(0, MAX(corners[0], MAX(corners[2], MAX(corners[4], corners[6])))+1));
-	int bottom = MIN(destination->h-1, MAX(0, MIN(corners[1], MIN(corners[3], MIN(corners[5], corners[7])))  ));
-	int top =    MIN(destination->h-1, MAX(0, MAX(corners[1], MAX(corners[3], MAX(corners[5], corners[7])))+1));
-
-	int tx, ty;
-	int spritex, spritey;
-	int sourcex, sourcey;
-	u8 pixel;
-	u32 destination_pixel_index;
-
-	for(ty = bottom; ty <= top; ty++){
-		for(tx = left; tx <= right; tx++){
-			spritex = tx-x;
-			spritey = ty-y;
-			sourcex = (int)(spritex*sin_bangle - spritey*cos_bangle + originx + 1) - 1;
-			sourcey = (int)(spritex*cos_bangle + spritey*sin_bangle + originy + 1) - 1;
-			if (sourcex < 0 || sourcex > source->w-1 || sourcey < 0 || sourcey > source->h-1
-			 || (pixel = source->p[sourcex + sourcey * source->w])  == 0) continue;
-			destination_pixel_index = tx + ty * destination->w;
-			destination->p[destination_pixel_index] = pixel;
-		}
-	}
+	SampleRotated (source, destination, x, y, angle, originx, originy, false, false, sample_write_pixel, 0, NULL);
 }
 
 void sprite_SampleRotatedFlipX (const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy) {
-	f32 sin_angle = sin_turns(angle);
-	f32 cos_angle = cos_turns(angle);
-	f32 sin_bangle = sin_turns(angle + 0.25f);
-	f32 cos_bangle = cos_turns(angle + 0.25f);
-
-	f32 l = -originx;
-	f32 r = source->w-originx;
-	f32 b = -originy;
-	f32 t = source->h-originy;
-
-	int corners[] = {
-		(int)(l*cos_angle - b*sin_angle + x),
-		(int)(l*sin_angle + b*cos_angle + y),
-
-		(int)(l*cos_angle - t*sin_angle + x),
-		(int)(l*sin_angle + t*cos_angle + y),
-
-		(int)(r*cos_angle - b*sin_angle + x),
-		(int)(r*sin_angle + b*cos_angle + y),
-
-		(int)(r*cos_angle - t*sin_angle + x),
-		(int)(r*sin_angle + t*cos_angle + y),
-	};
-
-	int left =   MIN(destination->w-1, MAX(0, MIN(corners[0], MIN(corners[2], MIN(corners[4], corners[6])))  ));
-	int right =  MIN(destination->w-1, MAX(0, MAX(corners[0], MAX(corners[2], MAX(corners[4], corners[6])))+1));
-	int bottom = MIN(destination->h-1, MAX(0, MIN(corners[1], MIN(corners[3], MIN(corners[5], corners[7])))  ));
-	int top =    MIN(destination->h-1, MAX(0, MAX(corners[1], MAX(corners[3], MAX(corners[5], corners[7])))+1));
-
-	int tx, ty;
-	int spritex, spritey;
-	int sourcex, sourcey;
-	u8 pixel;
-	u32 destination_pixel_index;
-
-	for(ty = bottom; ty <= top; ty++){
-		for(tx = left; tx <= right; tx++){
-			spritex = tx-x;
-			spritey = ty-y;
-			sourcex = source->w-1 - ((int)(spritex*sin_bangle - spritey*cos_bangle + originx + 1) - 1);
-			sourcey =               (int)(spritex*cos_bangle + spritey*sin_bangle + originy + 1) - 1;
-			if (sourcex < 0 || sourcex > source->w-1 || sourcey < 0 || sourcey > source->h-1
-			 || (pixel = source->p[sourcex + sourcey * source->w])  == 0) continue;
-			destination_pixel_index = tx + ty * destination->w;
-			destination->p[destination_pixel_index] = pixel;
-		}
-	}
+	SampleRotated (source, destination, x, y, angle, originx, originy, true, false, sample_write_pixel, 0, NULL);
 }
 
 void sprite_SampleRotatedFlipY (const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy) {
-	f32 sin_angle = sin_turns(angle);
-	f32 cos_angle = cos_turns(angle);
-
-	f32 l = -originx;
-	f32 r = source->w-originx;
-	f32 b = -originy;
-	f32 t = source->h-originy;
-
-	int corners[] = {
-		(int)(l*cos_angle - b*sin_angle + x),
-		(int)(l*sin_angle + b*cos_angle + y),
-
-		(int)(l*cos_angle - t*sin_angle + x),
-		(int)(l*sin_angle + t*cos_angle + y),
-
-		(int)(r*cos_angle - b*sin_angle + x),
-		(int)(r*sin_angle + b*cos_angle + y),
-
-		(int)(r*cos_angle - t*sin_angle + x),
-		(int)(r*sin_angle + t*cos_angle + y),
-	};
-
-	int left =   MIN(destination->w-1, MAX(0, MIN(corners[0], MIN(corners[2], MIN(corners[4], corners[6])))  ));
-	int right =  MIN(destination->w-1, MAX(0, MAX(corners[0], MAX(corners[2], MAX(corners[4], corners[6])))+1));
-	int bottom = MIN(destination->h-1, MAX(0, MIN(corners[1], MIN(corners[3], MIN(corners[5], corners[7])))  ));
-	int top =    MIN(destination->h-1, MAX(0, MAX(corners[1], MAX(corners[3], MAX(corners[5], corners[7])))+1));
-
-	int tx, ty;
-	int spritex, spritey;
-	int sourcex, sourcey;
-	u8 pixel;
-	u32 destination_pixel_index;
-	f32 sin_bangle = sin_turns(angle + 0.25f);
-	f32 cos_bangle = cos_turns(angle + 0.25f);
-
-	for(ty = bottom; ty <= top; ty++){
-		for(tx = left; tx <= right; tx++){
-			spritex = tx-x;
-			spritey = ty-y;
-			sourcex =               (int)(spritex*sin_bangle - spritey*cos_bangle + originx + 1) - 1;
-			sourcey = source->h-1 - ((int)(spritex*cos_bangle + spritey*sin_bangle + originy + 1) - 1);
-			if (sourcex < 0 || sourcex > source->w-1 || sourcey < 0 || sourcey > source->h-1
-			 || (pixel = source->p[sourcex + sourcey * source->w])  == 0) continue;
-			destination_pixel_index = tx + ty * destination->w;
-			destination->p[destination_pixel_index] = pixel;
-		}
-	}
+	SampleRotated (source, destination, x, y, angle, originx, originy, false, true, sample_write_pixel, 0, NULL);
 }
 
 void sprite_SampleRotatedFlipped(const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, bool flipx, bool flipy) {
@@ -344,6 +551,19 @@ void sprite_BlitColor(const sprite_t *source, sprite_t *destination, int x, int
 	right   = MIN(destination->w-1, x+source->w-1);
 	bottom  = MAX(0, y);
 	top     = MIN(destination->h-1, y+source->h-1);
+	const sprite_spans_t *spans = FindSpans (source);
+	if (spans) {
+		for(int y2 = bottom; y2 <= top; ++y2) {
+			const int sy = y2-y;
+			u8 *row = &destination->p[y2*destination->w];
+			for (u32 i = spans->row[sy]; i < spans->row[sy+1]; ++i) {
+				int l, r;
+				if (ClipSpan (spans->runs[i], x, 0, left, right, &l, &r))
+					memset (&row[l], color, r-l+1);
+			}
+		}
+		return;
+	}
 	for(int y2 = bottom; y2 <= top; ++y2) {
 		for(int x2 = left; x2 <= right; ++x2) {
 			u8 source_pixel = source->p[x2-x + (y2-y)*source->w];
@@ -412,6 +632,19 @@ void sprite_BlitFlippedHorizontallyColor(const sprite_t *source, sprite_t *desti
 	bottom  = MAX(0, y);
 	top     = MIN(destination->h-1, y+source->h-1);
 	w = source->w-1;
+	const sprite_spans_t *spans = FindSpans (source);
+	if (spans) {
+		for(int y2 = bottom; y2 <= top; ++y2) {
+			const int sy = y2-y;
+			u8 *row = &destination->p[y2*destination->w];
+			for (u32 i = spans->row[sy]; i < spans->row[sy+1]; ++i) {
+				int l, r;
+				if (ClipSpan (spans->runs[i], x, w, left, right, &l, &r))
+					memset (&row[l], color, r-l+1);
+			}
+		}
+		return;
+	}
 	for(int y2 = bottom; y2 <= top; ++y2) {
 		for(int x2 = left; x2 <= right; ++x2) {
 			u8 source_pixel = source->p[w - (x2-x) + (y2-y)*source->w];
@@ -428,6 +661,19 @@ void sprite_BlitFlippedVerticallyColor(const sprite_t *source, sprite_t *destina
 	bottom  = MAX(0, y);
 	top     = MIN(destination->h-1, y+source->h-1);
 	h = source->h-1;
+	const sprite_spans_t *spans = FindSpans (source);
+	if (spans) {
+		for(int y2 = bottom; y2 <= top; ++y2) {
+			const int sy = h-(y2-y);
+			u8 *row = &destination->p[y2*destination->w];
+			for (u32 i = spans->row[sy]; i < spans->row[sy+1]; ++i) {
+				int l, r;
+				if (ClipSpan (spans->runs[i], x, 0, left, right, &l, &r))
+					memset (&row[l], color, r-l+1);
+			}
+		}
+		return;
+	}
 	for(int y2 = bottom; y2 <= top; ++y2) {
 		for(int x2 = left; x2 <= right; ++x2) {
 			u8 source_pixel = source->p[x2-x + (h-(y2-y))*source->w];
@@ -438,153 +684,15 @@ void sprite_BlitFlippedVerticallyColor(const sprite_t *source, sprite_t *destina
 }
 
 void sprite_SampleRotatedColor(const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, u8 color) {
-	f32 sin_angle = sin_turns(angle);
-	f32 cos_angle = cos_turns(angle);
-	f32 sin_bangle = sin_turns(angle + 0.25f);
-	f32 cos_bangle = cos_turns(angle + 0.25f);
-
-	f32 l = -originx;
-	f32 r = source->w-originx;
-	f32 b = -originy;
-	f32 t = source->h-originy;
-
-	int corners[] = {
-		(int)(l*cos_angle - b*sin_angle + x),
-		(int)(l*sin_angle + b*cos_angle + y),
-
-		(int)(l*cos_angle - t*sin_angle + x),
-		(int)(l*sin_angle + t*cos_angle + y),
-
-		(int)(r*cos_angle - b*sin_angle + x),
-		(int)(r*sin_angle + b*cos_angle + y),
-
-		(int)(r*cos_angle - t*sin_angle + x),
-		(int)(r*sin_angle + t*cos_angle + y),
-	};
-
-	int left =   MIN(destination->w-1, MAX(0, MIN(corners[0], MIN(corners[2], MIN(corners[4], corners[6])))  ));
-	int right =  MIN(destination->w-1, MAX(0, MAX(corners[0], MAX(corners[2], MAX(corners[4], corners[6])))+1));
-	int bottom = MIN(destination->h-1, MAX(0, MIN(corners[1], MIN(corners[3], MIN(corners[5], corners[7])))  ));
-	int top =    MIN(destination->h-1, MAX(0, MAX(corners[1], MAX(corners[3], MAX(corners[5], corners[7])))+1));
-
-	int tx, ty;
-	int spritex, spritey;
-	int sourcex, sourcey;
-	u8 pixel;
-	u32 destination_pixel_index;
-
-	for(ty = bottom; ty <= top; ty++){
-		for(tx = left; tx <= right; tx++){
-			spritex = tx-x;
-			spritey = ty-y;
-			sourcex = (int)(spritex*sin_bangle - spritey*cos_bangle + originx + 1) - 1;
-			sourcey = (int)(spritex*cos_bangle + spritey*sin_bangle + originy + 1) - 1;
-			if (sourcex < 0 || sourcex > source->w-1 || sourcey < 0 || sourcey > source->h-1
-			 || (pixel = source->p[sourcex + sourcey * source->w]) == 0) continue;
-			destination_pixel_index = tx + ty * destination->w;
-			destination->p[destination_pixel_index] = color;
-		}
-	}
+	SampleRotated (source, destination, x, y, angle, originx, originy, false, false, sample_write_color, color, NULL);
 }
 
 void sprite_SampleRotatedFlipXColor (const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, u8 color) {
-	f32 sin_angle = sin_turns(angle);
-	f32 cos_angle = cos_turns(angle);
-	f32 sin_bangle = sin_turns(angle + 0.25f);
-	f32 cos_bangle = cos_turns(angle + 0.25f);
-
-	f32 l = -originx;
-	f32 r = source->w-originx;
-	f32 b = -originy;
-	f32 t = source->h-originy;
-
-	int corners[] = {
-		(int)(l*cos_angle - b*sin_angle + x),
-		(int)(l*sin_angle + b*cos_angle + y),
-
-		(int)(l*cos_angle - t*sin_angle + x),
-		(int)(l*sin_angle + t*cos_angle + y),
-
-		(int)(r*cos_angle - b*sin_angle + x),
-		(int)(r*sin_angle + b*cos_angle + y),
-
-		(int)(r*cos_angle - t*sin_angle + x),
-		(int)(r*sin_angle + t*cos_angle + y),
-	};
-
-	int left =   MIN(destination->w-1, MAX(0, MIN(corners[0], MIN(corners[2], MIN(corners[4], corners[6])))  ));
-	int right =  MIN(destination->w-1, MAX(0, MAX(corners[0], MAX(corners[2], MAX(corners[4], corners[6])))+1));
-	int bottom = MIN(destination->h-1, MAX(0, MIN(corners[1], MIN(corners[3], MIN(corners[5], corners[7])))  ));
-	int top =    MIN(destination->h-1, MAX(0, MAX(corners[1], MAX(corners[3], MAX(corners[5], corners[7])))+1));
-
-	int tx, ty;
-	int spritex, spritey;
-	int sourcex, sourcey;
-	u8 pixel;
-	u32 destination_pixel_index;
-
-	for(ty = bottom; ty <= top; ty++){
-		for(tx = left; tx <= right; tx++){
-			spritex = tx-x;
-			spritey = ty-y;
-			sourcex = source->w-1 - ((int)(spritex*sin_bangle - spritey*cos_bangle + originx + 1) - 1);
-			sourcey =               (int)(spritex*cos_bangle + spritey*sin_bangle + originy + 1) - 1;
-			if (sourcex < 0 || sourcex > source->w-1 || sourcey < 0 || sourcey > source->h-1
-			 || (pixel = source->p[sourcex + sourcey * source->w])  == 0) continue;
-			destination_pixel_index = tx + ty * destination->w;
-			destination->p[destination_pixel_index] = color;
-		}
-	}
+	SampleRotated (source, destination, x, y, angle, originx, originy, true, false, sample_write_color, color, NULL);
 }
 
 void sprite_SampleRotatedFlipYColor (const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, u8 color) {
-	f32 sin_angle = sin_turns(angle);
-	f32 cos_angle = cos_turns(angle);
-
-	f32 l = -originx;
-	f32 r = source->w-originx;
-	f32 b = -originy;
-	f32 t = source->h-originy;
-
-	int corners[] = {
-		(int)(l*cos_angle - b*sin_angle + x),
-		(int)(l*sin_angle + b*cos_angle + y),
-
-		(int)(l*cos_angle - t*sin_angle + x),
-		(int)(l*sin_angle + t*cos_angle + y),
-
-		(int)(r*cos_angle - b*sin_angle + x),
-		(int)(r*sin_angle + b*cos_angle + y),
-
-		(int)(r*cos_angle - t*sin_angle + x),
-		(int)(r*sin_angle + t*cos_angle + y),
-	};
-
-	int left =   MIN(destination->w-1, MAX(0, MIN(corners[0], MIN(corners[2], MIN(corners[4], corners[6])))  ));
-	int right =  MIN(destination->w-1, MAX(0, MAX(corners[0], MAX(corners[2], MAX(corners[4], corners[6])))+1));
-	int bottom = MIN(destination->h-1, MAX(0, MIN(corners[1], MIN(corners[3], MIN(corners[5], corners[7])))  ));
-	int top =    MIN(destination->h-1, MAX(0, MAX(corners[1], MAX(corners[3], MAX(corners[5], corners[7])))+1));
-
-	int tx, ty;
-	int spritex, spritey;
-	int sourcex, sourcey;
-	u8 pixel;
-	u32 destination_pixel_index;
-	f32 sin_bangle = sin_turns(angle + 0.25f);
-	f32 cos_bangle = cos_turns(angle + 0.25f);
-
-	for(ty = bottom; ty <= top; ty++){
-		for(tx = left; tx <= right; tx++){
-			spritex = tx-x;
-			spritey = ty-y;
-			sourcex =               (int)(spritex*sin_bangle - spritey*cos_bangle + originx + 1) - 1;
-			sourcey = source->h-1 - ((int)(spritex*cos_bangle + spritey*sin_bangle + originy + 1) - 1);
-			if (sourcex < 0 || sourcex > source->w-1 || sourcey < 0 || sourcey > source->h-1
-			 || (pixel = source->p[sourcex + sourcey * source->w])  == 0) continue;
-			destination_pixel_index = tx + ty * destination->w;
-			destination->p[destination_pixel_index] = color;
-		}
-	}
+	SampleRotated (source, destination, x, y, angle, originx, originy, false, true, sample_write_color, color, NULL);
 }
 
 void sprite_SampleRotatedFlippedColor(const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, bool flipx, bool flipy, u8 color) {
@@ -630,13 +738,8 @@ void sprite_BlitColorSwap(const sprite_t *source, sprite_t *destination, int x,
 	right   = MIN(destination->w-1, x+source->w-1);
 	bottom  = MAX(0, y);
 	top     = MIN(destination->h-1, y+source->h-1);
-	for(int y2 = bottom; y2 <= top; ++y2) {
-		for(int x2 = left; x2 <= right; ++x2) {
-			u8 source_pixel = color_swap_palette[source->p[x2-x + (y2-y)*source->w]];
-			if (source_pixel != 0)
-				destination->p[x2 + y2*destination->w] = source_pixel;
-		}
-	}
+	for(int y2 = bottom; y2 <= top; ++y2)
+		BlitRowColorSwap (&destination->p[left + y2*destination->w], &source->p[left-x + (y2-y)*source->w], 1, right-left+1, color_swap_palette);
 }
 
 void sprite_BlitColorSwapRotated90(const sprite_t *source, sprite_t *destination, int x, int y, int originx, int originy, const u8 color_swap_palette[256]) {
@@ -698,13 +801,8 @@ void sprite_BlitColorSwapFlippedHorizontally(const sprite_t *source, sprite_t *d
 	bottom  = MAX(0, y);
 	top     = MIN(destination->h-1, y+source->h-1);
 	w = source->w-1;
-	for(int y2 = bottom; y2 <= top; ++y2) {
-		for(int x2 = left; x2 <= right; ++x2) {
-			u8 source_pixel = color_swap_palette[source->p[w - (x2-x) + (y2-y)*source->w]];
-			if (source_pixel != 0)
-				destination->p[x2 + y2*destination->w] = source_pixel;
-		}
-	}
+	for(int y2 = bottom; y2 <= top; ++y2)
+		BlitRowColorSwap (&destination->p[left + y2*destination->w], &source->p[w - (left-x) + (y2-y)*source->w], -1, right-left+1, color_swap_palette);
 }
 
 void sprite_BlitColorSwapFlippedVertically(const sprite_t *source, sprite_t *destination, int x, int y, const u8 color_swap_palette[256]) {
@@ -714,163 +812,20 @@ void sprite_BlitColorSwapFlippedVertically(const sprite_t *source, sprite_t *des
 	bottom  = MAX(0, y);
 	top     = MIN(destination->h-1, y+source->h-1);
 	h = source->h-1;
-	for(int y2 = bottom; y2 <= top; ++y2) {
-		for(int x2 = left; x2 <= right; ++x2) {
-			u8 source_pixel = color_swap_palette[source->p[x2-x + (h-(y2-y))*source->w]];
-			if (source_pixel != 0)
-				destination->p[x2 + y2*destination->w] = source_pixel;
-		}
-	}
+	for(int y2 = bottom; y2 <= top; ++y2)
+		BlitRowColorSwap (&destination->p[left + y2*destination->w], &source->p[left-x + (h-(y2-y))*source->w], 1, right-left+1, color_swap_palette);
 }
 
 void sprite_SampleColorSwapRotated(const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, const u8 color_swap_palette[256]) {
-	f32 sin_angle = sin_turns(angle);
-	f32 cos_angle = cos_turns(angle);
-	f32 sin_bangle = sin_turns(angle + 0.25f);
-	f32 cos_bangle = cos_turns(angle + 0.25f);
-
-	f32 l = -originx;
-	f32 r = source->w-originx;
-	f32 b = -originy;
-	f32 t = source->h-originy;
-
-	int corners[] = {
-		(int)(l*cos_angle - b*sin_angle + x),
-		(int)(l*sin_angle + b*cos_angle + y),
-
-		(int)(l*cos_angle - t*sin_angle + x),
-		(int)(l*sin_angle + t*cos_angle + y),
-
-		(int)(r*cos_angle - b*sin_angle + x),
-		(int)(r*sin_angle + b*cos_angle + y),
-
-		(int)(r*cos_angle - t*sin_angle + x),
-		(int)(r*sin_angle + t*cos_angle + y),
-	};
-
-	int left =   MIN(destination->w-1, MAX(0, MIN(corners[0], MIN(corners[2], MIN(corners[4], corners[6])))  ));
-	int right =  MIN(destination->w-1, MAX(0, MAX(corners[0], MAX(corners[2], MAX(corners[4], corners[6])))+1));
-	int bottom = MIN(destination->h-1, MAX(0, MIN(corners[1], MIN(corners[3], MIN(corners[5], corners[7])))  ));
-	int top =    MIN(destination->h-1, MAX(0, MAX(corners[1], MAX(corners[3], MAX(corners[5], corners[7])))+1));
-
-	int tx, ty;
-	int spritex, spritey;
-	int sourcex, sourcey;
-	u8 pixel;
-	u32 destination_pixel_index;
-
-	for(ty = bottom; ty <= top; ty++){
-		for(tx = left; tx <= right; tx++){
-			spritex = tx-x;
-			spritey = ty-y;
-			sourcex = (int)(spritex*sin_bangle - spritey*cos_bangle + originx + 1) - 1;
-			sourcey = (int)(spritex*cos_bangle + spritey*sin_bangle + originy + 1) - 1;
-			if (sourcex < 0 || sourcex > source->w-1 || sourcey < 0 || sourcey > source->h-1
-			 || (pixel = color_swap_palette[source->p[sourcex + sourcey * source->w]])  == 0) continue;
-			destination_pixel_index = tx + ty * destination->w;
-			destination->p[destination_pixel_index] = pixel;
-		}
-	}
+	SampleRotated (source, destination, x, y, angle, originx, originy, false, false, sample_write_color_swap, 0, color_swap_palette);
 }
 
 void sprite_SampleColorSwapRotatedFlipX (const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, const u8 color_swap_palette[256]) {
-	f32 sin_angle = sin_turns(angle);
-	f32 cos_angle = cos_turns(angle);
-	f32 sin_bangle = sin_turns(angle + 0.25f);
-	f32 cos_bangle = cos_turns(angle + 0.25f);
-
-	f32 l = -originx;
-	f32 r = source->w-originx;
-	f32 b = -originy;
-	f32 t = source->h-originy;
-
-	int corners[] = {
-		(int)(l*cos_angle - b*sin_angle + x),
-		(int)(l*sin_angle + b*cos_angle + y),
-
-		(int)(l*cos_angle - t*sin_angle + x),
-		(int)(l*sin_angle + t*cos_angle + y),
-
-		(int)(r*cos_angle - b*sin_angle + x),
-		(int)(r*sin_angle + b*cos_angle + y),
-
-		(int)(r*cos_angle - t*sin_angle + x),
-		(int)(r*sin_angle + t*cos_angle + y),
-	};
-
-	int left =   MIN(destination->w-1, MAX(0, MIN(corners[0], MIN(corners[2], MIN(corners[4], corners[6])))  ));
-	int right =  MIN(destination->w-1, MAX(0, MAX(corners[0], MAX(corners[2], MAX(corners[4], corners[6])))+1));
-	int bottom = MIN(destination->h-1, MAX(0, MIN(corners[1], MIN(corners[3], MIN(corners[5], corners[7])))  ));
-	int top =    MIN(destination->h-1, MAX(0, MAX(corners[1], MAX(corners[3], MAX(corners[5], corners[7])))+1));
-
-	int tx, ty;
-	int spritex, spritey;
-	int sourcex, sourcey;
-	u8 pixel;
-	u32 destination_pixel_index;
-
-	for(ty = bottom; ty <= top; ty++){
-		for(tx = left; tx <= right; tx++){
-			spritex = tx-x;
-			spritey = ty-y;
-			sourcex = source->w-1 - ((int)(spritex*sin_bangle - spritey*cos_bangle + originx + 1) - 1);
-			sourcey =               (int)(spritex*cos_bangle + spritey*sin_bangle + originy + 1) - 1;
-			if (sourcex < 0 || sourcex > source->w-1 || sourcey < 0 || sourcey > source->h-1
-			 || (pixel = color_swap_palette[source->p[sourcex + sourcey * source->w]])  == 0) continue;
-			destination_pixel_index = tx + ty * destination->w;
-			destination->p[destination_pixel_index] = pixel;
-		}
-	}
+	SampleRotated (source, destination, x, y, angle, originx, originy, true, false, sample_write_color_swap, 0, color_swap_palette);
 }
 
 void sprite_SampleColorSwapRotatedFlipY (const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, const u8 color_swap_palette[256]) {
-	f32 sin_angle = sin_turns(angle);
-	f32 cos_angle = cos_turns(angle);
-
-	f32 l = -originx;
-	f32 r = source->w-originx;
-	f32 b = -originy;
-	f32 t = source->h-originy;
-
-	int corners[] = {
-		(int)(l*cos_angle - b*sin_angle + x),
-		(int)(l*sin_angle + b*cos_angle + y),
-
-		(int)(l*cos_angle - t*sin_angle + x),
-		(int)(l*sin_angle + t*cos_angle + y),
-
-		(int)(r*cos_angle - b*sin_angle + x),
-		(int)(r*sin_angle + b*cos_angle + y),
-
-		(int)(r*cos_angle - t*sin_angle + x),
-		(int)(r*sin_angle + t*cos_angle + y),
-	};
-
-	int left =   MIN(destination->w-1, MAX(0, MIN(corners[0], MIN(corners[2], MIN(corners[4], corners[6])))  ));
-	int right =  MIN(destination->w-1, MAX(0, MAX(corners[0], MAX(corners[2], MAX(corners[4], corners[6])))+1));
-	int bottom = MIN(destination->h-1, MAX(0, MIN(corners[1], MIN(corners[3], MIN(corners[5], corners[7])))  ));
-	int top =    MIN(destination->h-1, MAX(0, MAX(corners[1], MAX(corners[3], MAX(corners[5], corners[7])))+1));
-
-	int tx, ty;
-	int spritex, spritey;
-	int sourcex, sourcey;
-	u8 pixel;
-	u32 destination_pixel_index;
-	f32 sin_bangle = sin_turns(angle + 0.25f);
-	f32 cos_bangle = cos_turns(angle + 0.25f);
-
-	for(ty = bottom; ty <= top; ty++){
-		for(tx = left; tx <= right; tx++){
-			spritex = tx-x;
-			spritey = ty-y;
-			sourcex =               (int)(spritex*sin_bangle - spritey*cos_bangle + originx + 1) - 1;
-			sourcey = source->h-1 - ((int)(spritex*cos_bangle + spritey*sin_bangle + originy + 1) - 1);
-			if (sourcex < 0 || sourcex > source->w-1 || sourcey < 0 || sourcey > source->h-1
-			 || (pixel = color_swap_palette[source->p[sourcex + sourcey * source->w]])  == 0) continue;
-			destination_pixel_index = tx + ty * destination->w;
-			destination->p[destination_pixel_index] = pixel;
-		}
-	}
+	SampleRotated (source, destination, x, y, angle, originx, originy, false, true, sample_write_color_swap, 0, color_swap_palette);
 }
 
 void sprite_SampleColorSwapRotatedFlipped(const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, bool flipx, bool flipy, const u8 color_swap_palette[256]) {
@@ -66,6 +66,20 @@ void sprite_BlitColorSwapFlippedVertically(const sprite_t *source, sprite_t *des
 void sprite_SampleColorSwapRotated(const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, const u8 color_swap_palette[256]);
 void sprite_SampleColorSwapRotatedFlipped(const sprite_t *source, sprite_t *destination, int x, int y, f32 angle, f32 originx, f32 originy, bool flipx, bool flipy, const u8 color_swap_palette[256]);
 
+// --------------------------------------------------------------------------------
+// Opaque span tables (see sprite_spans_t)
+// Bytes of storage sprite_BuildSpans needs for this sprite.
+size_t sprite_SpansSize (const sprite_t *sprite);
+// Builds the span table into storage, which must be pointer aligned. Returns NULL if storage_size is too small. Assign the result to a sprite's spans, or to a copy of a const sprite.
+const sprite_spans_t *sprite_BuildSpans (const sprite_t *sprite, void *storage, size_t storage_size);
+// For sprites which can't carry their own table, like the const sprites in resources.c: builds one into a fixed arena (SPRITE_SPANS_ARENA_SIZE bytes, SPRITE_SPANS_MAX sprites) and looks it up by the sprite's address on each blit. Call at load from one thread, only for sprites whose pixels never change. Returns false if it's full.
+bool sprite_LoadSpans (const sprite_t *sprite);
+
+// --------------------------------------------------------------------------------
+// Row kernels used by sprite_Blit, the flipped blits and their color swap variants. The best kernel the CPU supports is picked on first use; set one explicitly to compare them. Returns the kernel actually selected, which is lower than requested if the CPU doesn't support it.
+typedef enum {sprite_blit_kernel_auto, sprite_blit_kernel_scalar, sprite_blit_kernel_sse2, sprite_blit_kernel_avx2} sprite_blit_kernel_e;
+sprite_blit_kernel_e sprite_SetBlitKernel (sprite_blit_kernel_e kernel);
+
 // --------------------------------------------------------------------------------
 
 static inline void sprite_SetPixelsToZero (sprite_t *sprite) {
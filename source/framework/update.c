@@ -46,8 +46,11 @@ static void TypeThisFrame (os_key_e key) {
 static update_state_e current_state = 0;
 static void Update_ObjectClearTopUnusedMemory ();
 static void Update_ObjectDelete (u16 index);
+static void Update_ObjectCompact ();
+static void Update_ObjectDeleteNonSurvivors ();
 static void Update_ObjectSort (u16 starting_index);
 static bool object_created_or_destroyed_this_frame = false;
+static bool object_deleted_this_frame = false; // Deleted descriptors are waiting for Update_ObjectCompact
 static struct {
 	update_state_e new_state;
 	bool happened;
@@ -194,35 +197,40 @@ void *Update(void*) {
 		object_created_or_destroyed_this_frame = false;
 
 		{	// Create a render state based on current game state
-			asm volatile("" ::: "memory");
 			Render_SelectStateToEdit ();
-			asm volatile("" ::: "memory");
 
-			for (i16 i = update_data.objects.count-1; i >= 0; --i) {
+			for (int i = update_data.objects.count-1; i >= 0; --i) {
 				const auto obj = &((update_object_t*)update_data.objects.mem)[i];
+				if (obj->deleted) continue;
 				const auto objdata = update_data.objects.mem + obj->memory_offset;
-				if (!obj->UpdateAndRender (objdata))
+				if (!obj->UpdateAndRender (objdata) && !obj->deleted)
 					Update_ObjectDelete (i);
 			}
 
 			state_functions[current_state].Update ();
 
 			ParticlesUpdate(PARTICLES_BOUNDARY_LEFT, PARTICLES_BOUNDARY_RIGHT, PARTICLES_BOUNDARY_BOTTOM, PARTICLES_BOUNDARY_TOP);
-			for (int i = 0; i < update_data.gameplay.particles.count; ++i) {
-				Render_Particle (update_data.gameplay.particles.position[i].x.high, update_data.gameplay.particles.position[i].y.high, update_data.gameplay.particles.pixel[i], false);
-			}
+			ParticlesRender ();
 
 			if (update_data.debug.show_simtime && *update_data.debug.show_simtime) {
 				char temp[64];
-					sprintf (temp, "S%4"PRId64"us", max_recorded_frame_time);
+					// Particle update time, and with worker threads the time they saved
+					const auto particle_stats = ParticlesUpdateStats ();
+					if (particle_stats.threads > 1) sprintf (temp, "S%4"PRId64"us P%4"PRIu32"us -%"PRIu32"us", max_recorded_frame_time, particle_stats.update_us, particle_stats.saved_us);
+					else sprintf (temp, "S%4"PRId64"us P%4"PRIu32"us", max_recorded_frame_time, particle_stats.update_us);
 					Render_Text (.x = 1, .y = RESOLUTION_HEIGHT-resources_framework_font.line_height*2, .string = temp, .ignore_camera = true);
 			}
+			if (update_data.debug.show_audio && *update_data.debug.show_audio) {
+				// Output latency, underruns and buffer depth in periods
+				const auto stats = SoundOutputStats ();
+				char temp[64];
+				sprintf (temp, "A%3"PRIu32"ms U%"PRIu32" x%d", stats.latency_us / 1000, stats.underruns, stats.buffer_periods);
+				Render_Text (.x = 1, .y = RESOLUTION_HEIGHT-resources_framework_font.line_height*3, .string = temp, .ignore_camera = true);
+			}
 			if (update_data.debug.show_rendertime && *update_data.debug.show_rendertime) Render_ShowRenderTime (true);
 			if (update_data.debug.show_framerate && *update_data.debug.show_framerate) Render_ShowFPS (true);
 
-			asm volatile("" ::: "memory");
 			Render_FinishEditingState ();
-			asm volatile("" ::: "memory");
 		}
 
 		update_data.frame = unedited_frameinput; // Restore input state in case game modified it
@@ -234,16 +242,11 @@ void *Update(void*) {
 			memset (update_data.frame.keyboard, 0, sizeof (update_data.frame.keyboard));
 			update_data.frame.mouse = (typeof(update_data.frame.mouse)){.x = update_data.frame.mouse.x, .y = update_data.frame.mouse.y};
 
-			for (i16 i = update_data.objects.count-1; i >= 0; --i) {
-				const auto obj = &((update_object_t*)update_data.objects.mem)[i];
-				if (!obj->survive_state_change)
-					Update_ObjectDelete (i);
-			}
-
+			Update_ObjectDeleteNonSurvivors ();
 			Update_ObjectClearTopUnusedMemory ();
 
 			#ifndef UPDATE_PARTICLES_DONT_CLEAR_ON_STATE_CHANGE
-			update_data.gameplay.particles.count = 0;
+			ParticlesClear ();
 			#endif
 
 			// update_state_e previous_state = current_state;
@@ -257,6 +260,8 @@ void *Update(void*) {
 			Update_ObjectClearTopUnusedMemory ();
 		}
 
+		if (object_deleted_this_frame)
+			Update_ObjectCompact ();
 		if (object_created_or_destroyed_this_frame)
 			Update_ObjectSort (0);
 
@@ -287,129 +292,6 @@ void *Update(void*) {
 	return NULL;
 } // Update ()
 
-#define PARTICLE_GRAVITY -2048
-
-void ParticleAdd_ (u8 pixel, int x, int y, i32 vx, i32 vy, ParticleAdd_arguments arguments) {
-	auto udata = &update_data.gameplay;
-
-	int i = udata->particles.count++;
-	if (udata->particles.count >= PARTICLES_MAX) {
-		udata->particles.count = PARTICLES_MAX;
-		i = 0;
-	}
-	udata->particles.pixel[i] = pixel;
-	udata->particles.position[i].x.high = x;
-	udata->particles.position[i].y.high = y;
-	udata->particles.position[i].x.low = 0;
-	udata->particles.position[i].y.low = 0;
-	udata->particles.velocity[i].x = vx;
-	udata->particles.velocity[i].y = vy;
-	udata->particles.gravity[i] = arguments.gravity;
-	udata->particles.time[i] = arguments.time;
-}
-
-void ParticlesUpdate (int left, int right, int bottom, int top) {
-	auto udata = &update_data.gameplay;
-
-	for (int i = 0; i < udata->particles.count; ++i) {
-		if (udata->particles.gravity[i])
-			udata->particles.velocity[i].y += PARTICLE_GRAVITY;
-		if (udata->particles.time[i]) {
-			if (--udata->particles.time[i] == 0) {
-				ParticleDelete (i--);
-				continue;
-			}
-		}
-		udata->particles.position[i].x.i32 += udata->particles.velocity[i].x;
-		udata->particles.position[i].y.i32 += udata->particles.velocity[i].y;
-		int x = udata->particles.position[i].x.high;
-		int y = udata->particles.position[i].y.high;
-		if (x < left || x > right || y < bottom || y > top) {
-			ParticleDelete (i--);
-		}
-	}
-}
-
-void ParticleDelete (int index) {
-	auto udata = &update_data.gameplay;
-
-	if (udata->particles.count == 0) return;
-	--udata->particles.count;
-	for (int i = index; i < udata->particles.count; ++i) {
-		udata->particles.position[i] = udata->particles.position[i+1];
-		udata->particles.velocity[i] = udata->particles.velocity[i+1];
-		udata->particles.pixel[i] = udata->particles.pixel[i+1];
-		udata->particles.gravity[i] = udata->particles.gravity[i+1];
-		udata->particles.time[i] = udata->particles.time[i+1];
-	}
-}
-
-void CreateParticlesFromSprite_ (const sprite_t *sprite, int x, int y, f32 direction, i32 velocity, CreateParticlesFromSprite_arguments arguments) {
-	enum {CPFSFLIP_NONE, CPFSFLIP_Y, CPFSFLIP_X, CPFSFLIP_BOTH} flip = (arguments.flipx ? 2 : 0) | (arguments.flipy ? 1 : 0);
-    auto w = sprite->w;
-    auto h = sprite->h;
-	f32 c = cos_turns (arguments.rotation);
-	f32 s = sin_turns (arguments.rotation);
-	switch (flip) {
-		case CPFSFLIP_NONE: {
-			for (int sy = 0; sy < h; ++sy) {
-				for (int sx = 0; sx < w; ++sx) {
-					u8 p = sprite->p[sx + sy * w];
-					int tx = sx - arguments.originx;
-					int ty = sy - arguments.originy;
-					int rx = c*tx - s*ty;
-					int ry = s*tx + c*ty;
-					if (p != 0)
-						ParticleAddAngleVelocity (arguments.color ? arguments.color : p, x + rx, y + ry, direction + DiscreteRandom_Rangef (&random_state, -0.01, 0.01), velocity + DiscreteRandom_Range (&random_state, -16384, 16384));
-				}
-			}
-		} break;
-		case CPFSFLIP_X: {
-			// x += w-1;
-			for (int sy = 0; sy < h; ++sy) {
-				for (int sx = 0; sx < w; ++sx) {
-					u8 p = sprite->p[sx + sy * w];
-					int tx = sx - arguments.originx;
-					int ty = sy - arguments.originy;
-					int rx = c*tx - s*ty;
-					int ry = s*tx + c*ty;
-					if (p != 0)
-						ParticleAddAngleVelocity (arguments.color ? arguments.color : p, x - rx, y + ry, direction + DiscreteRandom_Rangef (&random_state, -0.01, 0.01), velocity + DiscreteRandom_Range (&random_state, -16384, 16384));
-				}
-			}
-		} break;
-		case CPFSFLIP_Y: {
-			// y += h-1;
-			for (int sy = 0; sy < h; ++sy) {
-				for (int sx = 0; sx < w; ++sx) {
-					u8 p = sprite->p[sx + sy * w];
-					int tx = sx - arguments.originx;
-					int ty = sy - arguments.originy;
-					int rx = c*tx - s*ty;
-					int ry = s*tx + c*ty;
-					if (p != 0)
-						ParticleAddAngleVelocity (arguments.color ? arguments.color : p, x + rx, y - ry, direction + DiscreteRandom_Rangef (&random_state, -0.01, 0.01), velocity + DiscreteRandom_Range (&random_state, -16384, 16384));
-				}
-			}
-		} break;
-		case CPFSFLIP_BOTH: {
-			// x += w-1;
-			// y += h-1;
-			for (int sy = 0; sy < h; ++sy) {
-				for (int sx = 0; sx < w; ++sx) {
-					u8 p = sprite->p[sx + sy * w];
-					int tx = sx - arguments.originx;
-					int ty = sy - arguments.originy;
-					int rx = c*tx - s*ty;
-					int ry = s*tx + c*ty;
-					if (p != 0)
-						ParticleAddAngleVelocity (arguments.color ? arguments.color : p, x - rx, y - ry, direction + DiscreteRandom_Rangef (&random_state, -0.01, 0.01), velocity + DiscreteRandom_Range (&random_state, -16384, 16384));
-				}
-			}
-		} break;
-	}
-}
-
 void Update_ChangeStatePrepare_ (update_state_e new_state, const void *const data_to_copy_max_1kb, const size_t data_size) {
 	assert (new_state >= 0 && new_state < update_state_count); if (new_state < 0 || new_state >= update_state_count) { LOG ("Update new state %d out of bounds", new_state); new_state = 0; }
 
@@ -438,22 +320,49 @@ static void Update_ObjectClearTopUnusedMemory () {
 	update_data.objects.top_used = new_top;
 }
 
+// Frees the object's memory and slot straight away, but only marks its descriptor, so nothing moves while the objects are being updated. Update_ObjectCompact removes every marked descriptor in one pass at the end of the frame.
 static void Update_ObjectDelete (u16 index) {
 	assert (index < update_data.objects.count);
-	assert (update_data.objects.count > 0);
-	--update_data.objects.count;
-	
 	const auto obj = &((update_object_t*)update_data.objects.mem)[index];
+	assert (!obj->deleted);
+	obj->deleted = true;
+
 	update_object_header_t *header = (update_object_header_t*)(update_data.objects.mem + obj->memory_offset - sizeof (update_object_header_t));
 	header->used = false;
 
-	for (u16 i = index; i < update_data.objects.count; ++i) {
-		((update_object_t*)update_data.objects.mem)[i] = ((update_object_t*)update_data.objects.mem)[i+1];
-	}
+	auto slot = &update_data.objects.slots[obj->handle.index];
+	slot->generation = slot->generation == UINT16_MAX ? 1 : slot->generation + 1; // 0 is never a valid generation
+	slot->index = update_data.objects.free_slots;
+	update_data.objects.free_slots = obj->handle.index + 1;
 
+	object_deleted_this_frame = true;
 	object_created_or_destroyed_this_frame = true;
 }
 
+// Removes deleted descriptors, keeping the order of the rest
+static void Update_ObjectCompact () {
+	auto objects = (update_object_t*)update_data.objects.mem;
+	u32 kept = 0;
+	for (u32 i = 0; i < update_data.objects.count; ++i) {
+		if (objects[i].deleted) continue;
+		if (kept != i) objects[kept] = objects[i];
+		update_data.objects.slots[objects[kept].handle.index].index = kept;
+		++kept;
+	}
+	update_data.objects.count = kept;
+	update_data.objects.bottom_used = kept * sizeof (update_object_t);
+	object_deleted_this_frame = false;
+}
+
+static void Update_ObjectDeleteNonSurvivors () {
+	auto objects = (update_object_t*)update_data.objects.mem;
+	for (u32 i = 0; i < update_data.objects.count; ++i) {
+		if (!objects[i].deleted && !objects[i].survive_state_change)
+			Update_ObjectDelete (i);
+	}
+	Update_ObjectCompact ();
+}
+
 // Sort starting from index, continuing up. If 0 or 1, sort all objects.
 // Lowest layer object goes to front of array, because objects are processed from end of array back to the front.
 static void Update_ObjectSort (u16 starting_index) {
@@ -470,6 +379,9 @@ static void Update_ObjectSort (u16 starting_index) {
 		}
 		++index;
 	}
+	auto objects = (update_object_t*)update_data.objects.mem;
+	for (u32 i = 0; i < update_data.objects.count; ++i)
+		update_data.objects.slots[objects[i].handle.index].index = i;
 
 	object_created_or_destroyed_this_frame = true;
 }
@@ -481,10 +393,22 @@ update_object_t *Update_ObjectAlloc (const u32 bytes) {
 	const auto new_top = update_data.objects.top_used + object_size;
 	if (new_bottom + new_top >= UPDATE_OBJECT_MEMORY_SIZE) return NULL; // Out of memory
 
-	const auto id_ = update_data.objects.nextid++;
+	u16 slot_index;
+	if (update_data.objects.free_slots) {
+		slot_index = update_data.objects.free_slots - 1;
+		update_data.objects.free_slots = update_data.objects.slots[slot_index].index;
+	}
+	else if (update_data.objects.slots_used < UPDATE_OBJECTS_MAX) {
+		slot_index = update_data.objects.slots_used++;
+		update_data.objects.slots[slot_index].generation = 1;
+	}
+	else return NULL; // Out of slots
+	auto slot = &update_data.objects.slots[slot_index];
+	slot->index = update_data.objects.count;
+
 	auto obj = &((update_object_t*)update_data.objects.mem)[update_data.objects.count++];
 	*obj = (update_object_t) {
-		.id = id_,
+		.handle = {slot_index, slot->generation},
 		.memory_offset = UPDATE_OBJECT_MEMORY_SIZE - new_top + sizeof(update_object_header_t),
 	};
 	update_data.objects.bottom_used = new_bottom;
@@ -495,13 +419,38 @@ update_object_t *Update_ObjectAlloc (const u32 bytes) {
 	return obj;
 }
 
-u32 Update_ObjectCreate_ (const void *const data, const size_t data_size, const Update_Object_Func_t UpdateAndRenderFunc, const i8 layer, const bool survive_state_change) {
+update_object_handle_t Update_ObjectCreate_ (const void *const data, const size_t data_size, const Update_Object_Func_t UpdateAndRenderFunc, const i8 layer, const bool survive_state_change) {
 	auto obj = Update_ObjectAlloc (data_size);
+	if (obj == NULL) {
+		LOG ("Out of object memory or slots (%u objects)", update_data.objects.count);
+		return (update_object_handle_t){};
+	}
 	obj->UpdateAndRender = UpdateAndRenderFunc;
 	obj->layer = layer;
 	obj->survive_state_change = survive_state_change;
 	memcpy (&update_data.objects.mem[obj->memory_offset], data, data_size);
-	return obj->id;
+	return obj->handle;
+}
+
+// The descriptor index of the object handle refers to, or -1 if it has been deleted
+static inline int Update_ObjectFind (update_object_handle_t handle) {
+	if (handle.index >= update_data.objects.slots_used) return -1;
+	const auto slot = &update_data.objects.slots[handle.index];
+	if (handle.generation == 0 || slot->generation != handle.generation) return -1;
+	return slot->index;
+}
+
+void *Update_ObjectResolve (update_object_handle_t handle) {
+	const int index = Update_ObjectFind (handle);
+	if (index < 0) return NULL;
+	return &update_data.objects.mem[((update_object_t*)update_data.objects.mem)[index].memory_offset];
+}
+
+bool Update_ObjectDestroy (update_object_handle_t handle) {
+	const int index = Update_ObjectFind (handle);
+	if (index < 0) return false;
+	Update_ObjectDelete (index);
+	return true;
 }
 
 void *Update_ObjectMemOffsetToAddr (const u32 mem_offset) {
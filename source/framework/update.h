@@ -60,16 +60,6 @@ typedef struct update_data_s { // update_data_t
 		} mouse;
 	} frame;
 	char text_to_print[64];
-	struct {
-		struct {
-			vec2i32split_t position[PARTICLES_MAX];
-			u8 pixel[PARTICLES_MAX];
-			v2i32 velocity[PARTICLES_MAX];
-			int count;
-			bool gravity[PARTICLES_MAX];
-			int time[PARTICLES_MAX];
-		} particles;
-	} gameplay;
 	#define UPDATE_EVENTS_MAX 256
 	struct {
 		u32 count;
@@ -77,13 +67,25 @@ typedef struct update_data_s { // update_data_t
 	} events;
 	char debug_frame_time_string[64];
 	struct {
-		bool *show_simtime, *show_rendertime, *show_framerate;
+		bool *show_simtime, *show_rendertime, *show_framerate, *show_audio;
 	} debug;
+	#ifndef UPDATE_OBJECT_MEMORY_SIZE
 	#define UPDATE_OBJECT_MEMORY_SIZE 65535
+	#endif
+	#ifndef UPDATE_OBJECTS_MAX
+	#define UPDATE_OBJECTS_MAX 4096
+	#endif
+	static_assert (UPDATE_OBJECTS_MAX <= UINT16_MAX);
 	// Fixed memory buffer. Bottom contains array of object descriptors. Each object has a fixed size component in the bottom region of the memory, and a pointer to memory in the top region.
 	struct {
-		u32 bottom_used, top_used, count, nextid;
+		u32 bottom_used, top_used, count;
 		char mem[UPDATE_OBJECT_MEMORY_SIZE];
+		// What handles index. A live slot holds its object's descriptor index. A free one holds the next free slot plus one, and its generation has moved on from the last handle given out for it.
+		struct {
+			u16 generation, index;
+		} slots[UPDATE_OBJECTS_MAX];
+		u32 slots_used; // Slots ever handed out. The rest have never been used.
+		u32 free_slots; // Head of the free list plus one, or 0 if it's empty
 	} objects;
 } update_data_t;
 
@@ -92,24 +94,6 @@ void Update_ClearInputMouse ();
 void Update_ClearInputMouseButtons ();
 void Update_ClearInputKeyboard ();
 
-typedef struct {
-	bool gravity;
-	int time;
-} ParticleAdd_arguments;
-#define ParticleAdd(pixel, x, y, vx, vy, ...) ParticleAdd_ (pixel, x, y, vx, vy, (ParticleAdd_arguments){.gravity = true, .time = -1, __VA_ARGS__})
-void ParticleAdd_ (u8 pixel, int x, int y, i32 vx, i32 vy, ParticleAdd_arguments arguments);
-#define ParticleAddAngleVelocity(pixel, x, y, angle, velocity, ...) ParticleAdd (pixel, x, y, cos_turns (angle) * velocity, sin_turns (angle) * velocity, __VA_ARGS__)
-void ParticlesUpdate (int left, int right, int bottom, int top);
-void ParticleDelete (int index);
-typedef struct {
-	f32 rotation;
-	bool flipx, flipy;
-	int originx, originy;
-	u8 color;
-} CreateParticlesFromSprite_arguments;
-#define CreateParticlesFromSprite(sprite, x, y, direction, velocity, ...) CreateParticlesFromSprite_ (sprite, x, y, direction, velocity, (CreateParticlesFromSprite_arguments){__VA_ARGS__})
-void CreateParticlesFromSprite_ (const sprite_t *sprite, int x, int y, f32 direction, i32 velocity, CreateParticlesFromSprite_arguments arguments);
-
 #define UPDATE_CHANGE_STATE_DATA_SIZE_MAX 1024
 
 // Careful calling this! The second argument must either be missing, or some data to be instantly copied to a 1KB buffer.
@@ -133,12 +117,18 @@ void Update_RunAfterStateChange (void (*func)());
 
 typedef bool (*Update_Object_Func_t) (const void *self);
 
+// Refers to one object for as long as it lives. Once the object is deleted its handle resolves to NULL, even after the slot is reused by another object. The zero handle never refers to an object.
+typedef struct {
+	u16 index, generation;
+} update_object_handle_t;
+
 typedef struct [[gnu::packed]] {
-	u32 id;
+	update_object_handle_t handle;
 	u32 memory_offset;
 	Update_Object_Func_t UpdateAndRender;
 	i8 layer; // Objects are ordered by layer - higher layer means processed first. Objects in higher layers may occlude input from objects in lower layers.
 	bool survive_state_change : 1;
+	bool deleted : 1; // Skipped by the update, and removed from the descriptor array at the end of the frame
 } update_object_t;
 
 // Placed at the base address of every object's memory
@@ -147,7 +137,8 @@ typedef struct {
 	u32 size : 31;
 } update_object_header_t;
 
-u32 Update_ObjectCreate_ (const void *const data, const size_t data_size, const Update_Object_Func_t UpdateAndRenderFunc, const i8 layer, const bool survive_state_change);
+// Returns the zero handle if there's no memory or slot left for the object
+update_object_handle_t Update_ObjectCreate_ (const void *const data, const size_t data_size, const Update_Object_Func_t UpdateAndRenderFunc, const i8 layer, const bool survive_state_change);
 
 // 4th argument is your object, which can be initialized as (object_t){a, b, c}
 #define Update_ObjectCreate(update_and_render_func__, layer__, survive_state_change__, ...) \
@@ -163,5 +154,10 @@ update_object_t *Update_ObjectAlloc (const u32 bytes);
 
 void *Update_ObjectMemOffsetToAddr (const u32 mem_offset);
 
+// The object's memory, or NULL if it has been deleted
+void *Update_ObjectResolve (update_object_handle_t handle);
+// Deletes the object. It isn't updated again, even later this frame, and its handle stops resolving straight away. Returns false if it was already deleted.
+bool Update_ObjectDestroy (update_object_handle_t handle);
+
 typeof((update_data_t){}.frame) *Update_FrameInput ();
 typeof((update_data_t){}.frame) Update_GetUneditedFrameInputState ();
@@ -74,6 +74,11 @@ const WAVEFORMATEX wave_format = {
 };
 
 void *Sound (void *data_void) {
+    const char *argument;
+    if (const sound_backend_t *backend = SoundBackendRequested (&argument)) {
+        SoundRunBackend (backend, argument);
+        return NULL;
+    }
     sample_buffer_size = PERIOD_SIZE;
     DO_OR_QUIT (CoInitializeEx(NULL, COINIT_MULTITHREADED), "Sound thread failed to CoInitializeEx");
 
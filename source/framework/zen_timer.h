@@ -83,6 +83,13 @@ static inline i64  zen_End (zen_timer_t *timer) {
 	return (timer->end.QuadPart - timer->start.QuadPart) / zen_internal.ticks_per_microsecond;
 }
 
+// Returns the current time in nanoseconds, for timing things too short for zen_Start/zen_End to resolve.
+static inline i64 zen_nTime () {
+	LARGE_INTEGER time;
+	QueryPerformanceCounter(&time);
+	return time.QuadPart * 1000 / zen_internal.ticks_per_microsecond;
+}
+
 static inline void zen_Split (zen_split_timer_t *timer, const char *name) {
 	if (timer->current >= SPLIT_TIMER_MAX) return;
 	timer->splits[timer->current] = zen_End (&timer->timer);
@@ -159,6 +166,13 @@ static inline i64  zen_End (zen_timer_t *timer) {
 	return timer->end - timer->start;
 }
 
+// Returns the current time in nanoseconds, for timing things too short for zen_Start/zen_End to resolve.
+static inline i64 zen_nTime () {
+	struct timespec time;
+	clock_gettime (CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000000000   +   time.tv_nsec;
+}
+
 static inline void zen_Split (zen_split_timer_t *timer, const char *name) {
 	if (timer->current >= SPLIT_TIMER_MAX) return;
 	timer->splits[timer->current] = zen_End (&timer->timer);
@@ -234,6 +248,13 @@ static inline i64  zen_End (zen_timer_t *timer) {
 	return timer->end - timer->start;
 }
 
+// Returns the current time in nanoseconds, for timing things too short for zen_Start/zen_End to resolve.
+static inline i64 zen_nTime () {
+	struct timespec time;
+	clock_gettime (CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000000000   +   time.tv_nsec;
+}
+
 static inline void zen_Split (zen_split_timer_t *timer, const char *name) {
 	if (timer->current >= SPLIT_TIMER_MAX) return;
 	timer->splits[timer->current] = zen_End (&timer->timer);
@@ -31,6 +31,7 @@ const update_state_functions_t state_functions[update_state_count] = {
 
 extern const cereal_t cereal_options[];
 extern const size_t cereal_options_size;
+extern const sound_t sound_coin;
 
 char config_filename[560];
 char game_save_file[600];
@@ -54,9 +55,16 @@ void game_Init (const void *const ignore) {
 	snprintf (game_save_file, sizeof(game_save_file), "%s/%s/high_score", os_public.directories.savegame, GAME_FOLDER_SAVES);
 	cereal_ReadFromFile(cereal_savedata, cereal_savedata_size, game_save_file);
 
+	// Opaque span tables for the sprites drawn every frame. The heli is only ever drawn rotated, which doesn't use them.
+	sprite_LoadSpans (&resources_gameplay_pipe_top);
+	sprite_LoadSpans (&resources_gameplay_pipe_body);
+	sprite_LoadSpans (&resources_gameplay_coin);
+	SoundFXCache (&sound_coin); // Rendered before the first coin is picked up
+
 	update_data.debug.show_framerate = &submenu_vars.debug.show_framerate;
 	update_data.debug.show_rendertime = &submenu_vars.debug.show_rendertime;
 	update_data.debug.show_simtime = &submenu_vars.debug.show_simtime;
+	update_data.debug.show_audio = &submenu_vars.debug.show_audio;
 
 	Update_ChangeState (update_state_menu);
 }
@@ -103,6 +111,7 @@ const cereal_t cereal_options[] = {
 	{"Debug show FPS", cereal_bool, &submenu_vars.debug.show_framerate},
 	{"Debug show simulation time", cereal_bool, &submenu_vars.debug.show_simtime},
 	{"Debug show render time", cereal_bool, &submenu_vars.debug.show_rendertime},
+	{"Debug show audio latency", cereal_bool, &submenu_vars.debug.show_audio},
 };
 const size_t cereal_options_size = sizeof (cereal_options) / sizeof (*cereal_options);
 
@@ -161,11 +170,12 @@ submenu_t submenus_options[] = {
 		.type = menu_type_list,
 		.retain_selection = true,
 		.list = {
-			.item_count = 6,
+			.item_count = 7,
 			.items = {
 				{.name = "Framerate", .type = menu_list_item_type_toggle, .toggle.var = &submenu_vars.debug.show_framerate},
 				{.name = "Simulation time", .type = menu_list_item_type_toggle, .toggle.var = &submenu_vars.debug.show_simtime},
 				{.name = "Rendering time", .type = menu_list_item_type_toggle, .toggle.var = &submenu_vars.debug.show_rendertime},
+				{.name = "Audio latency", .type = menu_list_item_type_toggle, .toggle.var = &submenu_vars.debug.show_audio},
 				{.name = "Open config/log folder", .type = menu_list_item_type_function, .Function = menu_Options_Debug_OpenFolder},
 				{.name = "Open save data folder", .type = menu_list_item_type_function, .Function = menu_Options_Debug_OpenSaveFolder},
 				{.name = "Back", .type = menu_list_item_type_submenu, .submenu = NULL},
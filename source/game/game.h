@@ -22,7 +22,7 @@ typedef struct {
 	u8 music_volume, fx_volume;
 	bool fullscreen;
 	struct {
-		bool show_framerate, show_simtime, show_rendertime;
+		bool show_framerate, show_simtime, show_rendertime, show_audio;
 	} debug;
 } submenu_vars_t;
 extern submenu_vars_t submenu_vars;
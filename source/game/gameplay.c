@@ -54,7 +54,7 @@ static u64 random_state;
 
 #define ADSR_DEFAULT ((ADSR_t){.peak = .5, .sustain = .4, .attack = 48000 * .01, .decay = 48000 * .005, .release = 48000 * .01})
 const sound_t sound_coin2 = {.waveform = sound_waveform_sine, .duration = 48000 * .1, .frequency = 2000, .ADSR = ADSR_DEFAULT};
-const sound_t sound_coin = {.waveform = sound_waveform_sine, .duration = 48000 * .1, .next = &sound_coin2, .frequency = 1600, .ADSR = ADSR_DEFAULT};
+const sound_t sound_coin = {.waveform = sound_waveform_sine, .duration = 48000 * .1, .next = &sound_coin2, .frequency = 1600, .ADSR = ADSR_DEFAULT, .cache = true};
 
 void gameplay_Exit ();
 void PipeGenerate (int i);